@@ -0,0 +1,168 @@
+#include "page_pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+struct _page_pool_t
+{
+    vmTable_t *frames;
+    size_t number_of_frames;
+    size_t mapped_frames;
+    size_t next_free; // where to start looking for an unmapped frame
+    eviction_policy_t *policy;
+
+    // page number -> frame, chained through vmTable_t.next
+    vmTable_t **buckets;
+    size_t bucket_mask;
+};
+
+static inline size_t bucket_of(page_pool_t *pool, size_t page_number)
+{
+    return page_number & pool->bucket_mask;
+}
+
+page_pool_t *page_pool_init(size_t page_size, size_t number_of_frames, eviction_policy_type_t policy)
+{
+    assert(number_of_frames > 0);
+    page_pool_t *pool = (page_pool_t *)malloc(sizeof(page_pool_t));
+    assert(pool);
+    pool->number_of_frames = number_of_frames;
+    pool->mapped_frames = 0;
+    pool->next_free = 0;
+    pool->policy = eviction_policy_init(policy, number_of_frames);
+
+    pool->frames = (vmTable_t *)calloc(number_of_frames, sizeof(vmTable_t));
+    assert(pool->frames);
+    for (size_t i = 0; i < number_of_frames; i++)
+    {
+        pool->frames[i].page_cache = (uint8_t *)malloc(sizeof(uint8_t) * page_size);
+        assert(pool->frames[i].page_cache);
+    }
+
+    size_t number_of_buckets = 1;
+    while (number_of_buckets < number_of_frames)
+    {
+        number_of_buckets <<= 1;
+    }
+    pool->bucket_mask = number_of_buckets - 1;
+    pool->buckets = (vmTable_t **)calloc(number_of_buckets, sizeof(vmTable_t *));
+    assert(pool->buckets);
+    return pool;
+}
+
+size_t page_pool_count(page_pool_t *pool)
+{
+    return pool->mapped_frames;
+}
+
+vmTable_t *page_pool_lookup(page_pool_t *pool, size_t page_number)
+{
+    vmTable_t *frame = pool->buckets[bucket_of(pool, page_number)];
+    while (frame != NULL && frame->page_number != page_number)
+    {
+        frame = frame->next;
+    }
+    return frame;
+}
+
+void page_pool_touch(page_pool_t *pool, vmTable_t *frame)
+{
+    eviction_policy_access(pool->policy, frame - pool->frames);
+}
+
+static bool can_evict_frame(void *context, size_t slot)
+{
+    page_pool_t *pool = context;
+    return pool->frames[slot].pin_count == 0;
+}
+
+vmTable_t *page_pool_select_victim(page_pool_t *pool, size_t page_number)
+{
+    if (pool->mapped_frames < pool->number_of_frames)
+    {
+        while (pool->frames[pool->next_free].mapped)
+        {
+            pool->next_free = (pool->next_free + 1) % pool->number_of_frames;
+        }
+        return &pool->frames[pool->next_free];
+    }
+
+    size_t slot = eviction_policy_victim(pool->policy, page_number, can_evict_frame, pool);
+    if (slot == EVICTION_POLICY_NONE)
+    {
+        return NULL;
+    }
+    return &pool->frames[slot];
+}
+
+size_t page_pool_select_victims(page_pool_t *pool, size_t page_number, vmTable_t **victims, size_t count)
+{
+    size_t number_of_victims = 0;
+    while (number_of_victims < count)
+    {
+        size_t slot = eviction_policy_victim(pool->policy, page_number, can_evict_frame, pool);
+        if (slot == EVICTION_POLICY_NONE)
+        {
+            break;
+        }
+        victims[number_of_victims++] = &pool->frames[slot];
+    }
+    return number_of_victims;
+}
+
+void page_pool_map(page_pool_t *pool, vmTable_t *frame, size_t page_number, size_t page_address)
+{
+    assert(!frame->mapped);
+    frame->page_number = page_number;
+    frame->page_address = page_address;
+    frame->dirty = false;
+    frame->pin_count = 0;
+    frame->write_pin_count = 0;
+    frame->mapped = true;
+    frame->prefetched = false;
+    eviction_policy_insert(pool->policy, frame - pool->frames, page_number);
+
+    vmTable_t **bucket = &pool->buckets[bucket_of(pool, page_number)];
+    frame->next = *bucket;
+    *bucket = frame;
+    pool->mapped_frames++;
+}
+
+void page_pool_unmap(page_pool_t *pool, vmTable_t *frame)
+{
+    assert(frame->mapped);
+    vmTable_t **link = &pool->buckets[bucket_of(pool, frame->page_number)];
+    while (*link != frame)
+    {
+        link = &(*link)->next;
+    }
+    *link = frame->next;
+    frame->next = NULL;
+    frame->mapped = false;
+    eviction_policy_remove(pool->policy, frame - pool->frames);
+    pool->mapped_frames--;
+}
+
+void page_pool_foreach(page_pool_t *pool, void (*callback)(vmTable_t *frame, void *context), void *context)
+{
+    for (size_t i = 0; i < pool->number_of_frames; i++)
+    {
+        if (pool->frames[i].mapped)
+        {
+            callback(&pool->frames[i], context);
+        }
+    }
+}
+
+void page_pool_free(page_pool_t *pool)
+{
+    for (size_t i = 0; i < pool->number_of_frames; i++)
+    {
+        free(pool->frames[i].page_cache);
+    }
+    free(pool->frames);
+    free(pool->buckets);
+    eviction_policy_free(pool->policy);
+    free(pool);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stddef.h>
+#include "vmtable.h"
+#include <eviction_policy.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// fixed size pool of page frames replaced by an eviction policy,
+// frames, buffers, the page index and the policy state are allocated once in page_pool_init
+// so mapping and evicting pages never touches the heap
+
+struct _page_pool_t;
+typedef struct _page_pool_t page_pool_t;
+
+page_pool_t *page_pool_init(size_t page_size, size_t number_of_frames, eviction_policy_type_t policy);
+
+size_t page_pool_count(page_pool_t *pool);
+
+/* returns the frame holding page_number or NULL, does not count as an access */
+vmTable_t *page_pool_lookup(page_pool_t *pool, size_t page_number);
+
+/* reports an access to the eviction policy */
+void page_pool_touch(page_pool_t *pool, vmTable_t *frame);
+
+/* returns a free frame, or an unpinned frame chosen by the policy to make room for page_number,
+   which is still mapped and must be written back and unmapped by the caller.
+   returns NULL when every frame is pinned */
+vmTable_t *page_pool_select_victim(page_pool_t *pool, size_t page_number);
+
+/* chooses up to count unpinned frames with the policy to make room for page_number and the pages after it,
+   the victims are still mapped and must be written back and unmapped by the caller.
+   returns the number of victims */
+size_t page_pool_select_victims(page_pool_t *pool, size_t page_number, vmTable_t **victims, size_t count);
+
+void page_pool_map(page_pool_t *pool, vmTable_t *frame, size_t page_number, size_t page_address);
+
+void page_pool_unmap(page_pool_t *pool, vmTable_t *frame);
+
+/* calls callback for every mapped frame, the callback may unmap the frame */
+void page_pool_foreach(page_pool_t *pool, void (*callback)(vmTable_t *frame, void *context), void *context);
+
+void page_pool_free(page_pool_t *pool);
+
+#ifdef __cplusplus
+}
+#endif
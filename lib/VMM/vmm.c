@@ -7,6 +7,7 @@
 #include <inttypes.h>
 
 #include <string.h>
+#include <stdlib.h>
 #include <assert.h>
 
 #include <time.h>
@@ -20,6 +21,16 @@
 
 #include <sys/time.h>
 
+#ifdef ESP32
+#include <esp_timer.h>
+#endif
+
+#if defined(__linux__) && !defined(ESP32)
+#define VMM_HAS_MMAP
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #define MAX(x, y) (((x) > (y)) ? (x) : (y))
 #define MIN(x, y) (((x) < (y)) ? (x) : (y))
@@ -34,27 +45,53 @@ static void backing_store_read(VMM_t *vmm, size_t page_number, uint8_t *buf, con
 
 static void free_vmtable(VMM_t *vmm, vmTable_t *entry);
 
-static vmTable_t *new_vmtable(VMM_t *vmm);
-
-static vmTable_t *find_empty_TLB(VMM_t *vmm);
+static vmTable_t *find_empty_TLB(VMM_t *vmm, size_t page_number);
 
 static void load_page(VMM_t *vmm, size_t page_number, vmTable_t *page);
 
+static void snapshot_close(VMM_t *vmm);
+
+static void index_close(VMM_t *vmm);
+
 VMM_t *vmm_create(const char *pagefile, size_t maximum_size, size_t page_size, size_t number_of_pages, size_t maximum_himem_blocks);
 
+static VMM_t *vmm_create_paged(const char *pagefile, size_t maximum_size, size_t page_size, size_t number_of_pages, size_t maximum_himem_blocks, eviction_policy_type_t policy, const uint64_t *generation);
+
 void vmm_destroy(VMM_t *vmm);
 
 void vmm_read(VMM_t *vmm, size_t addr, void *target, size_t len);
 
 void vmm_write(VMM_t *vmm, const size_t addr, const void *source, const size_t len);
 
-static vmTable_t *get_page(VMM_t *vmm, size_t addr);
+static vmTable_t *get_page(VMM_t *vmm, size_t addr, vmm_access_t access);
+
+#ifdef VMM_TRACE
+static void trace_start_default(VMM_t *vmm);
+#endif
 
 void vmm_flush(VMM_t *vmm);
 
-int compare_page_number(const void *e1, const void *e2)
+static inline int64_t vmm_time_us(void)
+{
+#ifdef ESP32
+    return esp_timer_get_time();
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+static inline void record_latency(size_t *histogram, int64_t start_us)
 {
-    return (intptr_t)e1 - (intptr_t)e2;
+    int64_t elapsed = vmm_time_us() - start_us;
+    size_t bucket = 0;
+    while (elapsed > 0 && bucket < VMM_LATENCY_BUCKETS - 1)
+    {
+        elapsed >>= 1;
+        bucket++;
+    }
+    histogram[bucket]++;
 }
 
 static inline size_t get_page_number_by_address(VMM_t *vmm, size_t address)
@@ -70,371 +107,1494 @@ static vmTable_t *get_TLB(VMM_t *vmm, size_t page_number)
     vmTable_t *value = direct_cache_get(vmm->direct_cache, (void *)page_number);
     if (value != NULL)
     {
-        return value;
+        vmm->stats.direct_cache_hits++;
+    }
+    else
+    {
+        value = page_pool_lookup(vmm->page_pool, page_number);
+        if (value != NULL)
+        {
+            vmm->stats.page_pool_hits++;
+        }
     }
 
-    value = lru_cache_get(vmm->lru_cache, (void *)page_number);
     if (value != NULL)
     {
+        if (value->prefetched)
+        {
+            value->prefetched = false;
+            vmm->stats.readahead_hits++;
+        }
+        page_pool_touch(vmm->page_pool, value);
         return value;
     }
     log_trace("did not find TLB");
     return NULL;
 }
 
-static void on_page_cache_flush(size_t page_number, void * buf, void * flush_context){
+static void on_page_cache_flush(size_t page_number, void * buf, size_t number_of_pages, void * flush_context){
     VMM_t * vmm = flush_context;
+    const size_t length = number_of_pages * vmm->page_size;
+    int64_t start_us = vmm_time_us();
     if (fseek(vmm->backing_store, page_number * vmm->page_size, SEEK_SET) != 0)
     {
         log_warn("Error seeking in backing store");
     }
 
-    if (fwrite(buf, sizeof(uint8_t), vmm->page_size, vmm->backing_store) != vmm->page_size)
+    if (fwrite(buf, sizeof(uint8_t), length, vmm->backing_store) != length)
     {
         log_error("Error writing to backing store\n");
     }
+    vmm->stats.store_writes += number_of_pages;
+    vmm->stats.store_write_bytes += length;
+    vmm->stats.store_write_requests++;
+    record_latency(vmm->stats.store_write_latency, start_us);
 }
 
-static void backing_store_write(VMM_t *vmm, size_t page_number, const uint8_t *buf, const size_t buf_len)
+static void on_compressed_evict(size_t page_number, void *buf, void *context)
 {
-#ifdef VMM_DEBUG
-    struct timeval tv_start;
-    gettimeofday(&tv_start, NULL);
-#endif
-    // if (fseek(vmm->backing_store, page_number * vmm->page_size, SEEK_SET) != 0)
-    // {
-    //     log_warn("Error seeking in backing store");
-    // }
-
-    // // now vmm_read PAGE_READ_SIZE bytes from the backing store to the fileReadBuffer
-    // if (fwrite(buf, sizeof(uint8_t), buf_len, vmm->backing_store) != buf_len)
-    // {
-    //     log_error("Error writing to backing store\n");
-    // }
-
-    page_cache_set(vmm->page_cache,page_number, buf);
-#ifdef VMM_DEBUG
-    struct timeval tv_end;
-    gettimeofday(&tv_end, NULL);
-
-    float t_s = tv_end.tv_sec - tv_start.tv_sec + 1e-6f * (tv_end.tv_usec - tv_start.tv_usec);
-    vmm->store_write_time += (t_s * 1e3);
-
-    vmm->store_writes++;
-    vmm->store_write_bytes += buf_len;
-#endif
+    VMM_t *vmm = (VMM_t *)context;
+    page_cache_set(vmm->page_cache, page_number, buf);
 }
 
-static void backing_store_read(VMM_t *vmm, size_t page_number, uint8_t *buf, const size_t buf_len)
+// a page lives in one of the tiers, a page already in the page cache stays there
+static void store_page(VMM_t *vmm, size_t page_number, const uint8_t *buf)
 {
-#ifdef VMM_DEBUG
-    struct timeval tv_start;
-    gettimeofday(&tv_start, NULL);
-#endif
-
-    if (!page_cache_get(vmm->page_cache, page_number, buf))
+    if (vmm->compressed_cache != NULL && !page_cache_contains(vmm->page_cache, page_number))
     {
-
-        if (fseek(vmm->backing_store, page_number * vmm->page_size, SEEK_SET) != 0)
+        if (compressed_cache_set(vmm->compressed_cache, page_number, buf))
         {
-            log_warn("Error seeking in backing store, page %d\n", page_number);
-            *(uint8_t *)(0) = 1;
-        }
-
-        if (fread(buf, sizeof(uint8_t), buf_len, vmm->backing_store) == 0)
-        {
-            memset(buf, 0, buf_len);
-            log_error("Error reading from backing store\n");
+            vmm->stats.compressed_stores++;
+            return;
         }
+        vmm->stats.compressed_rejects++;
     }
-#ifdef VMM_DEBUG
-    struct timeval tv_end;
-    gettimeofday(&tv_end, NULL);
+    page_cache_set(vmm->page_cache, page_number, (void *)buf);
+}
 
-    float t_s = tv_end.tv_sec - tv_start.tv_sec + 1e-6f * (tv_end.tv_usec - tv_start.tv_usec);
-    vmm->store_read_time += (t_s * 1e3);
+// never written pages and pages written back as all zeros are not kept in any tier
+static inline bool is_zero_page(VMM_t *vmm, size_t page_number)
+{
+    return (vmm->zero_pages[page_number / 8] >> (page_number % 8)) & 1;
+}
 
-    vmm->store_reads++;
-    vmm->store_read_bytes += buf_len;
-#endif
+static inline void set_zero_page(VMM_t *vmm, size_t page_number, bool zero)
+{
+    if (zero)
+    {
+        vmm->zero_pages[page_number / 8] |= 1 << (page_number % 8);
+    }
+    else
+    {
+        vmm->zero_pages[page_number / 8] &= ~(1 << (page_number % 8));
+    }
 }
 
-static void free_vmtable(VMM_t *vmm, vmTable_t *entry)
+static inline bool is_snapshot_page(VMM_t *vmm, size_t page_number)
 {
-    lru_cache_remove(vmm->lru_cache, (void *)entry->page_number);
-    direct_cache_remove(vmm->direct_cache, (void *)entry->page_number);
-    free(entry->page_cache);
-    entry->page_cache = NULL;
-    free(entry); 
+    return vmm->snapshot_pages != NULL && ((vmm->snapshot_pages[page_number / 8] >> (page_number % 8)) & 1);
 }
 
-static vmTable_t *new_vmtable(VMM_t *vmm)
+static inline void clear_snapshot_page(VMM_t *vmm, size_t page_number)
 {
-    vmTable_t *entry = (vmTable_t *)malloc(sizeof(vmTable_t));
-    assert(entry);
-    entry->page_cache = (uint8_t *)malloc(sizeof(uint8_t) * vmm->page_size);
-    assert(entry->page_cache);
-    return entry;
+    if (vmm->snapshot_pages != NULL)
+    {
+        vmm->snapshot_pages[page_number / 8] &= ~(1 << (page_number % 8));
+    }
 }
 
-static vmTable_t *find_empty_TLB(VMM_t *vmm)
+static void snapshot_read(VMM_t *vmm, size_t page_number, uint8_t *buf)
 {
-    log_trace("looking for empty TLB in pagetable (%d items)", vmm->pagetable_size);
-    if (vmm->pagetable_size >= vmm->number_of_pages)
+    size_t low = 0;
+    size_t high = vmm->snapshot_count;
+    while (low < high)
     {
-        vmTable_t *last_page = lru_cache_get_least_recently_used(vmm->lru_cache);
-        if (last_page != NULL)
+        size_t middle = (low + high) / 2;
+        if (vmm->snapshot_index[middle] < page_number)
         {
-            free_vmtable(vmm, last_page);
-            vmm->pagetable_size--;
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
         }
     }
+    assert(low < vmm->snapshot_count && vmm->snapshot_index[low] == page_number);
 
-#ifdef VMM_DEBUG
-    vmm->page_faults++;
-#endif
-    vmTable_t *page = new_vmtable(vmm);
-    vmm->pagetable_size++;
-#ifdef VMM_DEBUG
-    if ((vmm->page_faults % 1000 == 0))
+    int64_t start_us = vmm_time_us();
+    if (fseek(vmm->snapshot, vmm->snapshot_data + (long)(low * vmm->page_size), SEEK_SET) != 0 ||
+        fread(buf, sizeof(uint8_t), vmm->page_size, vmm->snapshot) != vmm->page_size)
     {
-        printf("page fault %zu, read %zu (%zu bytes), write %zu (%zu bytes), store read %zu (%zu bytes %zu ms), store write %zu (%zu bytes %zu ms)\r\n",
-               vmm->page_faults,
-               vmm->reads, vmm->read_bytes,
-               vmm->writes, vmm->write_bytes,
-               vmm->store_reads, vmm->store_read_bytes,
-               vmm->store_read_time,
-               vmm->store_writes, vmm->store_write_bytes,
-               vmm->store_write_time);
+        log_error("Error reading page %d from snapshot\n", page_number);
+        memset(buf, 0, vmm->page_size);
     }
-#endif
-    return page;
+    vmm->stats.snapshot_reads++;
+    record_latency(vmm->stats.store_read_latency, start_us);
 }
 
-static void load_page(VMM_t *vmm, size_t page_number, vmTable_t *page)
+static inline bool is_persistent_page(VMM_t *vmm, size_t page_number)
 {
-    backing_store_read(vmm, page_number, page->page_cache, vmm->page_size);
+    return vmm->persistent_pages != NULL && ((vmm->persistent_pages[page_number / 8] >> (page_number % 8)) & 1);
 }
 
-void on_page_flush(void *key, void *value, void *context)
+static void index_filename(VMM_t *vmm, char *filename, size_t size)
 {
-    VMM_t *vmm = (VMM_t *)context;
-    vmTable_t *page = value;
-    if (page->dirty)
+    snprintf(filename, size, "%s.idx", vmm->filename);
+}
+
+// a broken index is removed, the next run recreates the pagefile
+static void index_drop(VMM_t *vmm)
+{
+    char filename[260];
+    index_filename(vmm, filename, sizeof(filename));
+    log_error("error writing %s, the pagefile is not kept", filename);
+    index_close(vmm);
+    remove(filename);
+}
+
+// the bit is cleared on disk before the new contents can reach the pagefile
+static void clear_persistent_page(VMM_t *vmm, size_t page_number)
+{
+    if (!is_persistent_page(vmm, page_number))
     {
-        log_trace("flushing 0x%" PRIx64 ", at %d", page->page_address, page->page_number * vmm->page_size);
-        backing_store_write(vmm, page->page_number, page->page_cache, vmm->page_size);
-        page->dirty = false;
+        return;
+    }
+    vmm->persistent_pages[page_number / 8] &= ~(1 << (page_number % 8));
+    if (fseek(vmm->index, VMM_PAGEFILE_INDEX_HEADER + page_number / 8, SEEK_SET) != 0 ||
+        fwrite(&vmm->persistent_pages[page_number / 8], 1, 1, vmm->index) != 1 ||
+        fflush(vmm->index) != 0)
+    {
+        index_drop(vmm);
     }
 }
 
+static bool page_is_zero(const uint8_t *buf, size_t length)
+{
+    const uint32_t *words = (const uint32_t *)buf;
+    for (size_t i = 0; i < length / sizeof(uint32_t); i++)
+    {
+        if (words[i] != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
 
-
-VMM_t *vmm_create(const char *pagefile, size_t maximum_size, size_t page_size, size_t number_of_pages, size_t maximum_himem_blocks)
+static void backing_store_write(VMM_t *vmm, size_t page_number, const uint8_t *buf, const size_t buf_len)
 {
-    log_info("creating vmm %s size: %zu, page: %zu, pages: %zu, total: %zu\r\n",
-           pagefile, maximum_size, page_size, number_of_pages, page_size * number_of_pages);
-    VMM_t *vmm = (VMM_t *)malloc(sizeof(VMM_t));
-    assert(vmm);
-    vmm->pagetable_size = 0;
-    strcpy((char *)&vmm->filename, pagefile);
+    // if (fseek(vmm->backing_store, page_number * vmm->page_size, SEEK_SET) != 0)
+    // {
+    //     log_warn("Error seeking in backing store");
+    // }
 
-    vmm->page_size = page_size;
-    vmm->number_of_pages = number_of_pages;
+    // // now vmm_read PAGE_READ_SIZE bytes from the backing store to the fileReadBuffer
+    // if (fwrite(buf, sizeof(uint8_t), buf_len, vmm->backing_store) != buf_len)
+    // {
+    //     log_error("Error writing to backing store\n");
+    // }
 
-#ifdef VMM_DEBUG
-    vmm->reads = 0;
-    vmm->read_bytes = 0;
-    vmm->writes = 0;
-    vmm->write_bytes = 0;
+    clear_snapshot_page(vmm, page_number);
 
-    vmm->store_writes = 0;
-    vmm->store_write_bytes = 0;
-    vmm->store_reads = 0;
-    vmm->store_read_bytes = 0;
+    // older copies in the other tiers are never read while the zero bit is set
+    if (page_is_zero(buf, buf_len))
+    {
+        set_zero_page(vmm, page_number, true);
+        vmm->stats.zero_writebacks++;
+        return;
+    }
+    set_zero_page(vmm, page_number, false);
+    clear_persistent_page(vmm, page_number);
 
-    vmm->page_faults = 0;
-#endif
+    if (vmm->write_behind != NULL)
+    {
+        if (write_behind_push(vmm->write_behind, page_number, buf))
+        {
+            vmm->stats.write_behind_stalls++;
+        }
+    }
+    else
+    {
+        store_page(vmm, page_number, buf);
+    }
+    vmm->stats.dirty_writebacks++;
+}
 
-    vmm->lru_cache = lru_cache_init(compare_page_number, on_page_flush, vmm);
-    vmm->direct_cache = direct_cache_init(1024 * 8);
-    vmm->page_cache = page_cache_init(page_size,maximum_himem_blocks, on_page_cache_flush, vmm);
+static void on_write_behind(void *context, size_t page_number, const uint8_t *page)
+{
+    VMM_t *vmm = (VMM_t *)context;
+    store_page(vmm, page_number, page);
+}
 
-    log_trace("creating page file %s of %d", pagefile, maximum_size);
-    FILE *create_f = fopen(pagefile, "wb");
-    if (!create_f)
+// the page cache and backing store are shared with the write-behind writer
+static inline void store_lock(VMM_t *vmm)
+{
+    if (vmm->write_behind != NULL)
     {
-        log_error("fopen() failed");
+        write_behind_lock_store(vmm->write_behind);
     }
-    if (setvbuf(create_f, NULL, _IOFBF, 1024 * 8) != 0)
+}
+
+static inline void store_unlock(VMM_t *vmm)
+{
+    if (vmm->write_behind != NULL)
     {
-        perror("setvbuf");
+        write_behind_unlock_store(vmm->write_behind);
     }
-    if (fseek(create_f, maximum_size, SEEK_SET) != 0)
+}
+
+static void backing_store_read(VMM_t *vmm, size_t page_number, uint8_t *buf, const size_t buf_len)
+{
+    // a queued page leaves the queue only after the writer stored it
+    if (vmm->write_behind != NULL && write_behind_read(vmm->write_behind, page_number, buf))
     {
-        log_error("fseek() failed");
+        vmm->stats.write_behind_hits++;
+        return;
     }
-    if (fputc('\0', create_f) != '\0')
+
+    // pages of a resumed snapshot are not in any tier until they are written back
+    if (is_snapshot_page(vmm, page_number))
     {
-        log_error("fputc() failed");
+        snapshot_read(vmm, page_number, buf);
+        return;
     }
-    fclose(create_f);
 
-    log_trace("opening for rw");
-
-    vmm->backing_store = fopen(pagefile, "r+b");
-    if (!vmm->backing_store)
+    store_lock(vmm);
+    if (vmm->compressed_cache != NULL && compressed_cache_get(vmm->compressed_cache, page_number, buf))
     {
-        log_error("error opening file");
-        vmm_destroy(vmm);
-        return NULL;
+        vmm->stats.compressed_hits++;
     }
-    if (setvbuf(vmm->backing_store, NULL, _IOFBF, 1024 * 8) != 0)
+    else if (page_cache_get(vmm->page_cache, page_number, buf))
     {
-        perror("setvbuf");
+        vmm->stats.page_cache_hits++;
     }
+    else
+    {
+        int64_t start_us = vmm_time_us();
 
-    log_debug("opened");
-    return vmm;
+        if (fseek(vmm->backing_store, page_number * vmm->page_size, SEEK_SET) != 0)
+        {
+            log_warn("Error seeking in backing store, page %d\n", page_number);
+            *(uint8_t *)(0) = 1;
+        }
+
+        // the pagefile is sparse, it ends after the last page written to it
+        size_t read_length = fread(buf, sizeof(uint8_t), buf_len, vmm->backing_store);
+        if (read_length < buf_len)
+        {
+            memset(buf + read_length, 0, buf_len - read_length);
+        }
+        vmm->stats.store_reads++;
+        vmm->stats.store_read_bytes += buf_len;
+        record_latency(vmm->stats.store_read_latency, start_us);
+    }
+    store_unlock(vmm);
 }
 
-void vmm_destroy(VMM_t *vmm)
+static inline void notify_evict(VMM_t *vmm, vmTable_t *entry)
 {
-    log_debug("page size %d", vmm->page_size);
-
-    for (size_t i = 0; i < lru_cache_count(vmm->lru_cache); i++)
+    for (size_t i = 0; i < VMM_MAX_EVICT_SUBSCRIBERS; i++)
     {
-        vmTable_t *last_page = lru_cache_get_least_recently_used(vmm->lru_cache);
-        if (last_page != NULL)
+        vmm_evict_subscriber_t *subscriber = &vmm->evict_subscribers[i];
+        if (subscriber->on_evict != NULL)
         {
-            free_vmtable(vmm, last_page);
-            vmm->pagetable_size--;
+            subscriber->on_evict(subscriber->context, entry->page_cache, vmm->page_size);
         }
     }
+}
 
-    if (vmm->backing_store != NULL)
+static void free_vmtable(VMM_t *vmm, vmTable_t *entry)
+{
+    notify_evict(vmm, entry);
+    if (entry->prefetched)
     {
-        vmm_flush(vmm);
-
-        // TODO: free each item in list pagetable and its page_cache
-        log_trace("closing");
-        fclose(vmm->backing_store);
-        log_debug("closed");
+        vmm->stats.readahead_wasted++;
+        vmm->readahead_window = MAX(vmm->readahead_window / 2, 1);
     }
-
-    lru_cache_free(vmm->lru_cache);
-    direct_cache_free(vmm->direct_cache);
-    free(vmm);
+    if (entry->dirty)
+    {
+        log_trace("flushing 0x%" PRIx64 ", at %d", entry->page_address, entry->page_number * vmm->page_size);
+        backing_store_write(vmm, entry->page_number, entry->page_cache, vmm->page_size);
+        entry->dirty = false;
+    }
+    direct_cache_remove(vmm->direct_cache, (void *)entry->page_number);
+    page_pool_unmap(vmm->page_pool, entry);
 }
 
-static size_t vmm_read_internal(VMM_t *vmm, size_t addr, void *target, size_t len)
+static int compare_page_number(const void *a, const void *b)
 {
-    log_trace("reading from address 0x%" PRIx64 " %d bytes", addr, len);
-    vmTable_t *page = get_page(vmm, addr);
-    const size_t offset = addr - page->page_address;
-    const size_t max_length = vmm->page_size - offset;
-    len = MIN(len, max_length);
-    memcpy(target, page->page_cache + offset, len);
-    return len;
+    const vmTable_t *page_a = *(vmTable_t *const *)a;
+    const vmTable_t *page_b = *(vmTable_t *const *)b;
+    return (page_a->page_number > page_b->page_number) - (page_a->page_number < page_b->page_number);
 }
 
-void vmm_read(VMM_t *vmm, size_t addr, void *target, size_t len)
+static void evict_pages(VMM_t *vmm, vmTable_t **pages, size_t count)
 {
-    log_debug("reading %s from address 0x%" PRIx64 " %zu bytes", vmm->filename, addr, len);
+    qsort(pages, count, sizeof(vmTable_t *), compare_page_number);
+    for (size_t i = 0; i < count; i++)
+    {
+        free_vmtable(vmm, pages[i]);
+        vmm->pagetable_size--;
+        vmm->stats.evictions++;
+    }
+}
 
-    size_t remain = len;
-    size_t offset = 0;
-    while (remain)
+static vmTable_t *find_empty_TLB(VMM_t *vmm, size_t page_number)
+{
+    log_trace("looking for empty TLB in pagetable (%d items)", vmm->pagetable_size);
+    vmTable_t *page;
+    if (page_pool_count(vmm->page_pool) < vmm->number_of_pages)
+    {
+        page = page_pool_select_victim(vmm->page_pool, page_number);
+    }
+    else
     {
-        size_t toCpy = vmm_read_internal(vmm, addr + offset, (uint8_t *)target + offset, remain);
-        offset += toCpy;
-        remain -= toCpy;
+        // the frames freed beyond this one serve the next faults
+        size_t count = page_pool_select_victims(vmm->page_pool, page_number, vmm->writeback, vmm->evict_batch);
+        if (count == 0)
+        {
+            log_error("all %zu pages are pinned", vmm->number_of_pages);
+            assert(count);
+        }
+        evict_pages(vmm, vmm->writeback, count);
+        page = vmm->writeback[0];
     }
 
+    vmm->stats.page_faults++;
+    vmm->pagetable_size++;
 #ifdef VMM_DEBUG
-    vmm->reads++;
-    vmm->read_bytes += len;
-
-    if ((vmm->reads % 1000000 == 0) || (vmm->read_bytes % 1000000 == 0))
+    if ((vmm->stats.page_faults % 1000 == 0))
     {
-        // printf("reads %zu bytes %zu\r\n", vmm->reads, vmm->read_bytes);
+        printf("page fault %zu, read %zu (%zu bytes), write %zu (%zu bytes), himem %zu, store read %zu (%zu bytes), writeback %zu, store write %zu (%zu bytes)\r\n",
+               vmm->stats.page_faults,
+               vmm->stats.reads, vmm->stats.read_bytes,
+               vmm->stats.writes, vmm->stats.write_bytes,
+               vmm->stats.page_cache_hits,
+               vmm->stats.store_reads, vmm->stats.store_read_bytes,
+               vmm->stats.dirty_writebacks,
+               vmm->stats.store_writes, vmm->stats.store_write_bytes);
     }
 #endif
+    return page;
 }
 
-static size_t vmm_write_internal(VMM_t *vmm, size_t addr, void *source, size_t len)
+static size_t readahead_window(VMM_t *vmm, size_t page_number)
 {
-    log_trace("internal writing to address 0x%" PRIx64 " %d bytes", addr, len);
-    vmTable_t *page = get_page(vmm, addr);
-    assert(page);
-    const size_t offset = addr - page->page_address;
-    const size_t max_length = vmm->page_size - offset;
-    log_trace("internal page offset 0x%" PRIx64 ", max length %d", offset, max_length);
-    len = MIN(len, max_length);
-    memcpy(page->page_cache + offset, source, len);
-    page->dirty = true;
-    return len;
+    if (vmm->readahead_max < 2 || page_number != vmm->readahead_next)
+    {
+        vmm->readahead_window = 1;
+    }
+    else
+    {
+        vmm->readahead_window = MIN(vmm->readahead_window * 2, vmm->readahead_max);
+    }
+    return vmm->readahead_window;
 }
 
-void vmm_write(VMM_t *vmm, const size_t addr, const void *source, const size_t len)
+// reads page_number and the pages after it with one backing store read,
+// returns 0 when fewer than two pages can be read this way
+static size_t read_ahead(VMM_t *vmm, size_t page_number, vmTable_t *page, size_t window)
 {
-    log_debug("writing %s to address 0x%" PRIx64 " %zu bytes", vmm->filename, addr, len);
-
-    size_t remain = len;
-    size_t offset = 0;
-    while (remain)
+    // never evicts for a read ahead page
+    size_t free_frames = vmm->number_of_pages - page_pool_count(vmm->page_pool);
+    window = MIN(window, free_frames + 1);
+    window = MIN(window, vmm->number_of_store_pages - page_number);
+
+    // only pages whose newest copy is in the backing store
+    store_lock(vmm);
+    size_t count = 0;
+    while (count < window)
+    {
+        size_t ahead = page_number + count;
+        if ((count > 0 && page_pool_lookup(vmm->page_pool, ahead) != NULL) ||
+            is_zero_page(vmm, ahead) ||
+            is_snapshot_page(vmm, ahead) ||
+            (vmm->write_behind != NULL && write_behind_contains(vmm->write_behind, ahead)) ||
+            (vmm->compressed_cache != NULL && compressed_cache_contains(vmm->compressed_cache, ahead)) ||
+            page_cache_contains(vmm->page_cache, ahead))
+        {
+            break;
+        }
+        count++;
+    }
+    if (count < 2)
     {
-        size_t toCpy = vmm_write_internal(vmm, addr + offset, (uint8_t *)source + offset, remain);
-        offset += toCpy;
-        remain -= toCpy;
+        store_unlock(vmm);
+        return 0;
     }
 
-#ifdef VMM_DEBUG
-    vmm->writes++;
-    vmm->write_bytes += len;
+    const size_t length = count * vmm->page_size;
+    int64_t start_us = vmm_time_us();
+    if (fseek(vmm->backing_store, page_number * vmm->page_size, SEEK_SET) != 0)
+    {
+        log_warn("Error seeking in backing store, page %d\n", page_number);
+    }
+    size_t read_length = fread(vmm->readahead_buffer, sizeof(uint8_t), length, vmm->backing_store);
+    if (read_length < length)
+    {
+        memset(vmm->readahead_buffer + read_length, 0, length - read_length);
+    }
+    vmm->stats.store_reads++;
+    vmm->stats.store_read_bytes += length;
+    record_latency(vmm->stats.store_read_latency, start_us);
+    store_unlock(vmm);
 
-    if ((vmm->writes % 1000000 == 0) || (vmm->write_bytes % 1000000 == 0))
+    memcpy(page->page_cache, vmm->readahead_buffer, vmm->page_size);
+    for (size_t i = 1; i < count; i++)
     {
-        // printf("writes %zu bytes %zu\r\n", vmm->writes, vmm->write_bytes);
+        const size_t ahead = page_number + i;
+        vmTable_t *frame = page_pool_select_victim(vmm->page_pool, ahead);
+        page_pool_map(vmm->page_pool, frame, ahead, ahead * vmm->page_size);
+        memcpy(frame->page_cache, vmm->readahead_buffer + i * vmm->page_size, vmm->page_size);
+        frame->prefetched = true;
+        direct_cache_set(vmm->direct_cache, (void *)ahead, frame);
+        vmm->pagetable_size++;
     }
-#endif
-    // TODO(dror): don't flush!
-    // vmm_flush(vmm);
+    vmm->stats.readahead_pages += count - 1;
+    return count;
 }
 
-static vmTable_t *get_page(VMM_t *vmm, size_t addr)
+static void load_page(VMM_t *vmm, size_t page_number, vmTable_t *page)
 {
-    log_trace("getting page for 0x%" PRIx64 "", addr);
-    const size_t page_number = get_page_number_by_address(vmm, addr);
-    const size_t page_offset = page_number * vmm->page_size;
-
-    log_trace("page number %d, offset 0x%" PRIx64 "", page_number, page_offset);
-
-    vmTable_t *page = get_TLB(vmm, page_number);
-    if (page != NULL)
+    size_t window = readahead_window(vmm, page_number);
+    size_t count = 0;
+    if (is_zero_page(vmm, page_number))
     {
-        log_trace("found existing TLB");
+        memset(page->page_cache, 0, vmm->page_size);
+        vmm->stats.zero_fills++;
+        count = 1;
     }
-    else if (page == NULL)
+    else if (window > 1)
     {
-        page = find_empty_TLB(vmm);
-        page->page_number = page_number;
-        page->page_address = page_offset;
-        load_page(vmm, page_number, page);
-        lru_cache_add(vmm->lru_cache, (void *)page_number, page);
-        direct_cache_set(vmm->direct_cache, (void *)page_number, page);
-        // splaytree_put(vmm->search_tree, page_number, page);
+        count = read_ahead(vmm, page_number, page, window);
+    }
+    if (count == 0)
+    {
+        backing_store_read(vmm, page_number, page->page_cache, vmm->page_size);
+        count = 1;
     }
+    vmm->readahead_next = page_number + count;
+}
 
-    return page;
+static void flush_page(VMM_t *vmm, vmTable_t *page)
+{
+    // writable mappings must fault again to mark the page dirty
+    notify_evict(vmm, page);
+    log_trace("flushing 0x%" PRIx64 ", at %d", page->page_address, page->page_number * vmm->page_size);
+    backing_store_write(vmm, page->page_number, page->page_cache, vmm->page_size);
+    // the page may still be written through an acquired pointer
+    if (page->write_pin_count == 0)
+    {
+        page->dirty = false;
+    }
 }
 
-void vmm_flush(VMM_t *vmm)
+typedef struct page_list_t
 {
-    log_debug("flushing dirty pages");
+    vmTable_t **pages;
+    size_t count;
+} page_list_t;
 
-    printf("sync\n");
-    lru_cache_sync(vmm->lru_cache);
-    printf("flush\n");
-    fflush(vmm->backing_store);
+static void collect_page(vmTable_t *page, void *context)
+{
+    page_list_t *list = (page_list_t *)context;
+    list->pages[list->count++] = page;
+}
+
+static void collect_dirty_page(vmTable_t *page, void *context)
+{
+    if (page->dirty)
+    {
+        collect_page(page, context);
+    }
+}
+
+static void collect_prefetched_page(vmTable_t *page, void *context)
+{
+    if (page->prefetched && page->pin_count == 0)
+    {
+        collect_page(page, context);
+    }
+}
+
+
+
+bool vmm_parse_backend(const char *name, vmm_backend_t *backend)
+{
+    if (strcmp(name, "paged") == 0)
+    {
+        *backend = VMM_BACKEND_PAGED;
+    }
+    else if (strcmp(name, "mmap") == 0)
+    {
+        *backend = VMM_BACKEND_MMAP_FILE;
+    }
+    else if (strcmp(name, "mmap_anonymous") == 0)
+    {
+        *backend = VMM_BACKEND_MMAP_ANONYMOUS;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+#ifdef VMM_HAS_MMAP
+static VMM_t *vmm_create_mapped(vmm_backend_t backend, const char *pagefile, size_t maximum_size, size_t page_size)
+{
+    log_info("mapping vmm %s size: %zu, page: %zu\r\n", pagefile, maximum_size, page_size);
+    VMM_t *vmm = (VMM_t *)calloc(1, sizeof(VMM_t));
+    assert(vmm);
+    vmm->backend = backend;
+    strcpy((char *)&vmm->filename, pagefile);
+    vmm->page_size = page_size;
+    vmm->mapping_size = (maximum_size + page_size - 1) / page_size * page_size;
+    vmm->mapping_fd = -1;
+
+    if (backend == VMM_BACKEND_MMAP_FILE)
+    {
+        vmm->mapping_fd = open(pagefile, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (vmm->mapping_fd < 0 || ftruncate(vmm->mapping_fd, vmm->mapping_size) != 0)
+        {
+            log_error("error creating page file %s", pagefile);
+            vmm_destroy(vmm);
+            return NULL;
+        }
+        char index[260];
+        index_filename(vmm, index, sizeof(index));
+        remove(index);
+        vmm->mapping = mmap(NULL, vmm->mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, vmm->mapping_fd, 0);
+    }
+    else
+    {
+        vmm->mapping = mmap(NULL, vmm->mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    }
+    if (vmm->mapping == MAP_FAILED)
+    {
+        log_error("mmap() failed");
+        vmm->mapping = NULL;
+        vmm_destroy(vmm);
+        return NULL;
+    }
+
+    // static entries so the page pointer api works the same way as the paged backend
+    vmm->number_of_pages = vmm->mapping_size / page_size;
+    vmm->pagetable_size = vmm->number_of_pages;
+    vmm->mapped_pages = (vmTable_t *)calloc(vmm->number_of_pages, sizeof(vmTable_t));
+    assert(vmm->mapped_pages);
+    for (size_t i = 0; i < vmm->number_of_pages; i++)
+    {
+        vmm->mapped_pages[i].page_number = i;
+        vmm->mapped_pages[i].page_address = i * page_size;
+        vmm->mapped_pages[i].page_cache = vmm->mapping + i * page_size;
+    }
+#ifdef VMM_TRACE
+    trace_start_default(vmm);
+#endif
+    return vmm;
+}
+#endif
+
+VMM_t *vmm_create_backend(vmm_backend_t backend, const char *pagefile, size_t maximum_size, size_t page_size, size_t number_of_pages, size_t maximum_himem_blocks, eviction_policy_type_t policy)
+{
+    if (backend != VMM_BACKEND_PAGED)
+    {
+#ifdef VMM_HAS_MMAP
+        return vmm_create_mapped(backend, pagefile, maximum_size, page_size);
+#else
+        log_warn("mmap backend not available, using paged backend");
+#endif
+    }
+    return vmm_create_paged(pagefile, maximum_size, page_size, number_of_pages, maximum_himem_blocks, policy, NULL);
+}
+
+VMM_t *vmm_create(const char *pagefile, size_t maximum_size, size_t page_size, size_t number_of_pages, size_t maximum_himem_blocks)
+{
+    return vmm_create_paged(pagefile, maximum_size, page_size, number_of_pages, maximum_himem_blocks, EVICTION_POLICY_CLOCK, NULL);
+}
+
+VMM_t *vmm_create_persistent(const char *pagefile, size_t maximum_size, size_t page_size, size_t number_of_pages, size_t maximum_himem_blocks, eviction_policy_type_t policy, uint64_t generation)
+{
+    return vmm_create_paged(pagefile, maximum_size, page_size, number_of_pages, maximum_himem_blocks, policy, &generation);
+}
+
+// reads the index of an earlier run, the persisted pages are the only ones that are not zero pages
+static bool index_open(VMM_t *vmm, uint64_t generation)
+{
+    char filename[260];
+    index_filename(vmm, filename, sizeof(filename));
+    FILE *f = fopen(filename, "r+b");
+    if (f == NULL)
+    {
+        return false;
+    }
+    char magic[8];
+    uint32_t page_size;
+    uint64_t number_of_store_pages, file_generation;
+    size_t bitmap_size = (vmm->number_of_store_pages + 7) / 8;
+    uint8_t *pages = (uint8_t *)malloc(bitmap_size);
+    assert(pages);
+    if (fread(magic, sizeof(magic), 1, f) != 1 || memcmp(magic, VMM_PAGEFILE_INDEX_MAGIC, sizeof(magic)) != 0 ||
+        fread(&page_size, sizeof(page_size), 1, f) != 1 ||
+        fread(&number_of_store_pages, sizeof(number_of_store_pages), 1, f) != 1 ||
+        fread(&file_generation, sizeof(file_generation), 1, f) != 1 ||
+        page_size != vmm->page_size || number_of_store_pages != vmm->number_of_store_pages || file_generation != generation ||
+        fread(pages, sizeof(uint8_t), bitmap_size, f) != bitmap_size)
+    {
+        log_info("%s does not match, recreating the pagefile", filename);
+        free(pages);
+        fclose(f);
+        return false;
+    }
+    if (vmm->number_of_store_pages % 8 != 0)
+    {
+        pages[bitmap_size - 1] &= (1 << (vmm->number_of_store_pages % 8)) - 1;
+    }
+
+    size_t count = 0;
+    for (size_t i = 0; i < bitmap_size; i++)
+    {
+        vmm->zero_pages[i] = ~pages[i];
+        for (uint8_t bits = pages[i]; bits != 0; bits &= bits - 1)
+        {
+            count++;
+        }
+    }
+    vmm->index = f;
+    vmm->persistent_pages = pages;
+    log_info("kept %zu pages of %s", count, vmm->filename);
+    return true;
+}
+
+// the index is written before the pagefile holds any page, a run that stops early leaves nothing to keep
+static bool index_create(VMM_t *vmm, uint64_t generation)
+{
+    char filename[260];
+    index_filename(vmm, filename, sizeof(filename));
+    size_t bitmap_size = (vmm->number_of_store_pages + 7) / 8;
+    vmm->persistent_pages = (uint8_t *)calloc(bitmap_size, 1);
+    assert(vmm->persistent_pages);
+    vmm->index = fopen(filename, "w+b");
+    if (vmm->index == NULL)
+    {
+        log_error("error creating %s", filename);
+        index_close(vmm);
+        return false;
+    }
+    uint32_t page_size = vmm->page_size;
+    uint64_t number_of_store_pages = vmm->number_of_store_pages;
+    if (fwrite(VMM_PAGEFILE_INDEX_MAGIC, 8, 1, vmm->index) != 1 ||
+        fwrite(&page_size, sizeof(page_size), 1, vmm->index) != 1 ||
+        fwrite(&number_of_store_pages, sizeof(number_of_store_pages), 1, vmm->index) != 1 ||
+        fwrite(&generation, sizeof(generation), 1, vmm->index) != 1 ||
+        fwrite(vmm->persistent_pages, sizeof(uint8_t), bitmap_size, vmm->index) != bitmap_size ||
+        fflush(vmm->index) != 0)
+    {
+        index_drop(vmm);
+        return false;
+    }
+    return true;
+}
+
+static void index_close(VMM_t *vmm)
+{
+    if (vmm->index != NULL)
+    {
+        fclose(vmm->index);
+        vmm->index = NULL;
+    }
+    free(vmm->persistent_pages);
+    vmm->persistent_pages = NULL;
+}
+
+static VMM_t *vmm_create_paged(const char *pagefile, size_t maximum_size, size_t page_size, size_t number_of_pages, size_t maximum_himem_blocks, eviction_policy_type_t policy, const uint64_t *generation)
+{
+    log_info("creating vmm %s size: %zu, page: %zu, pages: %zu, total: %zu\r\n",
+           pagefile, maximum_size, page_size, number_of_pages, page_size * number_of_pages);
+    VMM_t *vmm = (VMM_t *)malloc(sizeof(VMM_t));
+    assert(vmm);
+    vmm->backend = VMM_BACKEND_PAGED;
+    vmm->mapping = NULL;
+    vmm->mapping_size = 0;
+    vmm->mapping_fd = -1;
+    vmm->mapped_pages = NULL;
+    vmm->pagetable_size = 0;
+    strcpy((char *)&vmm->filename, pagefile);
+
+    vmm->page_size = page_size;
+    vmm->number_of_pages = number_of_pages;
+    memset(vmm->evict_subscribers, 0, sizeof(vmm->evict_subscribers));
+
+    memset(&vmm->stats, 0, sizeof(vmm->stats));
+    vmm->trace = NULL;
+    vmm->trace_buffer = NULL;
+
+    vmm->page_pool = page_pool_init(page_size, number_of_pages, policy);
+    vmm->write_behind = NULL;
+    vmm->compressed_cache = NULL;
+    vmm->policy = policy;
+    vmm->number_of_store_pages = (maximum_size + page_size - 1) / page_size;
+    vmm->zero_pages = (uint8_t *)malloc((vmm->number_of_store_pages + 7) / 8);
+    assert(vmm->zero_pages);
+    memset(vmm->zero_pages, 0xff, (vmm->number_of_store_pages + 7) / 8);
+    vmm->snapshot = NULL;
+    vmm->snapshot_pages = NULL;
+    vmm->snapshot_index = NULL;
+    vmm->snapshot_count = 0;
+    vmm->index = NULL;
+    vmm->persistent_pages = NULL;
+    vmm->readahead_buffer = NULL;
+    vmm->readahead_window = 1;
+    vmm->readahead_next = 0;
+    vmm_set_readahead(vmm, MIN(VMM_READAHEAD_PAGES, number_of_pages / 4));
+    vmm->writeback = (vmTable_t **)malloc(sizeof(vmTable_t *) * number_of_pages);
+    assert(vmm->writeback);
+    vmm->evict_batch = MIN(VMM_EVICT_BATCH, number_of_pages / 4);
+    if (vmm->evict_batch == 0)
+    {
+        vmm->evict_batch = 1;
+    }
+    vmm->direct_cache = direct_cache_init_ways(1024 * 8, 4);
+    vmm->page_cache = page_cache_init(page_size,maximum_himem_blocks, policy, on_page_cache_flush, vmm);
+
+    vmm->backing_store = NULL;
+    if (generation != NULL && index_open(vmm, *generation))
+    {
+        vmm->backing_store = fopen(pagefile, "r+b");
+        if (!vmm->backing_store)
+        {
+            index_close(vmm);
+            memset(vmm->zero_pages, 0xff, (vmm->number_of_store_pages + 7) / 8);
+        }
+    }
+
+    if (!vmm->backing_store)
+    {
+        // the page file starts empty, pages are written to it only once they hold data
+        log_trace("creating page file %s of %d", pagefile, maximum_size);
+        FILE *create_f = fopen(pagefile, "wb");
+        if (!create_f)
+        {
+            log_error("fopen() failed");
+        }
+        fclose(create_f);
+
+        if (generation != NULL)
+        {
+            index_create(vmm, *generation);
+        }
+        else
+        {
+            char index[260];
+            index_filename(vmm, index, sizeof(index));
+            remove(index);
+        }
+
+        log_trace("opening for rw");
+        vmm->backing_store = fopen(pagefile, "r+b");
+    }
+    if (!vmm->backing_store)
+    {
+        log_error("error opening file");
+        vmm_destroy(vmm);
+        return NULL;
+    }
+    if (setvbuf(vmm->backing_store, NULL, _IOFBF, 1024 * 8) != 0)
+    {
+        perror("setvbuf");
+    }
+
+#ifdef VMM_TRACE
+    trace_start_default(vmm);
+#endif
+
+    log_debug("opened");
+    return vmm;
+}
+
+void vmm_destroy(VMM_t *vmm)
+{
+    log_debug("page size %d", vmm->page_size);
+    vmm_trace_stop(vmm);
+
+#ifdef VMM_HAS_MMAP
+    if (vmm->backend != VMM_BACKEND_PAGED)
+    {
+        if (vmm->mapping != NULL)
+        {
+            munmap(vmm->mapping, vmm->mapping_size);
+        }
+        if (vmm->mapping_fd >= 0)
+        {
+            close(vmm->mapping_fd);
+        }
+        free(vmm->mapped_pages);
+        free(vmm);
+        return;
+    }
+#endif
+
+    page_list_t resident = {vmm->writeback, 0};
+    page_pool_foreach(vmm->page_pool, collect_page, &resident);
+    evict_pages(vmm, resident.pages, resident.count);
+    vmm_stop_write_behind(vmm);
+
+    if (vmm->backing_store != NULL)
+    {
+        vmm_flush(vmm);
+
+        // TODO: free each item in list pagetable and its page_cache
+        log_trace("closing");
+        fclose(vmm->backing_store);
+        log_debug("closed");
+    }
+
+    page_pool_free(vmm->page_pool);
+    direct_cache_free(vmm->direct_cache);
+    if (vmm->compressed_cache != NULL)
+    {
+        compressed_cache_free(vmm->compressed_cache);
+    }
+    page_cache_free(vmm->page_cache);
+    free(vmm->writeback);
+    free(vmm->readahead_buffer);
+    free(vmm->zero_pages);
+    index_close(vmm);
+    snapshot_close(vmm);
+    free(vmm->snapshot_pages);
+    free(vmm);
+}
+
+static size_t vmm_read_internal(VMM_t *vmm, size_t addr, void *target, size_t len)
+{
+    log_trace("reading from address 0x%" PRIx64 " %d bytes", addr, len);
+    vmTable_t *page = get_page(vmm, addr, VMM_ACCESS_READ);
+    const size_t offset = addr - page->page_address;
+    const size_t max_length = vmm->page_size - offset;
+    len = MIN(len, max_length);
+    memcpy(target, page->page_cache + offset, len);
+    return len;
+}
+
+void vmm_read(VMM_t *vmm, size_t addr, void *target, size_t len)
+{
+    log_debug("reading %s from address 0x%" PRIx64 " %zu bytes", vmm->filename, addr, len);
+
+    if (vmm->mapping != NULL)
+    {
+        memcpy(target, vmm->mapping + addr, len);
+    }
+    else
+    {
+        size_t remain = len;
+        size_t offset = 0;
+        while (remain)
+        {
+            size_t toCpy = vmm_read_internal(vmm, addr + offset, (uint8_t *)target + offset, remain);
+            offset += toCpy;
+            remain -= toCpy;
+        }
+    }
+
+    vmm->stats.reads++;
+    vmm->stats.read_bytes += len;
+}
+
+static size_t vmm_write_internal(VMM_t *vmm, size_t addr, void *source, size_t len)
+{
+    log_trace("internal writing to address 0x%" PRIx64 " %d bytes", addr, len);
+    vmTable_t *page = get_page(vmm, addr, VMM_ACCESS_WRITE);
+    assert(page);
+    const size_t offset = addr - page->page_address;
+    const size_t max_length = vmm->page_size - offset;
+    log_trace("internal page offset 0x%" PRIx64 ", max length %d", offset, max_length);
+    len = MIN(len, max_length);
+    memcpy(page->page_cache + offset, source, len);
+    page->dirty = true;
+    return len;
+}
+
+void vmm_write(VMM_t *vmm, const size_t addr, const void *source, const size_t len)
+{
+    log_debug("writing %s to address 0x%" PRIx64 " %zu bytes", vmm->filename, addr, len);
+
+    if (vmm->mapping != NULL)
+    {
+        memcpy(vmm->mapping + addr, source, len);
+    }
+    else
+    {
+        size_t remain = len;
+        size_t offset = 0;
+        while (remain)
+        {
+            size_t toCpy = vmm_write_internal(vmm, addr + offset, (uint8_t *)source + offset, remain);
+            offset += toCpy;
+            remain -= toCpy;
+        }
+    }
+
+    vmm->stats.writes++;
+    vmm->stats.write_bytes += len;
+    // TODO(dror): don't flush!
+    // vmm_flush(vmm);
+}
+
+vmTable_t *vmm_get_page(VMM_t *vmm, size_t addr, bool is_write)
+{
+    vmTable_t *page = get_page(vmm, addr, is_write ? VMM_ACCESS_WRITE : VMM_ACCESS_READ);
+    if (is_write)
+    {
+        page->dirty = true;
+    }
+    return page;
+}
+
+vmTable_t *vmm_get_code_page(VMM_t *vmm, size_t addr)
+{
+    return get_page(vmm, addr, VMM_ACCESS_CODE);
+}
+
+uint8_t *vmm_get_page_ptr(VMM_t *vmm, size_t addr, bool is_write)
+{
+    vmTable_t *page = vmm_get_page(vmm, addr, is_write);
+    return page->page_cache + (addr - page->page_address);
+}
+
+uint8_t *vmm_acquire_ptr(VMM_t *vmm, size_t addr, bool is_write, size_t *len, vmTable_t **page)
+{
+    vmTable_t *entry = vmm_get_page(vmm, addr, is_write);
+    const size_t offset = addr - entry->page_address;
+    vmm_pin_page(entry);
+    if (is_write)
+    {
+        entry->write_pin_count++;
+    }
+    if (len != NULL)
+    {
+        *len = vmm->page_size - offset;
+    }
+    *page = entry;
+    return entry->page_cache + offset;
+}
+
+void vmm_release_ptr(VMM_t *vmm, vmTable_t *page, bool is_write)
+{
+    (void)vmm;
+    assert(page->pin_count > 0);
+    if (is_write)
+    {
+        assert(page->write_pin_count > 0);
+        page->write_pin_count--;
+    }
+    vmm_unpin_page(page);
+}
+
+int vmm_subscribe_evict(VMM_t *vmm, vmm_evict_callback_t on_evict, void *context)
+{
+    for (size_t i = 0; i < VMM_MAX_EVICT_SUBSCRIBERS; i++)
+    {
+        vmm_evict_subscriber_t *subscriber = &vmm->evict_subscribers[i];
+        if (subscriber->on_evict == NULL)
+        {
+            subscriber->on_evict = on_evict;
+            subscriber->context = context;
+            return 0;
+        }
+    }
+    log_error("no free eviction subscriber slot");
+    return -1;
+}
+
+void vmm_unsubscribe_evict(VMM_t *vmm, vmm_evict_callback_t on_evict, void *context)
+{
+    for (size_t i = 0; i < VMM_MAX_EVICT_SUBSCRIBERS; i++)
+    {
+        vmm_evict_subscriber_t *subscriber = &vmm->evict_subscribers[i];
+        if (subscriber->on_evict == on_evict && subscriber->context == context)
+        {
+            subscriber->on_evict = NULL;
+            subscriber->context = NULL;
+        }
+    }
+}
+
+static void trace_flush(VMM_t *vmm)
+{
+    if (fwrite(vmm->trace_buffer, 1, vmm->trace_length, vmm->trace) != vmm->trace_length)
+    {
+        log_error("Error writing trace\n");
+    }
+    vmm->trace_length = 0;
+}
+
+static void trace_record(VMM_t *vmm, size_t page_number, vmm_access_t access)
+{
+    int64_t delta = (int64_t)page_number - (int64_t)vmm->trace_last_page;
+    uint64_t value = ((((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63)) << 2) | access;
+    vmm->trace_last_page = page_number;
+
+    // a 64 bit varint takes at most 10 bytes
+    if (vmm->trace_length + 10 > VMM_TRACE_BUFFER_SIZE)
+    {
+        trace_flush(vmm);
+    }
+    do
+    {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        vmm->trace_buffer[vmm->trace_length++] = value ? (byte | 0x80) : byte;
+    } while (value);
+}
+
+bool vmm_trace_start(VMM_t *vmm, const char *filename)
+{
+    vmm_trace_stop(vmm);
+    vmm->trace = fopen(filename, "wb");
+    if (!vmm->trace)
+    {
+        log_error("error creating trace file %s", filename);
+        return false;
+    }
+    vmm->trace_buffer = (uint8_t *)malloc(VMM_TRACE_BUFFER_SIZE);
+    assert(vmm->trace_buffer);
+    vmm->trace_last_page = 0;
+
+    uint32_t page_size = vmm->page_size;
+    memcpy(vmm->trace_buffer, VMM_TRACE_MAGIC, 8);
+    for (size_t i = 0; i < 4; i++)
+    {
+        vmm->trace_buffer[8 + i] = (page_size >> (i * 8)) & 0xff;
+    }
+    vmm->trace_length = 12;
+    return true;
+}
+
+void vmm_trace_stop(VMM_t *vmm)
+{
+    if (vmm->trace != NULL)
+    {
+        trace_flush(vmm);
+        fclose(vmm->trace);
+        free(vmm->trace_buffer);
+        vmm->trace = NULL;
+        vmm->trace_buffer = NULL;
+    }
+}
+
+#ifdef VMM_TRACE
+static void trace_start_default(VMM_t *vmm)
+{
+    char trace_filename[sizeof(vmm->filename) + 8];
+    snprintf(trace_filename, sizeof(trace_filename), "%s.trace", vmm->filename);
+    vmm_trace_start(vmm, trace_filename);
+}
+#endif
+
+static vmTable_t *get_page(VMM_t *vmm, size_t addr, vmm_access_t access)
+{
+    log_trace("getting page for 0x%" PRIx64 "", addr);
+    const size_t page_number = get_page_number_by_address(vmm, addr);
+    const size_t page_offset = page_number * vmm->page_size;
+
+    if (vmm->trace != NULL)
+    {
+        trace_record(vmm, page_number, access);
+    }
+
+    log_trace("page number %d, offset 0x%" PRIx64 "", page_number, page_offset);
+
+    if (vmm->mapped_pages != NULL)
+    {
+        assert(page_number < vmm->number_of_pages);
+        return &vmm->mapped_pages[page_number];
+    }
+
+    vmTable_t *page = get_TLB(vmm, page_number);
+    if (page != NULL)
+    {
+        log_trace("found existing TLB");
+    }
+    else if (page == NULL)
+    {
+        page = find_empty_TLB(vmm, page_number);
+        page_pool_map(vmm->page_pool, page, page_number, page_offset);
+        load_page(vmm, page_number, page);
+        direct_cache_set(vmm->direct_cache, (void *)page_number, page);
+        // splaytree_put(vmm->search_tree, page_number, page);
+    }
+
+    return page;
+}
+
+void vmm_flush(VMM_t *vmm)
+{
+    log_debug("flushing dirty pages");
+
+#ifdef VMM_HAS_MMAP
+    if (vmm->backend != VMM_BACKEND_PAGED)
+    {
+        if (vmm->mapping_fd >= 0)
+        {
+            msync(vmm->mapping, vmm->mapping_size, MS_SYNC);
+        }
+        return;
+    }
+#endif
+
+    printf("sync\n");
+    // dirty pages go to the page cache in page order, which merges adjacent pages on the way to the backing store
+    page_list_t dirty = {vmm->writeback, 0};
+    page_pool_foreach(vmm->page_pool, collect_dirty_page, &dirty);
+    qsort(dirty.pages, dirty.count, sizeof(vmTable_t *), compare_page_number);
+    for (size_t i = 0; i < dirty.count; i++)
+    {
+        flush_page(vmm, dirty.pages[i]);
+    }
+    if (vmm->write_behind != NULL)
+    {
+        write_behind_drain(vmm->write_behind);
+    }
+    store_lock(vmm);
+    if (vmm->compressed_cache != NULL)
+    {
+        compressed_cache_flush(vmm->compressed_cache);
+    }
+    page_cache_flush(vmm->page_cache);
+    printf("flush\n");
+    fflush(vmm->backing_store);
+    store_unlock(vmm);
+}
+
+bool vmm_start_write_behind(VMM_t *vmm, size_t number_of_pages)
+{
+    if (vmm->backend != VMM_BACKEND_PAGED || number_of_pages == 0)
+    {
+        return false;
+    }
+    vmm_stop_write_behind(vmm);
+    vmm->write_behind = write_behind_init(vmm->page_size, number_of_pages, on_write_behind, vmm);
+    return true;
+}
+
+void vmm_stop_write_behind(VMM_t *vmm)
+{
+    if (vmm->write_behind != NULL)
+    {
+        write_behind_free(vmm->write_behind);
+        vmm->write_behind = NULL;
+    }
+}
+
+bool vmm_start_compressed_tier(VMM_t *vmm, size_t arena_size)
+{
+    if (vmm->backend != VMM_BACKEND_PAGED || vmm->compressed_cache != NULL || arena_size < vmm->page_size)
+    {
+        return false;
+    }
+    vmm->compressed_cache = compressed_cache_init(vmm->page_size, arena_size, vmm->policy,
+                                                  on_compressed_evict, on_page_cache_flush, vmm);
+    return vmm->compressed_cache != NULL;
+}
+
+void vmm_set_readahead(VMM_t *vmm, size_t max_pages)
+{
+    if (vmm->backend != VMM_BACKEND_PAGED)
+    {
+        return;
+    }
+    free(vmm->readahead_buffer);
+    vmm->readahead_buffer = NULL;
+    vmm->readahead_max = max_pages;
+    vmm->readahead_window = 1;
+    if (max_pages > 1)
+    {
+        vmm->readahead_buffer = (uint8_t *)malloc(max_pages * vmm->page_size);
+        assert(vmm->readahead_buffer);
+    }
+}
+
+void vmm_cancel_readahead(VMM_t *vmm)
+{
+    if (vmm->backend != VMM_BACKEND_PAGED)
+    {
+        return;
+    }
+    page_list_t prefetched = {vmm->writeback, 0};
+    page_pool_foreach(vmm->page_pool, collect_prefetched_page, &prefetched);
+    evict_pages(vmm, prefetched.pages, prefetched.count);
+    vmm->readahead_window = 1;
+}
+
+bool vmm_persist(VMM_t *vmm)
+{
+    if (vmm->index == NULL)
+    {
+        return false;
+    }
+    vmm_flush(vmm);
+
+    // pages of a resumed snapshot are not in the pagefile
+    size_t bitmap_size = (vmm->number_of_store_pages + 7) / 8;
+    for (size_t i = 0; i < bitmap_size; i++)
+    {
+        vmm->persistent_pages[i] = ~vmm->zero_pages[i] & ~(vmm->snapshot_pages != NULL ? vmm->snapshot_pages[i] : 0);
+    }
+    if (vmm->number_of_store_pages % 8 != 0)
+    {
+        vmm->persistent_pages[bitmap_size - 1] &= (1 << (vmm->number_of_store_pages % 8)) - 1;
+    }
+    if (fseek(vmm->index, VMM_PAGEFILE_INDEX_HEADER, SEEK_SET) != 0 ||
+        fwrite(vmm->persistent_pages, sizeof(uint8_t), bitmap_size, vmm->index) != bitmap_size ||
+        fflush(vmm->index) != 0)
+    {
+        index_drop(vmm);
+        return false;
+    }
+    return true;
+}
+
+bool vmm_is_persistent(VMM_t *vmm, size_t addr, size_t len)
+{
+    if ((vmm->persistent_pages == NULL && vmm->snapshot_pages == NULL) || len == 0)
+    {
+        return false;
+    }
+    for (size_t page_number = addr / vmm->page_size; page_number <= (addr + len - 1) / vmm->page_size; page_number++)
+    {
+        vmTable_t *page = page_pool_lookup(vmm->page_pool, page_number);
+        if ((!is_persistent_page(vmm, page_number) && !is_snapshot_page(vmm, page_number)) ||
+            is_zero_page(vmm, page_number) || (page != NULL && page->dirty))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void snapshot_close(VMM_t *vmm)
+{
+    if (vmm->snapshot != NULL)
+    {
+        fclose(vmm->snapshot);
+        vmm->snapshot = NULL;
+    }
+    free(vmm->snapshot_index);
+    vmm->snapshot_index = NULL;
+    vmm->snapshot_count = 0;
+}
+
+// reads the index of a snapshot file, the snapshot bits are left to the caller
+static bool snapshot_open(VMM_t *vmm, const char *filename, uint64_t generation)
+{
+    FILE *f = fopen(filename, "rb");
+    if (f == NULL)
+    {
+        return false;
+    }
+    char magic[8];
+    uint32_t page_size, count;
+    uint64_t number_of_store_pages, file_generation;
+    if (fread(magic, sizeof(magic), 1, f) != 1 || memcmp(magic, VMM_SNAPSHOT_MAGIC, sizeof(magic)) != 0 ||
+        fread(&page_size, sizeof(page_size), 1, f) != 1 || fread(&count, sizeof(count), 1, f) != 1 ||
+        fread(&number_of_store_pages, sizeof(number_of_store_pages), 1, f) != 1 ||
+        fread(&file_generation, sizeof(file_generation), 1, f) != 1 || file_generation != generation ||
+        page_size != vmm->page_size || number_of_store_pages != vmm->number_of_store_pages || count > number_of_store_pages)
+    {
+        log_error("%s is not a snapshot of this memory", filename);
+        fclose(f);
+        return false;
+    }
+    uint32_t *index = (uint32_t *)malloc(sizeof(uint32_t) * MAX(count, 1));
+    assert(index);
+    bool valid = fread(index, sizeof(uint32_t), count, f) == count;
+    for (uint32_t i = 0; valid && i < count; i++)
+    {
+        valid = index[i] < number_of_store_pages && (i == 0 || index[i - 1] < index[i]);
+    }
+    if (!valid)
+    {
+        log_error("%s has a broken index", filename);
+        free(index);
+        fclose(f);
+        return false;
+    }
+
+    snapshot_close(vmm);
+    vmm->snapshot = f;
+    vmm->snapshot_index = index;
+    vmm->snapshot_count = count;
+    vmm->snapshot_data = ftell(f);
+    return true;
+}
+
+// rename() does not replace an existing file on FAT and Windows, there the old
+// file is moved aside until the new one is in place
+static bool replace_file(const char *temp_filename, const char *filename)
+{
+    if (rename(temp_filename, filename) == 0)
+    {
+        return true;
+    }
+    char old_filename[270];
+    snprintf(old_filename, sizeof(old_filename), "%s.old", filename);
+    remove(old_filename);
+    if (rename(filename, old_filename) != 0)
+    {
+        return false;
+    }
+    if (rename(temp_filename, filename) != 0)
+    {
+        rename(old_filename, filename);
+        return false;
+    }
+    remove(old_filename);
+    return true;
+}
+
+bool vmm_save_base(VMM_t *vmm, const char *filename, uint64_t generation)
+{
+    if (vmm->backend != VMM_BACKEND_PAGED)
+    {
+        return false;
+    }
+    vmm_flush(vmm);
+
+    uint32_t count = 0;
+    for (size_t page_number = 0; page_number < vmm->number_of_store_pages; page_number++)
+    {
+        count += !is_zero_page(vmm, page_number);
+    }
+    uint32_t *index = (uint32_t *)malloc(sizeof(uint32_t) * MAX(count, 1));
+    uint8_t *buf = (uint8_t *)malloc(vmm->page_size);
+    assert(index && buf);
+    count = 0;
+    for (size_t page_number = 0; page_number < vmm->number_of_store_pages; page_number++)
+    {
+        if (!is_zero_page(vmm, page_number))
+        {
+            index[count++] = page_number;
+        }
+    }
+
+    // the old snapshot may still hold pages, it is replaced only once the new one is complete
+    char temp_filename[260];
+    snprintf(temp_filename, sizeof(temp_filename), "%s.tmp", filename);
+    FILE *f = fopen(temp_filename, "wb");
+    bool ok = f != NULL;
+    if (ok)
+    {
+        uint32_t page_size = vmm->page_size;
+        uint64_t number_of_store_pages = vmm->number_of_store_pages;
+        ok = fwrite(VMM_SNAPSHOT_MAGIC, 8, 1, f) == 1 &&
+             fwrite(&page_size, sizeof(page_size), 1, f) == 1 &&
+             fwrite(&count, sizeof(count), 1, f) == 1 &&
+             fwrite(&number_of_store_pages, sizeof(number_of_store_pages), 1, f) == 1 &&
+             fwrite(&generation, sizeof(generation), 1, f) == 1 &&
+             fwrite(index, sizeof(uint32_t), count, f) == count;
+    }
+
+    // reading the pages back is not accounted as faults
+    vmm_stats_t stats = vmm->stats;
+    for (uint32_t i = 0; ok && i < count; i++)
+    {
+        vmTable_t *page = page_pool_lookup(vmm->page_pool, index[i]);
+        if (page != NULL)
+        {
+            memcpy(buf, page->page_cache, vmm->page_size);
+        }
+        else
+        {
+            backing_store_read(vmm, index[i], buf, vmm->page_size);
+        }
+        ok = fwrite(buf, sizeof(uint8_t), vmm->page_size, f) == vmm->page_size;
+    }
+    vmm->stats = stats;
+    free(buf);
+    free(index);
+    if (f != NULL && fclose(f) != 0)
+    {
+        ok = false;
+    }
+    if (!ok)
+    {
+        log_error("error writing snapshot %s", temp_filename);
+        remove(temp_filename);
+        return false;
+    }
+
+    // the old snapshot stays open until the new one is opened, the resumed pages are read from it until then
+    bool resumed = vmm->snapshot != NULL;
+    bool replaced = replace_file(temp_filename, filename);
+    if (!replaced && resumed)
+    {
+        // Windows does not rename open files, the snapshot is reopened below
+        fclose(vmm->snapshot);
+        vmm->snapshot = NULL;
+        replaced = replace_file(temp_filename, filename);
+    }
+    if (!replaced)
+    {
+        log_error("error renaming snapshot %s", temp_filename);
+        remove(temp_filename);
+    }
+    if (!resumed)
+    {
+        return replaced;
+    }
+    // the new snapshot holds every page the old one did, otherwise this reopens the old one
+    if (snapshot_open(vmm, filename, generation))
+    {
+        return replaced;
+    }
+    if (vmm->snapshot == NULL)
+    {
+        log_error("%s cannot be reopened, the pages resumed from it are lost", filename);
+        snapshot_close(vmm);
+        free(vmm->snapshot_pages);
+        vmm->snapshot_pages = NULL;
+    }
+    return false;
+}
+
+bool vmm_attach_base(VMM_t *vmm, const char *filename, uint64_t generation)
+{
+    if (vmm->backend != VMM_BACKEND_PAGED || page_pool_count(vmm->page_pool) != 0 || !snapshot_open(vmm, filename, generation))
+    {
+        return false;
+    }
+    free(vmm->snapshot_pages);
+    vmm->snapshot_pages = (uint8_t *)calloc((vmm->number_of_store_pages + 7) / 8, 1);
+    assert(vmm->snapshot_pages);
+    // pages that are not in the snapshot were zero pages, also those a persistent pagefile kept
+    memset(vmm->zero_pages, 0xff, (vmm->number_of_store_pages + 7) / 8);
+    for (size_t i = 0; i < vmm->snapshot_count; i++)
+    {
+        size_t page_number = vmm->snapshot_index[i];
+        vmm->snapshot_pages[page_number / 8] |= 1 << (page_number % 8);
+        set_zero_page(vmm, page_number, false);
+    }
+    log_info("resumed %zu pages from %s", vmm->snapshot_count, filename);
+    return true;
+}
+
+bool vmm_snapshot_save(VMM_t *vmm, const char *filename)
+{
+    return vmm_save_base(vmm, filename, 0);
+}
+
+bool vmm_snapshot_load(VMM_t *vmm, const char *filename)
+{
+    return vmm_attach_base(vmm, filename, 0);
+}
+
+void vmm_get_stats(VMM_t *vmm, vmm_stats_t *stats)
+{
+    *stats = vmm->stats;
+}
+
+void vmm_reset_stats(VMM_t *vmm)
+{
+    memset(&vmm->stats, 0, sizeof(vmm->stats));
 }
\ No newline at end of file
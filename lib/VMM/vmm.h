@@ -4,11 +4,13 @@
 // #include <llist.h>
 // #include <splaytree.h>
 
-#include <lru_cache.h>
 #include <direct_cache.h>
 #include <page_cache.h>
+#include <compressed_cache.h>
 
 #include "vmtable.h"
+#include "page_pool.h"
+#include "write_behind.h"
 #include <log.h>
 
 #define MAX(x, y) (((x) > (y)) ? (x) : (y))
@@ -19,9 +21,102 @@ extern "C" {
 #endif
 
 // #define VMM_DEBUG
+// records the page access stream of every VMM to <pagefile>.trace, see vmm_trace_start
+// #define VMM_TRACE
+
+/* called right before a page buffer is evicted or written back, host pointers
+   obtained with vmm_get_page_ptr into [page, page + page_size) must be dropped */
+typedef void (*vmm_evict_callback_t)(void *context, uint8_t *page, size_t page_size);
+
+#define VMM_MAX_EVICT_SUBSCRIBERS 4
+
+// pages evicted together when the page pool is full, at most a quarter of the pool,
+// their write-backs reach the page cache in page order
+#define VMM_EVICT_BATCH 8
+
+// longest read-ahead of a sequential fault stream, at most a quarter of the pool, see vmm_set_readahead
+#define VMM_READAHEAD_PAGES 8
+
+typedef struct vmm_evict_subscriber_t
+{
+    vmm_evict_callback_t on_evict;
+    void *context;
+} vmm_evict_subscriber_t;
+
+typedef enum vmm_backend_t
+{
+    VMM_BACKEND_PAGED,          // pages through the page pool, himem page cache and pagefile
+    VMM_BACKEND_MMAP_FILE,      // maps the pagefile, native linux only
+    VMM_BACKEND_MMAP_ANONYMOUS, // maps anonymous memory, native linux only
+} vmm_backend_t;
+
+typedef enum vmm_access_t
+{
+    VMM_ACCESS_READ,
+    VMM_ACCESS_WRITE,
+    VMM_ACCESS_CODE,
+} vmm_access_t;
+
+/* page trace file: the magic, a little endian uint32_t page size, then one LEB128 varint per
+   page lookup holding (zigzag(page_number - previous_page_number) << 2) | vmm_access_t */
+#define VMM_TRACE_MAGIC "VMMTRC01"
+#define VMM_TRACE_BUFFER_SIZE 4096
+
+#define VMM_LATENCY_BUCKETS 24
+
+/* snapshot and base image file: the magic, uint32_t page size, uint32_t number of saved pages, uint64_t number
+   of store pages, uint64_t generation, the ascending uint32_t page numbers of the saved pages, then the saved pages
+   in the same order */
+#define VMM_SNAPSHOT_MAGIC "VMMSNP02"
+
+/* index of a persistent pagefile, <pagefile>.idx: the magic, uint32_t page size, uint64_t number of store pages,
+   uint64_t generation, then one bit per store page that is set while the pagefile holds the page as persisted */
+#define VMM_PAGEFILE_INDEX_MAGIC "VMMIDX01"
+#define VMM_PAGEFILE_INDEX_HEADER (8 + 4 + 8 + 8)
+
+/* latency histograms are in log2 microsecond buckets, bucket 0 is under 1us,
+   bucket n holds [2^(n-1), 2^n) us and the last bucket everything slower */
+typedef struct vmm_stats_t
+{
+    size_t reads;
+    size_t read_bytes;
+    size_t writes;
+    size_t write_bytes;
+
+    // where page lookups were resolved
+    size_t direct_cache_hits;
+    size_t page_pool_hits;
+    size_t page_faults;
+    size_t zero_fills;        // faults on zero pages, served without any I/O
+    size_t snapshot_reads;    // faults served from a resumed snapshot or a base image
+    size_t compressed_hits;   // faults served from the compressed tier
+    size_t page_cache_hits;   // faults served from the himem page cache
+    size_t store_reads;       // faults served from the backing store
+    size_t store_read_bytes;
+
+    size_t evictions;
+    size_t dirty_writebacks;  // dirty pages written to the himem page cache
+    size_t zero_writebacks;   // dirty pages that were all zero and were dropped instead
+    size_t compressed_stores;  // dirty pages kept in the compressed tier
+    size_t compressed_rejects; // dirty pages that did not compress and went to the page cache
+    size_t store_writes;      // pages written to the backing store
+    size_t store_write_bytes;
+    size_t store_write_requests; // writes issued to the backing store, adjacent pages are merged into one
+
+    size_t write_behind_hits;   // faults served from the write-behind queue
+    size_t write_behind_stalls; // evictions that waited for room in the write-behind queue
+
+    size_t readahead_pages;  // pages read ahead of a sequential fault stream
+    size_t readahead_hits;   // read ahead pages that were accessed
+    size_t readahead_wasted; // read ahead pages evicted or cancelled before any access
+
+    size_t store_read_latency[VMM_LATENCY_BUCKETS];
+    size_t store_write_latency[VMM_LATENCY_BUCKETS];
+} vmm_stats_t;
 
 typedef struct VMM_t
 {
+    vmm_backend_t backend;
     size_t page_size;
     size_t number_of_pages;
 
@@ -32,28 +127,72 @@ typedef struct VMM_t
     char filename[255];
 
     // splaytree_t * search_tree;
-    cache_t * lru_cache;
+    page_pool_t * page_pool;
     direct_cache_t * direct_cache;
     page_cache_t * page_cache;
-#ifdef VMM_DEBUG
-    size_t reads;
-    size_t read_bytes;
-    size_t writes;
-    size_t write_bytes;
+    eviction_policy_type_t policy;
 
-    size_t store_writes;
-    size_t store_write_bytes;
-    size_t store_write_time;
-    size_t store_reads;
-    size_t store_read_bytes;
-    size_t store_read_time;
+    // compressed pages in front of the page cache, NULL when not enabled
+    compressed_cache_t *compressed_cache;
 
-    size_t page_faults;
-#endif
+    size_t evict_batch;
+    vmTable_t **writeback; // one entry per page frame, pages collected for a sorted write-back
+
+    // dirty pages on their way to the page cache, NULL when written synchronously
+    write_behind_t *write_behind;
+
+    // sequential fault detection, the window doubles while faults follow the previous read
+    // and halves when read ahead pages are evicted unused
+    size_t number_of_store_pages;
+    uint8_t *zero_pages;       // one bit per store page, set while the page holds only zeros
+
+    // resumed snapshot or base image, its pages are faulted in from it until they are written back,
+    // the file is never written
+    FILE *snapshot;
+    uint8_t *snapshot_pages;   // one bit per store page, set while the newest copy is in the snapshot
+    uint32_t *snapshot_index;  // ascending page numbers of the pages in the snapshot
+    size_t snapshot_count;
+    long snapshot_data;        // file offset of the first page
+
+    // index of a persistent pagefile, NULL when the pagefile is recreated on every run
+    FILE *index;
+    uint8_t *persistent_pages; // one bit per store page, cleared before other contents can reach the pagefile
+    size_t readahead_max;
+    size_t readahead_window;
+    size_t readahead_next;    // page a sequential stream faults on next
+    uint8_t *readahead_buffer; // readahead_max pages, one backing store read
+
+    vmm_evict_subscriber_t evict_subscribers[VMM_MAX_EVICT_SUBSCRIBERS];
+
+    // mmap backends, every page is resident and never evicted
+    uint8_t *mapping;
+    size_t mapping_size;
+    int mapping_fd;
+    vmTable_t *mapped_pages;
+
+    vmm_stats_t stats;
+
+    FILE *trace;
+    uint8_t *trace_buffer;
+    size_t trace_length;
+    size_t trace_last_page;
 } VMM_t;
 
+/* pages are replaced with EVICTION_POLICY_CLOCK */
 VMM_t *vmm_create(const char *pagefile, size_t maximum_size, size_t page_size, size_t number_of_pages, size_t maximum_himem_blocks);
 
+/* falls back to VMM_BACKEND_PAGED when the backend is not available on this platform,
+   policy replaces pages in the page pool and the himem page cache */
+VMM_t *vmm_create_backend(vmm_backend_t backend, const char *pagefile, size_t maximum_size, size_t page_size, size_t number_of_pages, size_t maximum_himem_blocks, eviction_policy_type_t policy);
+
+/* keeps the pagefile of an earlier run when its index has the same page size, size and generation,
+   the pages persisted with vmm_persist keep their contents and every other page starts as a zero page.
+   otherwise the pagefile is recreated. paged backend, the other VMMs remove the index of their pagefile */
+VMM_t *vmm_create_persistent(const char *pagefile, size_t maximum_size, size_t page_size, size_t number_of_pages, size_t maximum_himem_blocks, eviction_policy_type_t policy, uint64_t generation);
+
+/* parses "paged", "mmap" or "mmap_anonymous", returns false for unknown names */
+bool vmm_parse_backend(const char *name, vmm_backend_t *backend);
+
 void vmm_destroy(VMM_t *vmm);
 
 void vmm_read(VMM_t *vmm, size_t addr, void *target, size_t len);
@@ -62,6 +201,95 @@ void vmm_write(VMM_t *vmm, const size_t addr, const void *source, const size_t l
 
 void vmm_flush(VMM_t *vmm);
 
+/* evicted dirty pages are queued and written to the page cache and backing store by a background writer,
+   a fault only waits when the queue of number_of_pages pages is full. paged backend only */
+bool vmm_start_write_behind(VMM_t *vmm, size_t number_of_pages);
+
+/* writes the queued pages and stops the writer */
+void vmm_stop_write_behind(VMM_t *vmm);
+
+/* keeps evicted dirty pages LZ compressed in an arena of arena_size bytes in front of the himem page cache,
+   pages only move on to the page cache when the arena is full or they do not compress. paged backend only */
+bool vmm_start_compressed_tier(VMM_t *vmm, size_t arena_size);
+
+/* reads up to max_pages pages with one backing store read when faults are sequential,
+   pages are only read ahead into free frames. 0 or 1 disables read-ahead. paged backend only */
+void vmm_set_readahead(VMM_t *vmm, size_t max_pages);
+
+/* drops the read ahead pages that were not accessed yet, e.g. under memory pressure */
+void vmm_cancel_readahead(VMM_t *vmm);
+
+/* writes the dirty pages and keeps every page that is not a zero page for the next run,
+   a page drops out once it is written back with other contents. false when the VMM is not persistent */
+bool vmm_persist(VMM_t *vmm);
+
+/* true when every page of [addr, addr + len) still holds the contents persisted by an earlier run
+   or those of the attached base image */
+bool vmm_is_persistent(VMM_t *vmm, size_t addr, size_t len);
+
+/* writes every page that is not a zero page to filename, see VMM_SNAPSHOT_MAGIC,
+   generation identifies the contents, e.g. the boot images they were loaded from. paged backend only */
+bool vmm_save_base(VMM_t *vmm, const char *filename, uint64_t generation);
+
+/* runs the VMM as a copy-on-write overlay of a file written by vmm_save_base with the same generation,
+   its pages are read from filename on their first fault until they are written back to the pagefile.
+   filename is only read and can be shared by any number of VMMs. must be called before the first access,
+   the file stays open until vmm_destroy. paged backend only */
+bool vmm_attach_base(VMM_t *vmm, const char *filename, uint64_t generation);
+
+/* vmm_save_base of generation 0 */
+bool vmm_snapshot_save(VMM_t *vmm, const char *filename);
+
+/* vmm_attach_base of generation 0 */
+bool vmm_snapshot_load(VMM_t *vmm, const char *filename);
+
+/* copies the counters, they are always maintained */
+void vmm_get_stats(VMM_t *vmm, vmm_stats_t *stats);
+
+void vmm_reset_stats(VMM_t *vmm);
+
+/* records every page lookup that reaches the VMM to a trace file for tools/vmm_trace_sim,
+   accesses served by the CPU TLB never reach the VMM and are not recorded */
+bool vmm_trace_start(VMM_t *vmm, const char *filename);
+
+void vmm_trace_stop(VMM_t *vmm);
+
+/* returns a host pointer to the byte at addr, valid until the owning page is evicted,
+   a write access marks the page dirty */
+uint8_t *vmm_get_page_ptr(VMM_t *vmm, size_t addr, bool is_write);
+
+/* returns a host pointer to the byte at addr and pins its page until vmm_release_ptr,
+   *len is set to the number of bytes accessible up to the end of the page.
+   a write access marks the page dirty, it stays dirty until released */
+uint8_t *vmm_acquire_ptr(VMM_t *vmm, size_t addr, bool is_write, size_t *len, vmTable_t **page);
+
+/* is_write must be the one the pointer was acquired with */
+void vmm_release_ptr(VMM_t *vmm, vmTable_t *page, bool is_write);
+
+/* faults in the page holding addr, a write access marks the page dirty,
+   the entry stays valid until the page is evicted */
+vmTable_t *vmm_get_page(VMM_t *vmm, size_t addr, bool is_write);
+
+/* vmm_get_page for instruction fetches, only differs in how the access is traced */
+vmTable_t *vmm_get_code_page(VMM_t *vmm, size_t addr);
+
+/* pinned pages are skipped by eviction, used for pages the CPU executes from,
+   a flush still cleans them so writes must mark them dirty again */
+static inline void vmm_pin_page(vmTable_t *page)
+{
+    page->pin_count++;
+}
+
+static inline void vmm_unpin_page(vmTable_t *page)
+{
+    page->pin_count--;
+}
+
+/* returns 0 on success, -1 when all subscriber slots are taken */
+int vmm_subscribe_evict(VMM_t *vmm, vmm_evict_callback_t on_evict, void *context);
+
+void vmm_unsubscribe_evict(VMM_t *vmm, vmm_evict_callback_t on_evict, void *context);
+
 
 #ifdef __cplusplus
 }
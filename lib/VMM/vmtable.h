@@ -9,4 +9,9 @@ typedef struct vmTable_t
     size_t page_address;
     uint8_t *page_cache;
     bool dirty;
+    uint16_t pin_count; // pinned pages are never evicted
+    uint16_t write_pin_count; // pins of writable acquired pointers, the page stays dirty while there are any
+    bool mapped;        // frame holds page_number
+    bool prefetched;    // read ahead and not accessed yet
+    struct vmTable_t *next; // page pool index chain
 } vmTable_t;
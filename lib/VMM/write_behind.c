@@ -0,0 +1,336 @@
+#include "write_behind.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#ifdef ESP32
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+
+#define WRITE_BEHIND_TASK_STACK 4096
+
+typedef SemaphoreHandle_t wb_mutex_t;
+typedef SemaphoreHandle_t wb_event_t;
+
+static void mutex_init(wb_mutex_t *mutex)
+{
+    *mutex = xSemaphoreCreateMutex();
+    assert(*mutex);
+}
+
+static void mutex_lock(wb_mutex_t *mutex)
+{
+    xSemaphoreTake(*mutex, portMAX_DELAY);
+}
+
+static void mutex_unlock(wb_mutex_t *mutex)
+{
+    xSemaphoreGive(*mutex);
+}
+
+static void mutex_destroy(wb_mutex_t *mutex)
+{
+    vSemaphoreDelete(*mutex);
+}
+
+static void event_init(wb_event_t *event)
+{
+    *event = xSemaphoreCreateBinary();
+    assert(*event);
+}
+
+static void event_signal(wb_event_t *event)
+{
+    xSemaphoreGive(*event);
+}
+
+static void event_wait(wb_event_t *event)
+{
+    xSemaphoreTake(*event, portMAX_DELAY);
+}
+
+static void event_destroy(wb_event_t *event)
+{
+    vSemaphoreDelete(*event);
+}
+#else
+#include <pthread.h>
+
+typedef pthread_mutex_t wb_mutex_t;
+
+// binary semaphore, a signal without a waiter wakes the next wait
+typedef struct wb_event_t
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool signaled;
+} wb_event_t;
+
+static void mutex_init(wb_mutex_t *mutex)
+{
+    pthread_mutex_init(mutex, NULL);
+}
+
+static void mutex_lock(wb_mutex_t *mutex)
+{
+    pthread_mutex_lock(mutex);
+}
+
+static void mutex_unlock(wb_mutex_t *mutex)
+{
+    pthread_mutex_unlock(mutex);
+}
+
+static void mutex_destroy(wb_mutex_t *mutex)
+{
+    pthread_mutex_destroy(mutex);
+}
+
+static void event_init(wb_event_t *event)
+{
+    pthread_mutex_init(&event->mutex, NULL);
+    pthread_cond_init(&event->cond, NULL);
+    event->signaled = false;
+}
+
+static void event_signal(wb_event_t *event)
+{
+    pthread_mutex_lock(&event->mutex);
+    event->signaled = true;
+    pthread_cond_signal(&event->cond);
+    pthread_mutex_unlock(&event->mutex);
+}
+
+static void event_wait(wb_event_t *event)
+{
+    pthread_mutex_lock(&event->mutex);
+    while (!event->signaled)
+    {
+        pthread_cond_wait(&event->cond, &event->mutex);
+    }
+    event->signaled = false;
+    pthread_mutex_unlock(&event->mutex);
+}
+
+static void event_destroy(wb_event_t *event)
+{
+    pthread_cond_destroy(&event->cond);
+    pthread_mutex_destroy(&event->mutex);
+}
+#endif
+
+struct write_behind_slot_t
+{
+    size_t page_number;
+    uint8_t *page;
+};
+
+struct _write_behind_t
+{
+    size_t page_size;
+    write_behind_write_t write;
+    void *context;
+
+    // ring of queued pages, the oldest stays queued while it is being written
+    struct write_behind_slot_t *slots;
+    size_t number_of_slots;
+    size_t oldest;
+    size_t count;
+    bool stop;
+
+    wb_mutex_t queue_lock; // slots, oldest, count and stop
+    wb_mutex_t store_lock;
+    wb_event_t queued;  // wakes the writer
+    wb_event_t written; // wakes the owner waiting for room or for the queue to drain
+
+#ifdef ESP32
+    wb_event_t stopped;
+#else
+    pthread_t writer;
+#endif
+};
+
+static void writer_loop(write_behind_t *write_behind)
+{
+    mutex_lock(&write_behind->queue_lock);
+    for (;;)
+    {
+        while (write_behind->count == 0 && !write_behind->stop)
+        {
+            mutex_unlock(&write_behind->queue_lock);
+            event_wait(&write_behind->queued);
+            mutex_lock(&write_behind->queue_lock);
+        }
+        if (write_behind->count == 0)
+        {
+            break;
+        }
+        // the owner never refills a queued slot, so the page can be written without the queue lock
+        struct write_behind_slot_t *slot = &write_behind->slots[write_behind->oldest];
+        mutex_unlock(&write_behind->queue_lock);
+
+        mutex_lock(&write_behind->store_lock);
+        write_behind->write(write_behind->context, slot->page_number, slot->page);
+        mutex_unlock(&write_behind->store_lock);
+
+        mutex_lock(&write_behind->queue_lock);
+        write_behind->oldest = (write_behind->oldest + 1) % write_behind->number_of_slots;
+        write_behind->count--;
+        event_signal(&write_behind->written);
+    }
+    mutex_unlock(&write_behind->queue_lock);
+}
+
+#ifdef ESP32
+static void writer_task(void *argument)
+{
+    write_behind_t *write_behind = (write_behind_t *)argument;
+    writer_loop(write_behind);
+    event_signal(&write_behind->stopped);
+    vTaskDelete(NULL);
+}
+#else
+static void *writer_thread(void *argument)
+{
+    writer_loop((write_behind_t *)argument);
+    return NULL;
+}
+#endif
+
+write_behind_t *write_behind_init(size_t page_size, size_t number_of_pages, write_behind_write_t write, void *context)
+{
+    assert(number_of_pages > 0);
+    write_behind_t *write_behind = (write_behind_t *)calloc(1, sizeof(write_behind_t));
+    assert(write_behind);
+    write_behind->page_size = page_size;
+    write_behind->write = write;
+    write_behind->context = context;
+    write_behind->number_of_slots = number_of_pages;
+    write_behind->slots = (struct write_behind_slot_t *)calloc(number_of_pages, sizeof(struct write_behind_slot_t));
+    assert(write_behind->slots);
+    for (size_t i = 0; i < number_of_pages; i++)
+    {
+        write_behind->slots[i].page = (uint8_t *)malloc(page_size);
+        assert(write_behind->slots[i].page);
+    }
+
+    mutex_init(&write_behind->queue_lock);
+    mutex_init(&write_behind->store_lock);
+    event_init(&write_behind->queued);
+    event_init(&write_behind->written);
+
+#ifdef ESP32
+    event_init(&write_behind->stopped);
+    // the other core writes while this one keeps interpreting
+    BaseType_t core = tskNO_AFFINITY;
+#if portNUM_PROCESSORS > 1
+    core = xPortGetCoreID() ^ 1;
+#endif
+    BaseType_t created = xTaskCreatePinnedToCore(writer_task, "vmm_writer", WRITE_BEHIND_TASK_STACK, write_behind, uxTaskPriorityGet(NULL), NULL, core);
+    assert(created == pdPASS);
+#else
+    int created = pthread_create(&write_behind->writer, NULL, writer_thread, write_behind);
+    assert(created == 0);
+#endif
+    (void)created;
+    return write_behind;
+}
+
+bool write_behind_push(write_behind_t *write_behind, size_t page_number, const uint8_t *page)
+{
+    bool waited = false;
+    mutex_lock(&write_behind->queue_lock);
+    while (write_behind->count == write_behind->number_of_slots)
+    {
+        waited = true;
+        mutex_unlock(&write_behind->queue_lock);
+        event_wait(&write_behind->written);
+        mutex_lock(&write_behind->queue_lock);
+    }
+    struct write_behind_slot_t *slot = &write_behind->slots[(write_behind->oldest + write_behind->count) % write_behind->number_of_slots];
+    slot->page_number = page_number;
+    memcpy(slot->page, page, write_behind->page_size);
+    write_behind->count++;
+    mutex_unlock(&write_behind->queue_lock);
+    event_signal(&write_behind->queued);
+    return waited;
+}
+
+bool write_behind_read(write_behind_t *write_behind, size_t page_number, uint8_t *page)
+{
+    bool found = false;
+    mutex_lock(&write_behind->queue_lock);
+    for (size_t i = write_behind->count; i > 0 && !found; i--)
+    {
+        struct write_behind_slot_t *slot = &write_behind->slots[(write_behind->oldest + i - 1) % write_behind->number_of_slots];
+        if (slot->page_number == page_number)
+        {
+            memcpy(page, slot->page, write_behind->page_size);
+            found = true;
+        }
+    }
+    mutex_unlock(&write_behind->queue_lock);
+    return found;
+}
+
+bool write_behind_contains(write_behind_t *write_behind, size_t page_number)
+{
+    bool found = false;
+    mutex_lock(&write_behind->queue_lock);
+    for (size_t i = 0; i < write_behind->count && !found; i++)
+    {
+        found = write_behind->slots[(write_behind->oldest + i) % write_behind->number_of_slots].page_number == page_number;
+    }
+    mutex_unlock(&write_behind->queue_lock);
+    return found;
+}
+
+void write_behind_drain(write_behind_t *write_behind)
+{
+    mutex_lock(&write_behind->queue_lock);
+    while (write_behind->count > 0)
+    {
+        mutex_unlock(&write_behind->queue_lock);
+        event_wait(&write_behind->written);
+        mutex_lock(&write_behind->queue_lock);
+    }
+    mutex_unlock(&write_behind->queue_lock);
+}
+
+void write_behind_lock_store(write_behind_t *write_behind)
+{
+    mutex_lock(&write_behind->store_lock);
+}
+
+void write_behind_unlock_store(write_behind_t *write_behind)
+{
+    mutex_unlock(&write_behind->store_lock);
+}
+
+void write_behind_free(write_behind_t *write_behind)
+{
+    mutex_lock(&write_behind->queue_lock);
+    write_behind->stop = true;
+    mutex_unlock(&write_behind->queue_lock);
+    event_signal(&write_behind->queued);
+
+#ifdef ESP32
+    event_wait(&write_behind->stopped);
+    event_destroy(&write_behind->stopped);
+#else
+    pthread_join(write_behind->writer, NULL);
+#endif
+
+    event_destroy(&write_behind->queued);
+    event_destroy(&write_behind->written);
+    mutex_destroy(&write_behind->queue_lock);
+    mutex_destroy(&write_behind->store_lock);
+    for (size_t i = 0; i < write_behind->number_of_slots; i++)
+    {
+        free(write_behind->slots[i].page);
+    }
+    free(write_behind->slots);
+    free(write_behind);
+}
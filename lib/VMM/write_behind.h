@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// bounded queue of page copies written by a background writer, a pthread natively
+// and a FreeRTOS task pinned to the other core on ESP32.
+// pages are written in the order they were queued and stay readable until written
+
+struct _write_behind_t;
+typedef struct _write_behind_t write_behind_t;
+
+/* runs on the writer with the store lock held */
+typedef void (*write_behind_write_t)(void *context, size_t page_number, const uint8_t *page);
+
+write_behind_t *write_behind_init(size_t page_size, size_t number_of_pages, write_behind_write_t write, void *context);
+
+/* copies the page into the queue, waits while the queue is full,
+   returns true when it had to wait */
+bool write_behind_push(write_behind_t *write_behind, size_t page_number, const uint8_t *page);
+
+/* copies the newest queued copy of page_number, returns false when it is not queued */
+bool write_behind_read(write_behind_t *write_behind, size_t page_number, uint8_t *page);
+
+bool write_behind_contains(write_behind_t *write_behind, size_t page_number);
+
+/* waits until every queued page was written */
+void write_behind_drain(write_behind_t *write_behind);
+
+/* serializes the owner's own access to whatever the write callback writes to */
+void write_behind_lock_store(write_behind_t *write_behind);
+
+void write_behind_unlock_store(write_behind_t *write_behind);
+
+/* drains the queue and stops the writer */
+void write_behind_free(write_behind_t *write_behind);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,341 @@
+#include "compressed_cache.h"
+#include "lz.h"
+
+#include <memory_indexer.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+#define NO_CHUNK UINT32_MAX
+
+struct compressed_cache_entry_t
+{
+    size_t page_number;
+    uint32_t first_chunk; // chunks are chained through chunk_next
+    uint32_t compressed_size; // 0 for a zero page
+    bool dirty; // newer than the backing store
+};
+
+struct _compressed_cache_t
+{
+    size_t page_size;
+    size_t maximum_compressed_size;
+
+    uint8_t *arena;
+    uint32_t *chunk_next;
+    uint32_t free_chunk;
+    size_t number_of_chunks;
+    size_t number_of_free_chunks;
+
+    // one entry per chunk, zero pages may use entries without chunks
+    struct compressed_cache_entry_t *entries;
+    size_t number_of_entries;
+    size_t *free_entries;
+    size_t number_of_free_entries;
+    memory_indexer_t *index; // page number -> entry
+    eviction_policy_t *policy;
+    size_t protected_entry; // the entry being stored is never its own victim
+
+    size_t compressed_bytes;
+    uint16_t *hash_table;
+    uint8_t *compress_buffer;
+    uint8_t *gather_buffer; // chunks of the page being decompressed
+    uint8_t *page_buffer;
+    uint8_t *flush_buffer; // COMPRESSED_CACHE_FLUSH_PAGES pages
+    struct compressed_cache_entry_t **flush_order;
+
+    void (*on_evict)(size_t page_number, void *buf, void *context);
+    void (*on_flush)(size_t page_number, void *buf, size_t number_of_pages, void *context);
+    void *context;
+};
+
+compressed_cache_t *compressed_cache_init(size_t page_size, size_t arena_size, eviction_policy_type_t policy,
+                                          void (*on_evict)(size_t page_number, void *buf, void *context),
+                                          void (*on_flush)(size_t page_number, void *buf, size_t number_of_pages, void *context),
+                                          void *context)
+{
+    assert(page_size <= LZ_MAX_INPUT);
+    // the arena holds at least one page that barely compresses
+    assert(arena_size >= page_size);
+    compressed_cache_t *cache = (compressed_cache_t *)calloc(1, sizeof(compressed_cache_t));
+    assert(cache);
+    cache->page_size = page_size;
+    cache->maximum_compressed_size = page_size * 3 / 4;
+    cache->on_evict = on_evict;
+    cache->on_flush = on_flush;
+    cache->context = context;
+
+    cache->number_of_chunks = arena_size / COMPRESSED_CACHE_CHUNK;
+    cache->arena = (uint8_t *)malloc(cache->number_of_chunks * COMPRESSED_CACHE_CHUNK);
+    cache->chunk_next = (uint32_t *)malloc(sizeof(uint32_t) * cache->number_of_chunks);
+    assert(cache->arena && cache->chunk_next);
+    for (size_t i = 0; i < cache->number_of_chunks; i++)
+    {
+        cache->chunk_next[i] = (i + 1 < cache->number_of_chunks) ? (uint32_t)(i + 1) : NO_CHUNK;
+    }
+    cache->free_chunk = 0;
+    cache->number_of_free_chunks = cache->number_of_chunks;
+
+    cache->number_of_entries = cache->number_of_chunks;
+    cache->entries = (struct compressed_cache_entry_t *)calloc(cache->number_of_entries, sizeof(struct compressed_cache_entry_t));
+    cache->free_entries = (size_t *)malloc(sizeof(size_t) * cache->number_of_entries);
+    cache->flush_order = (struct compressed_cache_entry_t **)malloc(sizeof(struct compressed_cache_entry_t *) * cache->number_of_entries);
+    assert(cache->entries && cache->free_entries && cache->flush_order);
+    for (size_t i = 0; i < cache->number_of_entries; i++)
+    {
+        cache->free_entries[i] = cache->number_of_entries - 1 - i;
+    }
+    cache->number_of_free_entries = cache->number_of_entries;
+    cache->index = memory_indexer_init_with_capacity(MEMORY_INDEXER_HASH, cache->number_of_entries);
+    cache->policy = eviction_policy_init(policy, cache->number_of_entries);
+
+    cache->hash_table = (uint16_t *)malloc(sizeof(uint16_t) * LZ_HASH_SIZE);
+    cache->compress_buffer = (uint8_t *)malloc(cache->maximum_compressed_size);
+    cache->gather_buffer = (uint8_t *)malloc(cache->maximum_compressed_size);
+    cache->page_buffer = (uint8_t *)malloc(page_size);
+    cache->flush_buffer = (uint8_t *)malloc(page_size * COMPRESSED_CACHE_FLUSH_PAGES);
+    assert(cache->hash_table && cache->compress_buffer && cache->gather_buffer && cache->page_buffer && cache->flush_buffer);
+    return cache;
+}
+
+static inline size_t chunks_for(size_t compressed_size)
+{
+    return (compressed_size + COMPRESSED_CACHE_CHUNK - 1) / COMPRESSED_CACHE_CHUNK;
+}
+
+static void release_chunks(compressed_cache_t *cache, struct compressed_cache_entry_t *entry)
+{
+    uint32_t chunk = entry->first_chunk;
+    while (chunk != NO_CHUNK)
+    {
+        uint32_t next = cache->chunk_next[chunk];
+        cache->chunk_next[chunk] = cache->free_chunk;
+        cache->free_chunk = chunk;
+        cache->number_of_free_chunks++;
+        chunk = next;
+    }
+    entry->first_chunk = NO_CHUNK;
+    cache->compressed_bytes -= entry->compressed_size;
+    entry->compressed_size = 0;
+}
+
+static void store_chunks(compressed_cache_t *cache, struct compressed_cache_entry_t *entry, const uint8_t *data, size_t size)
+{
+    assert(cache->number_of_free_chunks >= chunks_for(size));
+    uint32_t *link = &entry->first_chunk;
+    for (size_t offset = 0; offset < size; offset += COMPRESSED_CACHE_CHUNK)
+    {
+        uint32_t chunk = cache->free_chunk;
+        cache->free_chunk = cache->chunk_next[chunk];
+        cache->number_of_free_chunks--;
+        memcpy(cache->arena + (size_t)chunk * COMPRESSED_CACHE_CHUNK, data + offset, MIN(COMPRESSED_CACHE_CHUNK, size - offset));
+        *link = chunk;
+        link = &cache->chunk_next[chunk];
+    }
+    *link = NO_CHUNK;
+    entry->compressed_size = (uint32_t)size;
+    cache->compressed_bytes += size;
+}
+
+static void load_page(compressed_cache_t *cache, struct compressed_cache_entry_t *entry, uint8_t *page)
+{
+    if (entry->compressed_size == 0)
+    {
+        memset(page, 0, cache->page_size);
+        return;
+    }
+    // gather the chunks, then decompress
+    size_t offset = 0;
+    for (uint32_t chunk = entry->first_chunk; chunk != NO_CHUNK; chunk = cache->chunk_next[chunk])
+    {
+        size_t length = MIN(COMPRESSED_CACHE_CHUNK, entry->compressed_size - offset);
+        memcpy(cache->gather_buffer + offset, cache->arena + (size_t)chunk * COMPRESSED_CACHE_CHUNK, length);
+        offset += length;
+    }
+    bool decompressed = lz_decompress(cache->gather_buffer, entry->compressed_size, page, cache->page_size);
+    assert(decompressed);
+    (void)decompressed;
+}
+
+static void remove_entry(compressed_cache_t *cache, struct compressed_cache_entry_t *entry)
+{
+    release_chunks(cache, entry);
+    entry->dirty = false;
+    memory_indexer_remove(cache->index, entry->page_number);
+    cache->free_entries[cache->number_of_free_entries++] = entry - cache->entries;
+}
+
+static bool can_evict_entry(void *context, size_t slot)
+{
+    compressed_cache_t *cache = (compressed_cache_t *)context;
+    return slot != cache->protected_entry;
+}
+
+static bool evict_one(compressed_cache_t *cache, size_t page_number)
+{
+    size_t slot = eviction_policy_victim(cache->policy, page_number, can_evict_entry, cache);
+    if (slot == EVICTION_POLICY_NONE)
+    {
+        return false;
+    }
+    struct compressed_cache_entry_t *entry = &cache->entries[slot];
+    if (entry->dirty)
+    {
+        load_page(cache, entry, cache->page_buffer);
+        cache->on_evict(entry->page_number, cache->page_buffer, cache->context);
+    }
+    remove_entry(cache, entry);
+    return true;
+}
+
+static bool is_zero_page(const uint8_t *page, size_t page_size)
+{
+    for (size_t i = 0; i < page_size; i++)
+    {
+        if (page[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool compressed_cache_get(compressed_cache_t *cache, size_t page_number, void *buf)
+{
+    struct compressed_cache_entry_t *entry = memory_indexer_search(cache->index, page_number);
+    if (entry == NULL)
+    {
+        return false;
+    }
+    eviction_policy_access(cache->policy, entry - cache->entries);
+    load_page(cache, entry, (uint8_t *)buf);
+    return true;
+}
+
+bool compressed_cache_set(compressed_cache_t *cache, size_t page_number, const void *buf)
+{
+    struct compressed_cache_entry_t *entry = memory_indexer_search(cache->index, page_number);
+
+    size_t size = 0;
+    if (!is_zero_page((const uint8_t *)buf, cache->page_size))
+    {
+        size = lz_compress((const uint8_t *)buf, cache->page_size, cache->compress_buffer, cache->maximum_compressed_size, cache->hash_table);
+        if (size == 0)
+        {
+            if (entry != NULL)
+            {
+                eviction_policy_remove(cache->policy, entry - cache->entries);
+                remove_entry(cache, entry);
+            }
+            return false;
+        }
+    }
+
+    if (entry != NULL)
+    {
+        release_chunks(cache, entry);
+        eviction_policy_access(cache->policy, entry - cache->entries);
+    }
+    else
+    {
+        if (cache->number_of_free_entries == 0)
+        {
+            cache->protected_entry = EVICTION_POLICY_NONE;
+            evict_one(cache, page_number);
+        }
+        size_t slot = cache->free_entries[--cache->number_of_free_entries];
+        entry = &cache->entries[slot];
+        entry->page_number = page_number;
+        entry->first_chunk = NO_CHUNK;
+        entry->compressed_size = 0;
+        memory_indexer_set(cache->index, page_number, entry);
+        eviction_policy_insert(cache->policy, slot, page_number);
+    }
+
+    cache->protected_entry = entry - cache->entries;
+    while (cache->number_of_free_chunks < chunks_for(size))
+    {
+        bool evicted = evict_one(cache, page_number);
+        assert(evicted);
+        (void)evicted;
+    }
+    store_chunks(cache, entry, cache->compress_buffer, size);
+    entry->dirty = true;
+    return true;
+}
+
+bool compressed_cache_contains(compressed_cache_t *cache, size_t page_number)
+{
+    return memory_indexer_search(cache->index, page_number) != NULL;
+}
+
+static int compare_page_number(const void *a, const void *b)
+{
+    const struct compressed_cache_entry_t *entry_a = *(struct compressed_cache_entry_t *const *)a;
+    const struct compressed_cache_entry_t *entry_b = *(struct compressed_cache_entry_t *const *)b;
+    return (entry_a->page_number > entry_b->page_number) - (entry_a->page_number < entry_b->page_number);
+}
+
+void compressed_cache_flush(compressed_cache_t *cache)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < cache->number_of_entries; i++)
+    {
+        struct compressed_cache_entry_t *entry = &cache->entries[i];
+        if (entry->dirty)
+        {
+            cache->flush_order[count++] = entry;
+        }
+    }
+    qsort(cache->flush_order, count, sizeof(struct compressed_cache_entry_t *), compare_page_number);
+
+    // adjacent pages are gathered into one on_flush call
+    size_t first_page = 0;
+    size_t number_of_pages = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        struct compressed_cache_entry_t *entry = cache->flush_order[i];
+        if (number_of_pages > 0 && (entry->page_number != first_page + number_of_pages || number_of_pages == COMPRESSED_CACHE_FLUSH_PAGES))
+        {
+            cache->on_flush(first_page, cache->flush_buffer, number_of_pages, cache->context);
+            number_of_pages = 0;
+        }
+        if (number_of_pages == 0)
+        {
+            first_page = entry->page_number;
+        }
+        load_page(cache, entry, cache->flush_buffer + number_of_pages * cache->page_size);
+        entry->dirty = false;
+        number_of_pages++;
+    }
+    if (number_of_pages > 0)
+    {
+        cache->on_flush(first_page, cache->flush_buffer, number_of_pages, cache->context);
+    }
+}
+
+void compressed_cache_get_stats(compressed_cache_t *cache, size_t *pages, size_t *compressed_bytes, size_t *arena_bytes)
+{
+    *pages = cache->number_of_entries - cache->number_of_free_entries;
+    *compressed_bytes = cache->compressed_bytes;
+    *arena_bytes = (cache->number_of_chunks - cache->number_of_free_chunks) * COMPRESSED_CACHE_CHUNK;
+}
+
+void compressed_cache_free(compressed_cache_t *cache)
+{
+    memory_indexer_free(cache->index);
+    eviction_policy_free(cache->policy);
+    free(cache->arena);
+    free(cache->chunk_next);
+    free(cache->entries);
+    free(cache->free_entries);
+    free(cache->flush_order);
+    free(cache->hash_table);
+    free(cache->compress_buffer);
+    free(cache->gather_buffer);
+    free(cache->page_buffer);
+    free(cache->flush_buffer);
+    free(cache);
+}
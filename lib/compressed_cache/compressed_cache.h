@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <eviction_policy.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// compressed in-memory page tier in the style of zswap,
+// pages are LZ compressed into fixed size chunks of one arena, zero pages take no chunks.
+// all memory is allocated in compressed_cache_init
+
+#define COMPRESSED_CACHE_CHUNK 128
+// most pages handed to on_flush in one call
+#define COMPRESSED_CACHE_FLUSH_PAGES 4
+
+struct _compressed_cache_t;
+typedef struct _compressed_cache_t compressed_cache_t;
+
+/* on_evict receives a dirty page pushed out of a full arena,
+   on_flush writes number_of_pages consecutive pages starting at page_number */
+compressed_cache_t *compressed_cache_init(size_t page_size, size_t arena_size, eviction_policy_type_t policy,
+                                          void (*on_evict)(size_t page_number, void *buf, void *context),
+                                          void (*on_flush)(size_t page_number, void *buf, size_t number_of_pages, void *context),
+                                          void *context);
+
+bool compressed_cache_get(compressed_cache_t *cache, size_t page_number, void *buf);
+
+/* stores a dirty page, returns false and drops any older copy when the page
+   does not compress to three quarters of its size, the caller keeps it elsewhere */
+bool compressed_cache_set(compressed_cache_t *cache, size_t page_number, const void *buf);
+
+/* does not count as an access */
+bool compressed_cache_contains(compressed_cache_t *cache, size_t page_number);
+
+/* writes every dirty page through on_flush in ascending page order, the pages stay cached */
+void compressed_cache_flush(compressed_cache_t *cache);
+
+/* number of cached pages, their compressed bytes and the arena bytes they take */
+void compressed_cache_get_stats(compressed_cache_t *cache, size_t *pages, size_t *compressed_bytes, size_t *arena_bytes);
+
+void compressed_cache_free(compressed_cache_t *cache);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,186 @@
+#include "lz.h"
+
+#include <string.h>
+#include <assert.h>
+
+#define MIN_MATCH 4
+#define LAST_LITERALS 5  // the block always ends with literals
+#define MATCH_LIMIT 12   // no match starts in the last bytes
+#define MAX_OFFSET 65535
+
+static inline uint32_t read32(const uint8_t *p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint32_t hash32(uint32_t value)
+{
+    return (value * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static inline uint8_t *write_length(uint8_t *op, size_t length)
+{
+    while (length >= 255)
+    {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (uint8_t)length;
+    return op;
+}
+
+// one sequence is a token, the literals and, except for the last one, a match
+static bool write_sequence(uint8_t **pop, uint8_t *end, const uint8_t *literals, size_t literal_length, size_t offset, size_t match_length)
+{
+    uint8_t *op = *pop;
+    size_t needed = 1 + literal_length / 255 + 1 + literal_length + (match_length ? 2 + match_length / 255 + 1 : 0);
+    if ((size_t)(end - op) < needed)
+    {
+        return false;
+    }
+
+    uint8_t *token = op++;
+    *token = (uint8_t)((literal_length >= 15 ? 15 : literal_length) << 4);
+    if (literal_length >= 15)
+    {
+        op = write_length(op, literal_length - 15);
+    }
+    memcpy(op, literals, literal_length);
+    op += literal_length;
+
+    if (match_length)
+    {
+        *op++ = offset & 0xff;
+        *op++ = offset >> 8;
+        size_t length = match_length - MIN_MATCH;
+        *token |= length >= 15 ? 15 : length;
+        if (length >= 15)
+        {
+            op = write_length(op, length - 15);
+        }
+    }
+    *pop = op;
+    return true;
+}
+
+size_t lz_compress(const uint8_t *src, size_t src_length, uint8_t *dst, size_t dst_capacity, uint16_t *hash_table)
+{
+    assert(src_length <= LZ_MAX_INPUT);
+    uint8_t *op = dst;
+    uint8_t *end = dst + dst_capacity;
+    size_t anchor = 0;
+
+    if (src_length > MATCH_LIMIT)
+    {
+        memset(hash_table, 0, sizeof(uint16_t) * LZ_HASH_SIZE);
+        const size_t match_start_limit = src_length - MATCH_LIMIT;
+        const size_t match_end_limit = src_length - LAST_LITERALS;
+        size_t ip = 0;
+        while (ip < match_start_limit)
+        {
+            uint32_t sequence = read32(src + ip);
+            uint32_t hash = hash32(sequence);
+            size_t reference = hash_table[hash];
+            hash_table[hash] = (uint16_t)ip;
+            if (reference >= ip || ip - reference > MAX_OFFSET || read32(src + reference) != sequence)
+            {
+                // incompressible data is skipped faster the longer it gets
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+
+            size_t match_length = MIN_MATCH;
+            while (ip + match_length < match_end_limit && src[ip + match_length] == src[reference + match_length])
+            {
+                match_length++;
+            }
+            if (!write_sequence(&op, end, src + anchor, ip - anchor, ip - reference, match_length))
+            {
+                return 0;
+            }
+            ip += match_length;
+            anchor = ip;
+        }
+    }
+
+    if (!write_sequence(&op, end, src + anchor, src_length - anchor, 0, 0))
+    {
+        return 0;
+    }
+    return op - dst;
+}
+
+static inline bool read_length(const uint8_t *src, size_t src_length, size_t *ip, size_t *length)
+{
+    uint8_t byte;
+    do
+    {
+        if (*ip >= src_length)
+        {
+            return false;
+        }
+        byte = src[(*ip)++];
+        *length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+bool lz_decompress(const uint8_t *src, size_t src_length, uint8_t *dst, size_t dst_length)
+{
+    size_t ip = 0;
+    size_t op = 0;
+    while (ip < src_length)
+    {
+        uint8_t token = src[ip++];
+
+        size_t literal_length = token >> 4;
+        if (literal_length == 15 && !read_length(src, src_length, &ip, &literal_length))
+        {
+            return false;
+        }
+        if (literal_length > src_length - ip || literal_length > dst_length - op)
+        {
+            return false;
+        }
+        memcpy(dst + op, src + ip, literal_length);
+        ip += literal_length;
+        op += literal_length;
+        if (ip == src_length)
+        {
+            break;
+        }
+
+        if (src_length - ip < 2)
+        {
+            return false;
+        }
+        size_t offset = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        size_t match_length = token & 15;
+        if (match_length == 15 && !read_length(src, src_length, &ip, &match_length))
+        {
+            return false;
+        }
+        match_length += MIN_MATCH;
+        if (offset == 0 || offset > op || match_length > dst_length - op)
+        {
+            return false;
+        }
+        if (offset >= match_length)
+        {
+            memcpy(dst + op, dst + op - offset, match_length);
+            op += match_length;
+        }
+        else
+        {
+            // overlapping copy repeats the last offset bytes
+            for (size_t i = 0; i < match_length; i++, op++)
+            {
+                dst[op] = dst[op - offset];
+            }
+        }
+    }
+    return op == dst_length;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// LZ4 block format compressor for buffers up to 64KB, greedy single probe matching
+
+#define LZ_HASH_BITS 12
+#define LZ_HASH_SIZE (1 << LZ_HASH_BITS)
+#define LZ_MAX_INPUT 65536
+
+/* returns the compressed length, or 0 when it would not fit in dst_capacity,
+   hash_table holds LZ_HASH_SIZE entries and is only used as scratch */
+size_t lz_compress(const uint8_t *src, size_t src_length, uint8_t *dst, size_t dst_capacity, uint16_t *hash_table);
+
+/* returns false when src is malformed or does not decompress to exactly dst_length bytes */
+bool lz_decompress(const uint8_t *src, size_t src_length, uint8_t *dst, size_t dst_length);
+
+#ifdef __cplusplus
+}
+#endif
@@ -2,6 +2,7 @@
 
 #include <stdint.h>
 #include <malloc.h>
+#include <assert.h>
 
 #ifdef ESP32
 #include <esp_heap_caps.h>
@@ -9,7 +10,7 @@
 
 struct cache_line
 {
-    void *value;
+    void *value; // NULL for empty lines
     void *key;
 };
 
@@ -17,50 +18,163 @@ struct _direct_cache_t
 {
     struct cache_line *cache;
     size_t cache_size;
+
+    size_t number_of_sets;
+    size_t ways;
+    size_t ways_log2;
+    // tree pseudo-LRU per set, bit n is node n of the tree, set bits point to the right half
+    uint8_t *plru;
+
+    size_t hits;
+    size_t misses;
 };
 
 direct_cache_t *direct_cache_init(size_t cache_size)
 {
+    return direct_cache_init_ways(cache_size, 1);
+}
+
+direct_cache_t *direct_cache_init_ways(size_t cache_size, size_t ways)
+{
+    assert(ways == 1 || ways == 2 || ways == 4 || ways == 8);
     direct_cache_t *cache = (direct_cache_t *)malloc(sizeof(direct_cache_t));
-    cache->cache_size = cache_size;
+    cache->ways = ways;
+    cache->ways_log2 = 0;
+    while (((size_t)1 << cache->ways_log2) < ways)
+    {
+        cache->ways_log2++;
+    }
+    cache->number_of_sets = cache_size / ways;
+    if (cache->number_of_sets == 0)
+    {
+        cache->number_of_sets = 1;
+    }
+    cache->cache_size = cache->number_of_sets * ways;
+    cache->hits = 0;
+    cache->misses = 0;
 #ifdef ESP32
-    cache->cache = (struct cache_line *)heap_caps_malloc(sizeof(struct cache_line) * cache_size,MALLOC_CAP_INTERNAL );
+    cache->cache = (struct cache_line *)heap_caps_malloc(sizeof(struct cache_line) * cache->cache_size,MALLOC_CAP_INTERNAL );
 #else
-    cache->cache = (struct cache_line *)malloc(sizeof(struct cache_line) * cache_size);
+    cache->cache = (struct cache_line *)malloc(sizeof(struct cache_line) * cache->cache_size);
 #endif
-    for (size_t i = 0; i < cache_size;i++){
-        cache->cache[i].key = i + 1;
+    for (size_t i = 0; i < cache->cache_size;i++){
+        cache->cache[i].key = NULL;
+        cache->cache[i].value = NULL;
     }
+    cache->plru = (ways > 1) ? (uint8_t *)calloc(cache->number_of_sets, sizeof(uint8_t)) : NULL;
     return cache;
 }
 
+static inline struct cache_line *set_of(direct_cache_t *cache, void *key, size_t *set)
+{
+    *set = (uintptr_t)(key) % cache->number_of_sets;
+    return &cache->cache[*set * cache->ways];
+}
+
+// points every node on the path to way at the other half
+static inline void plru_touch(direct_cache_t *cache, size_t set, size_t way)
+{
+    if (cache->plru == NULL)
+    {
+        return;
+    }
+    uint8_t bits = cache->plru[set];
+    size_t node = 1;
+    for (size_t level = cache->ways_log2; level-- > 0;)
+    {
+        size_t right = (way >> level) & 1;
+        if (right)
+        {
+            bits &= ~(1 << node);
+        }
+        else
+        {
+            bits |= (1 << node);
+        }
+        node = node * 2 + right;
+    }
+    cache->plru[set] = bits;
+}
+
+static inline size_t plru_victim(direct_cache_t *cache, size_t set)
+{
+    uint8_t bits = cache->plru[set];
+    size_t node = 1;
+    size_t way = 0;
+    for (size_t level = 0; level < cache->ways_log2; level++)
+    {
+        size_t right = (bits >> node) & 1;
+        way = way * 2 + right;
+        node = node * 2 + right;
+    }
+    return way;
+}
+
 void *direct_cache_get(direct_cache_t *cache, void *key)
 {
-    uint16_t cell = (intptr_t)(key) % cache->cache_size;
-    struct cache_line line = cache->cache[cell];
-    if (line.key == key)
+    size_t set;
+    struct cache_line *lines = set_of(cache, key, &set);
+    for (size_t way = 0; way < cache->ways; way++)
     {
-        return line.value;
+        if (lines[way].key == key && lines[way].value != NULL)
+        {
+            cache->hits++;
+            plru_touch(cache, set, way);
+            return lines[way].value;
+        }
     }
+    cache->misses++;
     return NULL;
 }
 
 void direct_cache_set(direct_cache_t *cache, void *key, void *value)
 {
-    uint16_t cell = (intptr_t)(key) % cache->cache_size;
-    cache->cache[cell].key = key;
-    cache->cache[cell].value = value;
+    size_t set;
+    struct cache_line *lines = set_of(cache, key, &set);
+    size_t target = cache->ways;
+    for (size_t way = 0; way < cache->ways; way++)
+    {
+        if (lines[way].key == key)
+        {
+            target = way;
+            break;
+        }
+        if (lines[way].value == NULL && target == cache->ways)
+        {
+            target = way;
+        }
+    }
+    if (target == cache->ways)
+    {
+        target = (cache->plru != NULL) ? plru_victim(cache, set) : 0;
+    }
+    lines[target].key = key;
+    lines[target].value = value;
+    plru_touch(cache, set, target);
 }
 
 void direct_cache_remove(direct_cache_t *cache, void *key)
 {
-    uint16_t cell = (intptr_t)(key) % cache->cache_size;
-    cache->cache[cell].key = cell + 1;
-    cache->cache[cell].value = NULL;
+    size_t set;
+    struct cache_line *lines = set_of(cache, key, &set);
+    for (size_t way = 0; way < cache->ways; way++)
+    {
+        if (lines[way].key == key)
+        {
+            lines[way].value = NULL;
+        }
+    }
+}
+
+void direct_cache_get_stats(direct_cache_t *cache, size_t *hits, size_t *misses)
+{
+    *hits = cache->hits;
+    *misses = cache->misses;
 }
 
 void direct_cache_free(direct_cache_t *cache)
 {
+    free(cache->plru);
     free(cache->cache);
     free(cache);
-}
\ No newline at end of file
+}
@@ -7,9 +7,15 @@ typedef struct _direct_cache_t direct_cache_t;
 
 direct_cache_t *direct_cache_init(size_t cache_size);
 
+/* set-associative cache of cache_size lines, ways is 1, 2, 4 or 8,
+   each set replaces its pseudo least recently used line */
+direct_cache_t *direct_cache_init_ways(size_t cache_size, size_t ways);
+
 void *direct_cache_get(direct_cache_t *cache, void *key);
 
 void direct_cache_set(direct_cache_t *cache, void *key, void *value);
 void direct_cache_remove(direct_cache_t *cache, void *key);
 
+void direct_cache_get_stats(direct_cache_t *cache, size_t *hits, size_t *misses);
+
 void direct_cache_free(direct_cache_t *cache);
\ No newline at end of file
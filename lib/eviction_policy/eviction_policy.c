@@ -0,0 +1,382 @@
+#include "eviction_policy.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <memory_indexer.h>
+
+#define NIL UINT32_MAX
+
+// lists, LRU only uses T1
+enum
+{
+    LIST_T1,
+    LIST_T2,
+    LIST_B1,
+    LIST_B2,
+    NUMBER_OF_LISTS,
+    LIST_NONE = 0xff,
+};
+
+struct list_head
+{
+    uint32_t head; // most recent
+    uint32_t tail; // least recent
+    size_t size;
+};
+
+struct _eviction_policy_t
+{
+    eviction_policy_type_t type;
+    size_t number_of_slots;
+
+    // nodes [0, number_of_slots) are slots, ARC ghosts use [number_of_slots, 2 * number_of_slots)
+    uint32_t *prev;
+    uint32_t *next;
+    uint8_t *list;
+    size_t *keys;
+    struct list_head lists[NUMBER_OF_LISTS];
+
+    // CLOCK
+    uint8_t *referenced;
+    size_t clock_hand;
+
+    // ARC, arc_p is the target size of T1
+    size_t arc_p;
+    memory_indexer_t *ghosts; // key -> ghost node + 1
+    uint32_t *free_ghosts;
+    size_t number_of_free_ghosts;
+    // key whose ghost was hit while choosing its victim, inserted into T2
+    size_t promoted_key;
+    bool promoted;
+};
+
+static void list_unlink(eviction_policy_t *policy, uint32_t node)
+{
+    struct list_head *list = &policy->lists[policy->list[node]];
+    if (policy->prev[node] != NIL)
+        policy->next[policy->prev[node]] = policy->next[node];
+    else
+        list->head = policy->next[node];
+    if (policy->next[node] != NIL)
+        policy->prev[policy->next[node]] = policy->prev[node];
+    else
+        list->tail = policy->prev[node];
+    list->size--;
+    policy->list[node] = LIST_NONE;
+}
+
+static void list_push_head(eviction_policy_t *policy, uint8_t index, uint32_t node)
+{
+    struct list_head *list = &policy->lists[index];
+    policy->prev[node] = NIL;
+    policy->next[node] = list->head;
+    if (list->head != NIL)
+        policy->prev[list->head] = node;
+    else
+        list->tail = node;
+    list->head = node;
+    list->size++;
+    policy->list[node] = index;
+}
+
+eviction_policy_t *eviction_policy_init(eviction_policy_type_t type, size_t number_of_slots)
+{
+    assert(number_of_slots > 0 && number_of_slots < NIL / 2);
+    eviction_policy_t *policy = (eviction_policy_t *)calloc(1, sizeof(eviction_policy_t));
+    assert(policy);
+    policy->type = type;
+    policy->number_of_slots = number_of_slots;
+
+    size_t number_of_nodes = (type == EVICTION_POLICY_ARC) ? number_of_slots * 2 : number_of_slots;
+    policy->prev = (uint32_t *)malloc(sizeof(uint32_t) * number_of_nodes);
+    policy->next = (uint32_t *)malloc(sizeof(uint32_t) * number_of_nodes);
+    policy->list = (uint8_t *)malloc(number_of_nodes);
+    policy->keys = (size_t *)malloc(sizeof(size_t) * number_of_nodes);
+    assert(policy->prev && policy->next && policy->list && policy->keys);
+    memset(policy->list, LIST_NONE, number_of_nodes);
+    for (size_t i = 0; i < NUMBER_OF_LISTS; i++)
+    {
+        policy->lists[i].head = policy->lists[i].tail = NIL;
+    }
+
+    if (type == EVICTION_POLICY_CLOCK)
+    {
+        policy->referenced = (uint8_t *)calloc(number_of_slots, sizeof(uint8_t));
+        assert(policy->referenced);
+    }
+    else if (type == EVICTION_POLICY_ARC)
+    {
+        policy->ghosts = memory_indexer_init_with_capacity(MEMORY_INDEXER_HASH, number_of_slots);
+        policy->free_ghosts = (uint32_t *)malloc(sizeof(uint32_t) * number_of_slots);
+        assert(policy->free_ghosts);
+        for (size_t i = 0; i < number_of_slots; i++)
+        {
+            policy->free_ghosts[i] = number_of_slots * 2 - 1 - i;
+        }
+        policy->number_of_free_ghosts = number_of_slots;
+    }
+    return policy;
+}
+
+bool eviction_policy_parse(const char *name, eviction_policy_type_t *type)
+{
+    if (strcmp(name, "clock") == 0)
+    {
+        *type = EVICTION_POLICY_CLOCK;
+    }
+    else if (strcmp(name, "lru") == 0)
+    {
+        *type = EVICTION_POLICY_LRU;
+    }
+    else if (strcmp(name, "arc") == 0)
+    {
+        *type = EVICTION_POLICY_ARC;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+eviction_policy_type_t eviction_policy_type(eviction_policy_t *policy)
+{
+    return policy->type;
+}
+
+static void ghost_forget(eviction_policy_t *policy, uint32_t node)
+{
+    list_unlink(policy, node);
+    memory_indexer_remove(policy->ghosts, policy->keys[node]);
+    policy->free_ghosts[policy->number_of_free_ghosts++] = node;
+}
+
+static void ghost_remember(eviction_policy_t *policy, uint8_t index, size_t key, bool ghost_hit)
+{
+    // on a miss T1 + B1 stays within the cache size, the ghosts always stay within the number of ghost nodes
+    if (!ghost_hit && index == LIST_B1 && policy->lists[LIST_T1].size + policy->lists[LIST_B1].size >= policy->number_of_slots && policy->lists[LIST_B1].size > 0)
+    {
+        ghost_forget(policy, policy->lists[LIST_B1].tail);
+    }
+    if (policy->number_of_free_ghosts == 0)
+    {
+        uint8_t longest = policy->lists[LIST_B1].size > policy->lists[LIST_B2].size ? LIST_B1 : LIST_B2;
+        ghost_forget(policy, policy->lists[longest].tail);
+    }
+    uint32_t node = policy->free_ghosts[--policy->number_of_free_ghosts];
+    policy->keys[node] = key;
+    list_push_head(policy, index, node);
+    memory_indexer_set(policy->ghosts, key, (void *)(uintptr_t)(node + 1));
+}
+
+static uint32_t ghost_find(eviction_policy_t *policy, size_t key)
+{
+    uintptr_t node = (uintptr_t)memory_indexer_search(policy->ghosts, key);
+    return node ? (uint32_t)(node - 1) : NIL;
+}
+
+// a ghost hit moves arc_p towards the list that would have kept the key
+static void arc_adapt(eviction_policy_t *policy, uint32_t ghost)
+{
+    size_t b1 = policy->lists[LIST_B1].size;
+    size_t b2 = policy->lists[LIST_B2].size;
+    if (policy->list[ghost] == LIST_B1)
+    {
+        policy->arc_p += (b1 >= b2) ? 1 : b2 / b1;
+        if (policy->arc_p > policy->number_of_slots)
+        {
+            policy->arc_p = policy->number_of_slots;
+        }
+    }
+    else
+    {
+        size_t delta = (b2 >= b1) ? 1 : b1 / b2;
+        policy->arc_p = (policy->arc_p > delta) ? policy->arc_p - delta : 0;
+    }
+}
+
+void eviction_policy_insert(eviction_policy_t *policy, size_t slot, size_t key)
+{
+    assert(slot < policy->number_of_slots);
+    policy->keys[slot] = key;
+    switch (policy->type)
+    {
+    case EVICTION_POLICY_CLOCK:
+        policy->list[slot] = LIST_T1;
+        policy->referenced[slot] = 1;
+        break;
+    case EVICTION_POLICY_LRU:
+        list_push_head(policy, LIST_T1, slot);
+        break;
+    case EVICTION_POLICY_ARC:
+    {
+        bool promote = policy->promoted && policy->promoted_key == key;
+        if (!promote)
+        {
+            // a free slot was used, no victim was chosen for this key
+            uint32_t ghost = ghost_find(policy, key);
+            if (ghost != NIL)
+            {
+                arc_adapt(policy, ghost);
+                ghost_forget(policy, ghost);
+                promote = true;
+            }
+        }
+        list_push_head(policy, promote ? LIST_T2 : LIST_T1, slot);
+        policy->promoted = false;
+        break;
+    }
+    }
+}
+
+void eviction_policy_access(eviction_policy_t *policy, size_t slot)
+{
+    switch (policy->type)
+    {
+    case EVICTION_POLICY_CLOCK:
+        policy->referenced[slot] = 1;
+        break;
+    case EVICTION_POLICY_LRU:
+        if (policy->lists[LIST_T1].head != slot)
+        {
+            list_unlink(policy, slot);
+            list_push_head(policy, LIST_T1, slot);
+        }
+        break;
+    case EVICTION_POLICY_ARC:
+        if (policy->lists[LIST_T2].head != slot)
+        {
+            list_unlink(policy, slot);
+            list_push_head(policy, LIST_T2, slot);
+        }
+        break;
+    }
+}
+
+void eviction_policy_remove(eviction_policy_t *policy, size_t slot)
+{
+    if (policy->list[slot] == LIST_NONE)
+    {
+        return;
+    }
+    if (policy->type == EVICTION_POLICY_CLOCK)
+    {
+        policy->list[slot] = LIST_NONE;
+        policy->referenced[slot] = 0;
+    }
+    else
+    {
+        list_unlink(policy, slot);
+    }
+}
+
+static inline bool can_evict_slot(eviction_policy_can_evict_t can_evict, void *context, size_t slot)
+{
+    return can_evict == NULL || can_evict(context, slot);
+}
+
+static uint32_t list_victim(eviction_policy_t *policy, uint8_t index, eviction_policy_can_evict_t can_evict, void *context)
+{
+    for (uint32_t node = policy->lists[index].tail; node != NIL; node = policy->prev[node])
+    {
+        if (can_evict_slot(can_evict, context, node))
+        {
+            return node;
+        }
+    }
+    return NIL;
+}
+
+static size_t clock_victim(eviction_policy_t *policy, eviction_policy_can_evict_t can_evict, void *context)
+{
+    // every slot gets at most two passes, one to clear its referenced bit and one to be picked
+    for (size_t i = 0; i < policy->number_of_slots * 2; i++)
+    {
+        size_t slot = policy->clock_hand;
+        policy->clock_hand = (policy->clock_hand + 1) % policy->number_of_slots;
+        if (policy->list[slot] == LIST_NONE || !can_evict_slot(can_evict, context, slot))
+        {
+            continue;
+        }
+        if (policy->referenced[slot])
+        {
+            policy->referenced[slot] = 0;
+            continue;
+        }
+        policy->list[slot] = LIST_NONE;
+        return slot;
+    }
+    return EVICTION_POLICY_NONE;
+}
+
+static size_t arc_victim(eviction_policy_t *policy, size_t key, eviction_policy_can_evict_t can_evict, void *context)
+{
+    uint32_t ghost = ghost_find(policy, key);
+    bool in_b2 = ghost != NIL && policy->list[ghost] == LIST_B2;
+    if (ghost != NIL)
+    {
+        arc_adapt(policy, ghost);
+        ghost_forget(policy, ghost);
+        policy->promoted = true;
+        policy->promoted_key = key;
+    }
+
+    size_t t1 = policy->lists[LIST_T1].size;
+    bool from_t1 = t1 > 0 && (t1 > policy->arc_p || (in_b2 && t1 == policy->arc_p));
+
+    uint8_t first = from_t1 ? LIST_T1 : LIST_T2;
+    uint8_t second = from_t1 ? LIST_T2 : LIST_T1;
+    uint32_t victim = list_victim(policy, first, can_evict, context);
+    if (victim == NIL)
+    {
+        victim = list_victim(policy, second, can_evict, context);
+    }
+    if (victim == NIL)
+    {
+        return EVICTION_POLICY_NONE;
+    }
+
+    uint8_t index = policy->list[victim];
+    list_unlink(policy, victim);
+    ghost_remember(policy, index == LIST_T1 ? LIST_B1 : LIST_B2, policy->keys[victim], ghost != NIL);
+    return victim;
+}
+
+size_t eviction_policy_victim(eviction_policy_t *policy, size_t key, eviction_policy_can_evict_t can_evict, void *context)
+{
+    switch (policy->type)
+    {
+    case EVICTION_POLICY_LRU:
+    {
+        uint32_t victim = list_victim(policy, LIST_T1, can_evict, context);
+        if (victim == NIL)
+        {
+            return EVICTION_POLICY_NONE;
+        }
+        list_unlink(policy, victim);
+        return victim;
+    }
+    case EVICTION_POLICY_ARC:
+        return arc_victim(policy, key, can_evict, context);
+    default:
+        return clock_victim(policy, can_evict, context);
+    }
+}
+
+void eviction_policy_free(eviction_policy_t *policy)
+{
+    if (policy->ghosts != NULL)
+    {
+        memory_indexer_free(policy->ghosts);
+    }
+    free(policy->free_ghosts);
+    free(policy->referenced);
+    free(policy->prev);
+    free(policy->next);
+    free(policy->list);
+    free(policy->keys);
+    free(policy);
+}
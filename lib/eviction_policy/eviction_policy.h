@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// replacement policy over a fixed number of slots (page frames, himem blocks),
+// the owner keeps the data and the key to slot index, the policy only decides which slot to reuse.
+// all state is allocated in eviction_policy_init
+
+typedef enum eviction_policy_type_t
+{
+    EVICTION_POLICY_CLOCK, // second chance, one referenced bit per slot
+    EVICTION_POLICY_LRU,   // exact least recently used
+    EVICTION_POLICY_ARC,   // adaptive replacement cache, scan resistant
+} eviction_policy_type_t;
+
+#define EVICTION_POLICY_NONE ((size_t)-1)
+
+struct _eviction_policy_t;
+typedef struct _eviction_policy_t eviction_policy_t;
+
+/* returns false when the slot must not be evicted, e.g. pinned */
+typedef bool (*eviction_policy_can_evict_t)(void *context, size_t slot);
+
+eviction_policy_t *eviction_policy_init(eviction_policy_type_t type, size_t number_of_slots);
+
+/* parses "clock", "lru" or "arc", returns false for unknown names */
+bool eviction_policy_parse(const char *name, eviction_policy_type_t *type);
+
+eviction_policy_type_t eviction_policy_type(eviction_policy_t *policy);
+
+/* slot was filled with key */
+void eviction_policy_insert(eviction_policy_t *policy, size_t slot, size_t key);
+
+/* slot was accessed */
+void eviction_policy_access(eviction_policy_t *policy, size_t slot);
+
+/* slot was emptied without being chosen as a victim, does nothing for untracked slots */
+void eviction_policy_remove(eviction_policy_t *policy, size_t slot);
+
+/* chooses a tracked slot to make room for key and stops tracking it,
+   can_evict may be NULL, returns EVICTION_POLICY_NONE when no slot can be evicted */
+size_t eviction_policy_victim(eviction_policy_t *policy, size_t key, eviction_policy_can_evict_t can_evict, void *context);
+
+void eviction_policy_free(eviction_policy_t *policy);
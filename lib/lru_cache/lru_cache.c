@@ -24,10 +24,15 @@ struct _cache_t
 };
 
 cache_t *lru_cache_init(int (*compare_key)(const void *, const void *), void (*on_flush)(void *key, void *value, void *context), void *context)
+{
+    return lru_cache_init_with_indexer(compare_key, on_flush, context, MEMORY_INDEXER_AVL, 0);
+}
+
+cache_t *lru_cache_init_with_indexer(int (*compare_key)(const void *, const void *), void (*on_flush)(void *key, void *value, void *context), void *context, memory_indexer_type_t indexer_type, size_t capacity)
 {
     cache_t *cache = (cache_t *)malloc(sizeof(cache_t));
     cache->cache_item_list = list_new();
-    cache->memory_indexer = memory_indexer_init();
+    cache->memory_indexer = memory_indexer_init_with_capacity(indexer_type, capacity);
     cache->on_flush = on_flush;
     cache->number_of_items = 0;
     cache->context = context;
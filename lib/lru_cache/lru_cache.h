@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stddef.h>
+#include <memory_indexer.h>
 
 #define LRU_MARKING 100
 
@@ -8,6 +9,8 @@ struct _cache_t;
 typedef struct _cache_t cache_t;
 
 cache_t * lru_cache_init(int (*compare_key)(const void *, const void *), void (*on_flush)(void *key, void *value, void * context), void * context);
+/* keys are looked up through a memory indexer of the given type, see memory_indexer_init_with_capacity */
+cache_t * lru_cache_init_with_indexer(int (*compare_key)(const void *, const void *), void (*on_flush)(void *key, void *value, void * context), void * context, memory_indexer_type_t indexer_type, size_t capacity);
 
 size_t lru_cache_count(cache_t * cache);
 
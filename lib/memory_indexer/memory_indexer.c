@@ -2,10 +2,27 @@
 
 #include <avltree.h>
 #include <string.h>
+#include <stdlib.h>
+
+struct hash_slot
+{
+    size_t key;
+    void *value; // NULL for empty slots
+};
 
 struct _memory_indexer_t
 {
+    memory_indexer_type_t type;
     struct avl_tree avl_tree;
+
+    // MEMORY_INDEXER_DIRECT, value of key is table[key]
+    void **table;
+    size_t table_size;
+
+    // MEMORY_INDEXER_HASH, linear probing, size is a power of 2
+    struct hash_slot *slots;
+    size_t slots_bits;
+    size_t count;
 };
 
 struct memory_wrapper
@@ -29,15 +46,7 @@ static int cmp_func(struct avl_node *a, struct avl_node *b, void *aux)
         return 0;
 }
 
-memory_indexer_t *memory_indexer_init()
-{
-    memory_indexer_t *indexer = (memory_indexer_t *)malloc(sizeof(memory_indexer_t));
-    memset(indexer, 0, sizeof(memory_indexer_t));
-    avl_init(&indexer->avl_tree, NULL);
-
-    return indexer;
-}
-void memory_indexer_set(memory_indexer_t *indexer, size_t key, void *value)
+static void avl_indexer_set(memory_indexer_t *indexer, size_t key, void *value)
 {
     memory_indexer_remove(indexer, key);
 
@@ -48,12 +57,13 @@ void memory_indexer_set(memory_indexer_t *indexer, size_t key, void *value)
     if (avl_insert(&indexer->avl_tree, &memory_item->avl, cmp_func) == &memory_item->avl)
     {
         // printf("added successfully %d\n", key);
-        return; 
+        return;
     }
     // printf("duplicate %d\n", key);
 
 }
-void *memory_indexer_search(memory_indexer_t *indexer, size_t key)
+
+static void *avl_indexer_search(memory_indexer_t *indexer, size_t key)
 {
     struct memory_wrapper query = {};
     query.key = key;
@@ -65,7 +75,8 @@ void *memory_indexer_search(memory_indexer_t *indexer, size_t key)
     }
     return NULL;
 }
-void memory_indexer_remove(memory_indexer_t *indexer, size_t key)
+
+static void avl_indexer_remove(memory_indexer_t *indexer, size_t key)
 {
     struct memory_wrapper query;
     query.key = key;
@@ -76,10 +87,9 @@ void memory_indexer_remove(memory_indexer_t *indexer, size_t key)
         avl_remove(&indexer->avl_tree, avl_node);
         free(wrapper);
     }
-    return NULL;
 }
 
-size_t memory_indexer_free(memory_indexer_t *indexer)
+static size_t avl_indexer_free(memory_indexer_t *indexer)
 {
     size_t x = 0;
     struct avl_node_t *avl_node = avl_first(&indexer->avl_tree);
@@ -88,7 +98,219 @@ size_t memory_indexer_free(memory_indexer_t *indexer)
         struct memory_wrapper *node = _get_entry(avl_node, struct memory_wrapper, avl);
         avl_node = avl_next(avl_node);
         avl_remove(&indexer->avl_tree, &node->avl);
+        free(node);
         x++;
     }
     return x;
-}
\ No newline at end of file
+}
+
+static void direct_indexer_grow(memory_indexer_t *indexer, size_t key)
+{
+    size_t table_size = indexer->table_size ? indexer->table_size : 1;
+    while (table_size <= key)
+    {
+        table_size *= 2;
+    }
+    indexer->table = (void **)realloc(indexer->table, sizeof(void *) * table_size);
+    memset(indexer->table + indexer->table_size, 0, sizeof(void *) * (table_size - indexer->table_size));
+    indexer->table_size = table_size;
+}
+
+static inline size_t hash_slot_of(memory_indexer_t *indexer, size_t key)
+{
+    // fibonacci hashing, spreads dense page numbers across the table
+    return (uint32_t)(key * 2654435769u) >> (32 - indexer->slots_bits);
+}
+
+static void hash_indexer_set(memory_indexer_t *indexer, size_t key, void *value);
+
+static void hash_indexer_resize(memory_indexer_t *indexer, size_t slots_bits)
+{
+    struct hash_slot *old_slots = indexer->slots;
+    size_t old_size = indexer->slots ? ((size_t)1 << indexer->slots_bits) : 0;
+
+    indexer->slots_bits = slots_bits;
+    indexer->slots = (struct hash_slot *)calloc((size_t)1 << slots_bits, sizeof(struct hash_slot));
+    indexer->count = 0;
+    for (size_t i = 0; i < old_size; i++)
+    {
+        if (old_slots[i].value != NULL)
+        {
+            hash_indexer_set(indexer, old_slots[i].key, old_slots[i].value);
+        }
+    }
+    free(old_slots);
+}
+
+static struct hash_slot *hash_indexer_find(memory_indexer_t *indexer, size_t key)
+{
+    const size_t mask = ((size_t)1 << indexer->slots_bits) - 1;
+    for (size_t i = hash_slot_of(indexer, key);; i = (i + 1) & mask)
+    {
+        struct hash_slot *slot = &indexer->slots[i];
+        if (slot->value == NULL || slot->key == key)
+        {
+            return slot;
+        }
+    }
+}
+
+static void hash_indexer_set(memory_indexer_t *indexer, size_t key, void *value)
+{
+    // keep the load factor under 3/4 so probe sequences stay short
+    if ((indexer->count + 1) * 4 > ((size_t)3 << indexer->slots_bits))
+    {
+        hash_indexer_resize(indexer, indexer->slots_bits + 1);
+    }
+    struct hash_slot *slot = hash_indexer_find(indexer, key);
+    if (slot->value == NULL)
+    {
+        indexer->count++;
+    }
+    slot->key = key;
+    slot->value = value;
+}
+
+static void hash_indexer_remove(memory_indexer_t *indexer, size_t key)
+{
+    const size_t mask = ((size_t)1 << indexer->slots_bits) - 1;
+    struct hash_slot *slot = hash_indexer_find(indexer, key);
+    if (slot->value == NULL)
+    {
+        return;
+    }
+    indexer->count--;
+
+    // backward shift deletion, no tombstones
+    size_t hole = slot - indexer->slots;
+    for (size_t i = (hole + 1) & mask; indexer->slots[i].value != NULL; i = (i + 1) & mask)
+    {
+        size_t home = hash_slot_of(indexer, indexer->slots[i].key);
+        if (((i - home) & mask) >= ((i - hole) & mask))
+        {
+            indexer->slots[hole] = indexer->slots[i];
+            hole = i;
+        }
+    }
+    indexer->slots[hole].value = NULL;
+}
+
+memory_indexer_t *memory_indexer_init()
+{
+    return memory_indexer_init_with_capacity(MEMORY_INDEXER_AVL, 0);
+}
+
+memory_indexer_t *memory_indexer_init_with_capacity(memory_indexer_type_t type, size_t capacity)
+{
+    memory_indexer_t *indexer = (memory_indexer_t *)malloc(sizeof(memory_indexer_t));
+    memset(indexer, 0, sizeof(memory_indexer_t));
+    indexer->type = type;
+
+    switch (type)
+    {
+    case MEMORY_INDEXER_DIRECT:
+        direct_indexer_grow(indexer, capacity ? capacity - 1 : 0);
+        break;
+    case MEMORY_INDEXER_HASH:
+    {
+        size_t slots_bits = 4;
+        while (((size_t)3 << slots_bits) < capacity * 4)
+        {
+            slots_bits++;
+        }
+        hash_indexer_resize(indexer, slots_bits);
+        break;
+    }
+    default:
+        avl_init(&indexer->avl_tree, NULL);
+        break;
+    }
+
+    return indexer;
+}
+
+void memory_indexer_set(memory_indexer_t *indexer, size_t key, void *value)
+{
+    switch (indexer->type)
+    {
+    case MEMORY_INDEXER_DIRECT:
+        if (key >= indexer->table_size)
+        {
+            direct_indexer_grow(indexer, key);
+        }
+        indexer->table[key] = value;
+        break;
+    case MEMORY_INDEXER_HASH:
+        if (value == NULL)
+        {
+            hash_indexer_remove(indexer, key);
+        }
+        else
+        {
+            hash_indexer_set(indexer, key, value);
+        }
+        break;
+    default:
+        avl_indexer_set(indexer, key, value);
+        break;
+    }
+}
+
+void *memory_indexer_search(memory_indexer_t *indexer, size_t key)
+{
+    switch (indexer->type)
+    {
+    case MEMORY_INDEXER_DIRECT:
+        return (key < indexer->table_size) ? indexer->table[key] : NULL;
+    case MEMORY_INDEXER_HASH:
+        return hash_indexer_find(indexer, key)->value;
+    default:
+        return avl_indexer_search(indexer, key);
+    }
+}
+
+void memory_indexer_remove(memory_indexer_t *indexer, size_t key)
+{
+    switch (indexer->type)
+    {
+    case MEMORY_INDEXER_DIRECT:
+        if (key < indexer->table_size)
+        {
+            indexer->table[key] = NULL;
+        }
+        break;
+    case MEMORY_INDEXER_HASH:
+        hash_indexer_remove(indexer, key);
+        break;
+    default:
+        avl_indexer_remove(indexer, key);
+        break;
+    }
+}
+
+size_t memory_indexer_free(memory_indexer_t *indexer)
+{
+    size_t x = 0;
+    switch (indexer->type)
+    {
+    case MEMORY_INDEXER_DIRECT:
+        for (size_t i = 0; i < indexer->table_size; i++)
+        {
+            if (indexer->table[i] != NULL)
+            {
+                x++;
+            }
+        }
+        free(indexer->table);
+        break;
+    case MEMORY_INDEXER_HASH:
+        x = indexer->count;
+        free(indexer->slots);
+        break;
+    default:
+        x = avl_indexer_free(indexer);
+        break;
+    }
+    free(indexer);
+    return x;
+}
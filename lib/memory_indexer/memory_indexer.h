@@ -6,7 +6,16 @@
 struct _memory_indexer_t;
 typedef struct _memory_indexer_t memory_indexer_t;
 
+typedef enum memory_indexer_type_t
+{
+    MEMORY_INDEXER_AVL,    // avl-tree, O(log n), any key range
+    MEMORY_INDEXER_DIRECT, // flat table indexed by key, O(1), for small dense keys such as page numbers
+    MEMORY_INDEXER_HASH,   // open addressing hash, O(1), memory bound by the number of entries
+} memory_indexer_type_t;
+
 memory_indexer_t * memory_indexer_init();
+/* capacity is the expected key range (direct) or number of entries (hash), tables grow when exceeded */
+memory_indexer_t * memory_indexer_init_with_capacity(memory_indexer_type_t type, size_t capacity);
 void memory_indexer_set(memory_indexer_t *indexer, size_t key, void * value);
 void * memory_indexer_search(memory_indexer_t *indexer, size_t key);
 void memory_indexer_remove(memory_indexer_t *indexer, size_t key);
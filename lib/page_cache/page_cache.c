@@ -1,4 +1,3 @@
-
 // should initialize himem to blocks of page_size
 // should use splay-tree and direct-cache to store page indexes
 // should evict unused pages
@@ -6,15 +5,26 @@
 #include "page_cache.h"
 
 #include <himem_allocator.h>
-#include <lru_cache.h>
+#include <memory_indexer.h>
 #include <direct_cache.h>
 
 #include <malloc.h>
 #include <stdio.h>
+#include <stdlib.h>
+
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+
+struct page_cache_item_t
+{
+    size_t page_number;
+    size_t block_id;
+    bool dirty; // newer than the backing store
+};
 
 struct _page_cache_t
 {
-    cache_t *lru_cache;
+    memory_indexer_t *index;
+    eviction_policy_t *policy;
     direct_cache_t * direct_cache;
     size_t page_size;
 
@@ -22,37 +32,87 @@ struct _page_cache_t
     // size_t himem_available_blocks;
     size_t himem_last_allocated_block;
     himem_t * himem;
-    void * flush_buffer;
+    struct page_cache_item_t *items; // one per himem block, indexed by block_id
+    size_t *free_blocks; // blocks released by a batch eviction
+    size_t number_of_free_blocks;
+    size_t evict_batch;
+    struct page_cache_item_t **flush_order; // one per himem block, sorted before flushing
+    void * flush_buffer; // PAGE_CACHE_BATCH pages
     void * flush_context;
-    void (*on_flush)(size_t page_number, void * buf, void* flush_context)
+    void (*on_flush)(size_t page_number, void * buf, size_t number_of_pages, void* flush_context)
 };
 
-struct page_cache_item_t
+static int compare_page_number(const void *a, const void *b)
 {
-    size_t page_number;
-    size_t block_id;
-};
+    const struct page_cache_item_t *item_a = *(struct page_cache_item_t *const *)a;
+    const struct page_cache_item_t *item_b = *(struct page_cache_item_t *const *)b;
+    return (item_a->page_number > item_b->page_number) - (item_a->page_number < item_b->page_number);
+}
 
-static int compare_page_number(const void *e1, const void *e2)
+// writes the dirty items in page order, adjacent pages are gathered into one on_flush call
+static void flush_items(page_cache_t *page_cache, struct page_cache_item_t **items, size_t count)
 {
-    return (intptr_t)e1 - (intptr_t)e2;
+    qsort(items, count, sizeof(struct page_cache_item_t *), compare_page_number);
+
+    size_t first_page = 0;
+    size_t number_of_pages = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        struct page_cache_item_t *page_item = items[i];
+        if (!page_item->dirty)
+        {
+            continue;
+        }
+        if (number_of_pages > 0 && (page_item->page_number != first_page + number_of_pages || number_of_pages == PAGE_CACHE_BATCH))
+        {
+            page_cache->on_flush(first_page, page_cache->flush_buffer, number_of_pages, page_cache->flush_context);
+            number_of_pages = 0;
+        }
+        if (number_of_pages == 0)
+        {
+            first_page = page_item->page_number;
+        }
+        himem_read(page_cache->himem, page_item->block_id, (uint8_t *)page_cache->flush_buffer + number_of_pages * page_cache->page_size, page_cache->page_size);
+        page_item->dirty = false;
+        number_of_pages++;
+    }
+    if (number_of_pages > 0)
+    {
+        page_cache->on_flush(first_page, page_cache->flush_buffer, number_of_pages, page_cache->flush_context);
+    }
 }
 
-static void on_page_flush(void *key, void *value, void *context)
+// releases a batch of blocks chosen by the policy, their write-backs are merged
+static void evict_batch(page_cache_t *page_cache, size_t page_number)
 {
-    page_cache_t *page_cache =context;
-    struct page_cache_item_t *page_item = value;
-    himem_read(page_cache->himem, page_item->block_id, page_cache->flush_buffer, page_cache->page_size);
-    page_cache->on_flush(key,page_cache->flush_buffer, page_cache->flush_context);
+    size_t count = 0;
+    while (count < page_cache->evict_batch)
+    {
+        size_t block_id = eviction_policy_victim(page_cache->policy, page_number, NULL, NULL);
+        if (block_id == EVICTION_POLICY_NONE)
+        {
+            break;
+        }
+        page_cache->flush_order[count++] = &page_cache->items[block_id];
+    }
+
+    flush_items(page_cache, page_cache->flush_order, count);
+    for (size_t i = 0; i < count; i++)
+    {
+        struct page_cache_item_t *page_item = page_cache->flush_order[i];
+        memory_indexer_remove(page_cache->index, page_item->page_number);
+        direct_cache_remove(page_cache->direct_cache, page_item->page_number);
+        page_cache->free_blocks[page_cache->number_of_free_blocks++] = page_item->block_id;
+    }
 }
 
-page_cache_t *page_cache_init(size_t page_size, size_t maximum_himem_blocks, void (*on_flush)(size_t page_number, void * buf,void * flush_context), void* flush_context)
+page_cache_t *page_cache_init(size_t page_size, size_t maximum_himem_blocks, eviction_policy_type_t policy, void (*on_flush)(size_t page_number, void * buf, size_t number_of_pages, void * flush_context), void* flush_context)
 {
     page_cache_t *page_cache = (page_cache_t *)malloc(sizeof(page_cache_t));
     page_cache->flush_context = flush_context;
     page_cache->on_flush = on_flush;
     page_cache->page_size = page_size;
-    page_cache->flush_buffer = malloc(page_size);
+    page_cache->flush_buffer = malloc(page_size * PAGE_CACHE_BATCH);
 
     page_cache->himem_maximum_blocks = maximum_himem_blocks;
 
@@ -60,20 +120,40 @@ page_cache_t *page_cache_init(size_t page_size, size_t maximum_himem_blocks, voi
     //page_cache->himem_available_blocks = 
     page_cache->himem = himem_allocator_init(page_size, page_cache->himem_maximum_blocks);
     page_cache->himem_last_allocated_block = 0;
+    page_cache->items = (struct page_cache_item_t *)malloc(sizeof(struct page_cache_item_t) * maximum_himem_blocks);
+    page_cache->free_blocks = (size_t *)malloc(sizeof(size_t) * maximum_himem_blocks);
+    page_cache->number_of_free_blocks = 0;
+    page_cache->flush_order = (struct page_cache_item_t **)malloc(sizeof(struct page_cache_item_t *) * maximum_himem_blocks);
+    page_cache->evict_batch = MIN(PAGE_CACHE_BATCH, maximum_himem_blocks / 4);
+    if (page_cache->evict_batch == 0)
+    {
+        page_cache->evict_batch = 1;
+    }
 
-    page_cache->lru_cache = lru_cache_init(compare_page_number, on_page_flush, page_cache);
-    page_cache->direct_cache = direct_cache_init(2048);
+    // at most one entry per himem block
+    page_cache->index = memory_indexer_init_with_capacity(MEMORY_INDEXER_HASH, maximum_himem_blocks);
+    page_cache->policy = eviction_policy_init(policy, maximum_himem_blocks);
+    page_cache->direct_cache = direct_cache_init_ways(2048, 4);
 
     return page_cache;
 }
 
-bool page_cache_get(page_cache_t *page_cache, size_t page_number, void *buff)
+static struct page_cache_item_t *find_item(page_cache_t *page_cache, size_t page_number)
 {
-    // printf("getting page %d\n", page_number);
     struct page_cache_item_t *page_item = direct_cache_get(page_cache->direct_cache, page_number);
     if (page_item == NULL){
-        page_item = lru_cache_get(page_cache->lru_cache, page_number);
+        page_item = memory_indexer_search(page_cache->index, page_number);
+    }
+    if (page_item != NULL){
+        eviction_policy_access(page_cache->policy, page_item->block_id);
     }
+    return page_item;
+}
+
+bool page_cache_get(page_cache_t *page_cache, size_t page_number, void *buff)
+{
+    // printf("getting page %d\n", page_number);
+    struct page_cache_item_t *page_item = find_item(page_cache, page_number);
     if (page_item != NULL)
     {
         size_t block_id = page_item->block_id;
@@ -88,43 +168,72 @@ bool page_cache_get(page_cache_t *page_cache, size_t page_number, void *buff)
 void page_cache_set(page_cache_t *page_cache, size_t page_number, void *buff)
 {
     // printf("setting page %d\n", page_number);
-    struct page_cache_item_t *page_item = direct_cache_get(page_cache->direct_cache, page_number);
-    if (page_item == NULL){
-        page_item = lru_cache_get(page_cache->lru_cache, page_number);
-    }
+    struct page_cache_item_t *page_item = find_item(page_cache, page_number);
 
     if (page_item != NULL)
     {
         size_t block_id = page_item->block_id;
         // printf("on block %d \n", block_id);
         himem_write(page_cache->himem,block_id, buff, page_cache->page_size);
+        page_item->dirty = true;
     }
     else
     {
         size_t block_id;
         if (page_cache->himem_last_allocated_block < page_cache->himem_maximum_blocks)
         {
-            page_item = (struct page_cache_item_t *)malloc(sizeof(struct page_cache_item_t));
             block_id = page_cache->himem_last_allocated_block++;
-            page_item->page_number = page_number;
-            page_item->block_id = block_id;
             // printf("on new block %d \n", block_id);
         }
         else
         {
-            page_item = lru_cache_get_least_recently_used(page_cache->lru_cache);
-            lru_cache_remove(page_cache->lru_cache, page_item->page_number);
-            direct_cache_remove(page_cache->direct_cache, page_item->page_number);
-
-            block_id = page_item->block_id;
-            page_item->page_number = page_number;
-
+            if (page_cache->number_of_free_blocks == 0)
+            {
+                evict_batch(page_cache, page_number);
+            }
+            block_id = page_cache->free_blocks[--page_cache->number_of_free_blocks];
             // printf("on reused block %d \n", block_id);
         }
+        page_item = &page_cache->items[block_id];
+        page_item->page_number = page_number;
+        page_item->block_id = block_id;
+        page_item->dirty = true;
 
         // printf("writing block %d for page %d\n", (int)block_id, (int)page_number);
         himem_write(page_cache->himem,block_id, buff, page_cache->page_size);
-        lru_cache_add(page_cache->lru_cache, page_number, page_item);
+        memory_indexer_set(page_cache->index, page_number, page_item);
         direct_cache_set(page_cache->direct_cache,page_number, page_item);
+        eviction_policy_insert(page_cache->policy, block_id, page_number);
+    }
+}
+
+bool page_cache_contains(page_cache_t *page_cache, size_t page_number)
+{
+    return memory_indexer_search(page_cache->index, page_number) != NULL;
+}
+
+void page_cache_flush(page_cache_t *page_cache)
+{
+    size_t count = 0;
+    for (size_t block_id = 0; block_id < page_cache->himem_last_allocated_block; block_id++)
+    {
+        if (page_cache->items[block_id].dirty)
+        {
+            page_cache->flush_order[count++] = &page_cache->items[block_id];
+        }
     }
+    flush_items(page_cache, page_cache->flush_order, count);
+}
+
+void page_cache_free(page_cache_t *page_cache)
+{
+    memory_indexer_free(page_cache->index);
+    eviction_policy_free(page_cache->policy);
+    direct_cache_free(page_cache->direct_cache);
+    himem_allocator_deinit(page_cache->himem);
+    free(page_cache->items);
+    free(page_cache->free_blocks);
+    free(page_cache->flush_order);
+    free(page_cache->flush_buffer);
+    free(page_cache);
 }
@@ -5,13 +5,27 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <eviction_policy.h>
+
+// blocks evicted together when the cache is full, at most a quarter of the cache,
+// and the most pages handed to on_flush in one call
+#define PAGE_CACHE_BATCH 4
 
 struct _page_cache_t;
 typedef struct _page_cache_t page_cache_t;
 
-
-page_cache_t *page_cache_init(size_t page_size, size_t maximum_himem_blocks, void (*on_flush)(size_t page_number, void * buf,void * flush_context), void* flush_context);
+/* on_flush writes number_of_pages consecutive pages starting at page_number,
+   dirty blocks are always flushed in ascending page order with adjacent pages merged */
+page_cache_t *page_cache_init(size_t page_size, size_t maximum_himem_blocks, eviction_policy_type_t policy, void (*on_flush)(size_t page_number, void * buf, size_t number_of_pages, void * flush_context), void* flush_context);
 
 bool page_cache_get(page_cache_t *page_cache, size_t page_number, void *buff);
 
-void page_cache_set(page_cache_t *page_cache, size_t page_number, void *buff);
\ No newline at end of file
+void page_cache_set(page_cache_t *page_cache, size_t page_number, void *buff);
+
+/* does not count as an access */
+bool page_cache_contains(page_cache_t *page_cache, size_t page_number);
+
+/* writes every dirty block through on_flush, the blocks stay cached */
+void page_cache_flush(page_cache_t *page_cache);
+
+void page_cache_free(page_cache_t *page_cache);
\ No newline at end of file
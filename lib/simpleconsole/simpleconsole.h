@@ -16,6 +16,7 @@ typedef struct
     // int stdin_fd;
     int console_esc_state;
     BOOL resize_pending;
+    BOOL snapshot_pending;
 } STDIODevice;
 
 #ifdef _WIN32
@@ -93,16 +94,33 @@ static void simple_console_get_size(STDIODevice *s, int *pw, int *ph)
     *ph = height;
 }
 
+/* C-a s requests a snapshot, C-a C-a sends C-a */
 static int simple_console_read(void *opaque, uint8_t *buf, int len)
 {
-    int i = 0;
-    while (kbhit() && i < len)
+    STDIODevice *s = opaque;
+    int j = 0;
+    while (kbhit() && j < len)
     {
-        buf[i] = getch();
-        i++;
+        uint8_t ch = getch();
+        if (s->console_esc_state)
+        {
+            s->console_esc_state = 0;
+            if (ch == 's')
+                s->snapshot_pending = TRUE;
+            else if (ch == 1)
+                buf[j++] = ch;
+        }
+        else if (ch == 1)
+        {
+            s->console_esc_state = 1;
+        }
+        else
+        {
+            buf[j++] = ch;
+        }
     }
 
-    return i;
+    return j;
 }
 
 static void simple_console_write(void *opaque, const uint8_t *buf, int len)
@@ -32,6 +32,14 @@
 #include "iomem.h"
 
 #include <virtual_directory.h>
+#include <himem_allocator.h>
+
+#ifdef ESP32
+#include <esp_heap_caps.h>
+#endif
+
+/* heap left to the rest of the emulator after the resident pages are allocated */
+#define VMM_RESERVED_HEAP (64 * 1024)
 
 static PhysMemoryRange *default_register_ram(PhysMemoryMap *s, uint64_t addr,
                                              uint64_t size, int devram_flags);
@@ -65,18 +73,63 @@ void phys_mem_map_end(PhysMemoryMap *s)
     free(s);
 }
 
-/* return NULL if not found */
-/* XXX: optimize */
-PhysMemoryRange *get_phys_mem_range(PhysMemoryMap *s, uint64_t paddr)
+/* sorts the enabled ranges by address for phys_mem_range_lookup */
+static void phys_mem_map_update(PhysMemoryMap *s)
 {
     PhysMemoryRange *pr;
-    int i;
+    int i, j, n;
+
+    n = 0;
     for(i = 0; i < s->n_phys_mem_range; i++) {
         pr = &s->phys_mem_range[i];
-        if (paddr >= pr->addr && paddr < pr->addr + pr->size)
-            return pr;
+        if (pr->size == 0)
+            continue;
+        for(j = n; j > 0 && s->sorted_range[j - 1]->addr > pr->addr; j--)
+            s->sorted_range[j] = s->sorted_range[j - 1];
+        s->sorted_range[j] = pr;
+        n++;
     }
-    return NULL;
+    s->n_sorted_range = n;
+    for(i = 1; i < n; i++) {
+        if (s->sorted_range[i - 1]->addr + s->sorted_range[i - 1]->size > s->sorted_range[i]->addr) {
+            s->n_sorted_range = -1;
+            break;
+        }
+    }
+    s->last_range = NULL;
+}
+
+/* return NULL if not found */
+PhysMemoryRange *phys_mem_range_lookup(PhysMemoryMap *s, uint64_t paddr)
+{
+    PhysMemoryRange *pr;
+    int i, low, high, middle;
+
+    if (s->n_sorted_range < 0) {
+        for(i = 0; i < s->n_phys_mem_range; i++) {
+            pr = &s->phys_mem_range[i];
+            if (paddr >= pr->addr && paddr < pr->addr + pr->size)
+                return pr;
+        }
+        return NULL;
+    }
+    /* the last range starting at or below paddr */
+    low = 0;
+    high = s->n_sorted_range;
+    while (low < high) {
+        middle = (low + high) / 2;
+        if (s->sorted_range[middle]->addr <= paddr)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    if (low == 0)
+        return NULL;
+    pr = s->sorted_range[low - 1];
+    if (paddr - pr->addr >= pr->size)
+        return NULL;
+    s->last_range = pr;
+    return pr;
 }
 
 PhysMemoryRange *register_ram_entry(PhysMemoryMap *s, uint64_t addr,
@@ -100,9 +153,55 @@ PhysMemoryRange *register_ram_entry(PhysMemoryMap *s, uint64_t addr,
         pr->size = pr->org_size;
     pr->phys_mem = NULL;
     pr->dirty_bits = NULL;
+    phys_mem_map_update(s);
     return pr;
 }
 
+static void default_vmm_evict(void *opaque, uint8_t *page, size_t page_size)
+{
+    PhysMemoryMap *map = opaque;
+    if (map->flush_tlb_host_range)
+        map->flush_tlb_host_range(map->opaque, page, page_size);
+}
+
+static size_t vmm_available_heap(void)
+{
+#ifdef ESP32
+    size_t free_size = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    return free_size > VMM_RESERVED_HEAP ? free_size - VMM_RESERVED_HEAP : 0;
+#else
+    return SIZE_MAX;
+#endif
+}
+
+/* fills in the defaults and shrinks the region to the memory of this board,
+   the same configuration runs on boards with different PSRAM sizes */
+static void vmm_region_fit(VMMRegionConfig *region, uint64_t addr, uint64_t size)
+{
+    if (region->page_size == 0)
+        region->page_size = VMM_REGION_DEFAULT_PAGE_SIZE;
+    if (region->pages == 0)
+        region->pages = VMM_REGION_DEFAULT_PAGES;
+    if (region->himem_blocks == 0)
+        region->himem_blocks = VMM_REGION_DEFAULT_HIMEM_BLOCKS;
+
+    size_t store_pages = (size + region->page_size - 1) / region->page_size;
+    if ((size_t)region->pages > store_pages)
+        region->pages = store_pages;
+
+    size_t heap_pages = vmm_available_heap() / region->page_size;
+    if ((size_t)region->pages > heap_pages) {
+        printf("RAM 0x%" PRIx64 ": %d pages requested, heap fits %zu\r\n", addr, region->pages, heap_pages);
+        region->pages = heap_pages > 0 ? heap_pages : 1;
+    }
+
+    size_t himem_blocks = himem_allocator_get_maximum_blocks(region->page_size);
+    if ((size_t)region->himem_blocks > himem_blocks) {
+        printf("RAM 0x%" PRIx64 ": %d himem blocks requested, %zu available\r\n", addr, region->himem_blocks, himem_blocks);
+        region->himem_blocks = himem_blocks > 0 ? himem_blocks : 1;
+    }
+}
+
 static PhysMemoryRange *default_register_ram(PhysMemoryMap *s, uint64_t addr,
                                              uint64_t size, int devram_flags)
 {
@@ -114,33 +213,34 @@ static PhysMemoryRange *default_register_ram(PhysMemoryMap *s, uint64_t addr,
     pr->phys_mem = NULL;
 
 
+    VMMRegionConfig region = s->vmm_region;
+    vmm_region_fit(&region, addr, size);
+
     char filename[50];
     snprintf(filename, sizeof(filename), "pagefile0x%" PRIx64 ".bin", addr);
 
     char fullpath[256];
-    vd_cwd(fullpath, sizeof(fullpath));
-    strncat(fullpath, filename, sizeof(fullpath)-1);
-
-    uint32_t vmm_pages = 0;
-
-    if (size< 1024 * 1024) {
-        vmm_pages = (128 * 1024) / (16*1024);
+    if (region.pagefile && region.pagefile[0] == '/') {
+        snprintf(fullpath, sizeof(fullpath), "%s", region.pagefile);
     } else {
-        vmm_pages = (2 * 1024 * 1024) / (16 * 1024);
-    }
-
-    //testing new indexer
-    vmm_pages = 400;
-    uint32_t vmm_page_size = 1024 * 8;
-
-    size_t maxiumum_blocks = 500;
-    if (addr == 0){
-        maxiumum_blocks = 12; //bios doesn't need more than 128k
-        vmm_pages = 10;
+        vd_cwd(fullpath, sizeof(fullpath));
+        strncat(fullpath, region.pagefile ? region.pagefile : filename, sizeof(fullpath) - strlen(fullpath) - 1);
     }
 
-    pr->vmm = vmm_create(fullpath, size, vmm_page_size, vmm_pages, maxiumum_blocks);
+    printf("RAM 0x%" PRIx64 ": %d pages of %d bytes, %d himem blocks, %s\r\n",
+           addr, region.pages, region.page_size, region.himem_blocks, fullpath);
+    if (region.persistent && s->vmm_backend == VMM_BACKEND_PAGED)
+        pr->vmm = vmm_create_persistent(fullpath, size, region.page_size, region.pages, region.himem_blocks, region.policy, s->vmm_generation);
+    else
+        pr->vmm = vmm_create_backend(s->vmm_backend, fullpath, size, region.page_size, region.pages, region.himem_blocks, region.policy);
     assert(pr->vmm && "VMM not created");
+    if (s->vmm_write_behind > 0) {
+        vmm_start_write_behind(pr->vmm, s->vmm_write_behind);
+    }
+    if (s->vmm_compressed_tier > 0) {
+        vmm_start_compressed_tier(pr->vmm, (size_t)s->vmm_compressed_tier * 1024);
+    }
+    vmm_subscribe_evict(pr->vmm, default_vmm_evict, s);
 
     printf("Registered RAM 0x%" PRIx64 ": %" PRIu64 " bytes at 0x%p\r\n", addr,size, pr->phys_mem );
 
@@ -237,6 +337,7 @@ PhysMemoryRange *cpu_register_device(PhysMemoryMap *s, uint64_t addr,
     pr->read_func = read_func;
     pr->write_func = write_func;
     pr->devio_flags = devio_flags;
+    phys_mem_map_update(s);
     return pr;
 }
 
@@ -272,8 +373,9 @@ void phys_mem_set_addr(PhysMemoryRange *pr, uint64_t addr, BOOL enabled)
     if (!pr->is_ram) {
         default_set_addr(map, pr, addr, enabled);
     } else {
-        return map->set_ram_addr(map, pr, addr, enabled);
+        map->set_ram_addr(map, pr, addr, enabled);
     }
+    phys_mem_map_update(map);
 }
 
 /* return NULL if no valid RAM page. The access can only be done in the page */
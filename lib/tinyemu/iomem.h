@@ -68,6 +68,26 @@ typedef struct {
 
 #define PHYS_MEM_RANGE_MAX 32
 
+/* page sizes a RAM region can use, himem blocks are addressed with 16 bit sizes */
+#define VMM_REGION_MIN_PAGE_SIZE 1024
+#define VMM_REGION_MAX_PAGE_SIZE 32768
+#define VMM_REGION_MAX_HIMEM_BLOCKS 65535
+
+#define VMM_REGION_DEFAULT_PAGE_SIZE (8 * 1024)
+#define VMM_REGION_DEFAULT_PAGES 400
+#define VMM_REGION_DEFAULT_HIMEM_BLOCKS 500
+
+/* VMM of a paged RAM region, zero fields use the defaults above */
+typedef struct {
+    int page_size; /* bytes, a power of two */
+    int pages; /* resident page frames */
+    int himem_blocks; /* blocks of the himem page cache */
+    eviction_policy_type_t policy;
+    char *pagefile; /* NULL for pagefile0x<addr>.bin, relative paths are in the working directory */
+    BOOL persistent; /* keeps the pagefile and the boot images loaded into it for the next boot */
+    char *base; /* NULL or a base image of the loaded boot images, the region is a copy-on-write overlay of it */
+} VMMRegionConfig;
+
 struct PhysMemoryMap {
     int n_phys_mem_range;
     PhysMemoryRange phys_mem_range[PHYS_MEM_RANGE_MAX];
@@ -80,6 +100,18 @@ struct PhysMemoryMap {
     void *opaque;
     void (*flush_tlb_write_range)(void *opaque, uint8_t *ram_addr,
                                   size_t ram_size);
+    /* called when the VMM evicts a page buffer the TLB may point to */
+    void (*flush_tlb_host_range)(void *opaque, uint8_t *host_addr,
+                                 size_t host_size);
+    vmm_backend_t vmm_backend; /* backend of the RAM registered next */
+    VMMRegionConfig vmm_region; /* VMM of the RAM registered next */
+    int vmm_write_behind; /* write-behind queue pages of the paged RAM, 0 disables it */
+    int vmm_compressed_tier; /* compressed tier KB of the paged RAM, 0 disables it */
+    uint64_t vmm_generation; /* boot images of persistent pagefiles, other images recreate them */
+    /* enabled ranges sorted by address, rebuilt whenever a range is added, moved, enabled or disabled */
+    PhysMemoryRange *sorted_range[PHYS_MEM_RANGE_MAX];
+    int n_sorted_range; /* -1 while enabled ranges overlap, they are then searched in registration order */
+    PhysMemoryRange *last_range; /* range of the last lookup, NULL after a rebuild */
 };
 
 
@@ -96,7 +128,19 @@ PhysMemoryRange *cpu_register_device(PhysMemoryMap *s, uint64_t addr,
                                      uint64_t size, void *opaque,
                                      DeviceReadFunc *read_func, DeviceWriteFunc *write_func,
                                      int devio_flags);
-PhysMemoryRange *get_phys_mem_range(PhysMemoryMap *s, uint64_t paddr);
+PhysMemoryRange *phys_mem_range_lookup(PhysMemoryMap *s, uint64_t paddr);
+
+/* return NULL if not found. Consecutive accesses mostly hit the same range,
+   the others are a binary search */
+static inline PhysMemoryRange *get_phys_mem_range(PhysMemoryMap *s, uint64_t paddr)
+{
+    PhysMemoryRange *pr = s->last_range;
+    /* a disabled range has a size of 0 and never matches */
+    if (pr && paddr - pr->addr < pr->size)
+        return pr;
+    return phys_mem_range_lookup(s, paddr);
+}
+
 void phys_mem_set_addr(PhysMemoryRange *pr, uint64_t addr, BOOL enabled);
 
 static inline const uint32_t *phys_mem_get_dirty_bits(PhysMemoryRange *pr)
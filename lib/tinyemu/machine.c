@@ -119,6 +119,87 @@ static int vm_get_str_opt(JSONValue obj, const char *name, const char **pstr)
     return vm_get_str2(obj, name, pstr, TRUE);
 }
 
+static const char *vm_ram_region_names[VM_RAM_REGION_COUNT] = {
+    "ram",
+    "low_ram",
+};
+
+/* VMM of each region unless the configuration tunes it */
+static const VMMRegionConfig vm_ram_region_defaults[VM_RAM_REGION_COUNT] = {
+    { VMM_REGION_DEFAULT_PAGE_SIZE, VMM_REGION_DEFAULT_PAGES, VMM_REGION_DEFAULT_HIMEM_BLOCKS, EVICTION_POLICY_CLOCK, NULL, FALSE, NULL },
+    { VMM_REGION_DEFAULT_PAGE_SIZE, 10, 12, EVICTION_POLICY_CLOCK, NULL, FALSE, NULL }, /* the bios doesn't need more than 96k */
+};
+
+static int vm_parse_vmm_policy(const char *name, const char *str, eviction_policy_type_t *ppolicy)
+{
+    eviction_policy_type_t policy;
+    if (!eviction_policy_parse(str, &policy)) {
+        vm_error("%s: unknown policy '%s'\n", name, str);
+        return -1;
+    }
+    *ppolicy = policy;
+    return 0;
+}
+
+/* page_size, pages, himem_blocks, policy, pagefile, persistent and base of one region, all optional */
+static int vm_parse_vmm_region(const char *name, JSONValue obj, VMMRegionConfig *region)
+{
+    const char *str;
+    JSONValue el;
+
+    if (obj.type != JSON_OBJ) {
+        vm_error("%s: object expected\n", name);
+        return -1;
+    }
+    if (vm_get_int_opt(obj, "page_size", &region->page_size, region->page_size) < 0 ||
+        vm_get_int_opt(obj, "pages", &region->pages, region->pages) < 0 ||
+        vm_get_int_opt(obj, "himem_blocks", &region->himem_blocks, region->himem_blocks) < 0)
+        return -1;
+    if (region->page_size < VMM_REGION_MIN_PAGE_SIZE || region->page_size > VMM_REGION_MAX_PAGE_SIZE ||
+        (region->page_size & (region->page_size - 1)) != 0) {
+        vm_error("%s: page_size must be a power of two from %d to %d\n", name,
+                 VMM_REGION_MIN_PAGE_SIZE, VMM_REGION_MAX_PAGE_SIZE);
+        return -1;
+    }
+    if (region->pages < 1) {
+        vm_error("%s: pages must be positive\n", name);
+        return -1;
+    }
+    if (region->himem_blocks < 1 || region->himem_blocks > VMM_REGION_MAX_HIMEM_BLOCKS) {
+        vm_error("%s: himem_blocks must be from 1 to %d\n", name, VMM_REGION_MAX_HIMEM_BLOCKS);
+        return -1;
+    }
+
+    if (vm_get_str_opt(obj, "policy", &str) < 0)
+        return -1;
+    if (str && vm_parse_vmm_policy(name, str, &region->policy) < 0)
+        return -1;
+
+    if (vm_get_str_opt(obj, "pagefile", &str) < 0)
+        return -1;
+    if (str) {
+        free(region->pagefile);
+        region->pagefile = strdup(str);
+    }
+
+    el = json_object_get(obj, "persistent");
+    if (!json_is_undefined(el)) {
+        if (el.type != JSON_BOOL) {
+            vm_error("%s: persistent: boolean expected\n", name);
+            return -1;
+        }
+        region->persistent = el.u.b;
+    }
+
+    if (vm_get_str_opt(obj, "base", &str) < 0)
+        return -1;
+    if (str) {
+        free(region->base);
+        region->base = strdup(str);
+    }
+    return 0;
+}
+
 static char *strdup_null(const char *str)
 {
     if (!str)
@@ -225,7 +306,7 @@ static const VirtMachineClass *virt_machine_find_class(const char *machine_name)
 static int virt_machine_parse_config(VirtMachineParams *p,
                                      char *config_file_str, int len)
 {
-    int version, val;
+    int version, val, i;
     const char *tag_name, *str;
     char buf1[256];
     JSONValue cfg, obj, el;
@@ -290,6 +371,86 @@ static int virt_machine_parse_config(VirtMachineParams *p,
     if (str) {
         p->cmdline = cmdline_subst(str);
     }
+
+    tag_name = "vmm_backend";
+    if (vm_get_str_opt(cfg, tag_name, &str) < 0)
+        goto tag_fail;
+    if (str) {
+        vmm_backend_t backend;
+        if (!vmm_parse_backend(str, &backend)) {
+            vm_error("%s: unknown backend '%s'\n", tag_name, str);
+            goto tag_fail;
+        }
+        p->vmm_backend = backend;
+    }
+
+    for(i = 0; i < VM_RAM_REGION_COUNT; i++)
+        p->vmm_region[i] = vm_ram_region_defaults[i];
+
+    /* either one policy for all regions or an object with a policy per
+       region, it is the default the policy of vmm_region overrides */
+    tag_name = "vmm_policy";
+    obj = json_object_get(cfg, tag_name);
+    if (obj.type == JSON_STR) {
+        eviction_policy_type_t policy;
+        if (vm_parse_vmm_policy(tag_name, obj.u.str->data, &policy) < 0)
+            goto tag_fail;
+        for(i = 0; i < VM_RAM_REGION_COUNT; i++)
+            p->vmm_region[i].policy = policy;
+    } else if (obj.type == JSON_OBJ) {
+        for(i = 0; i < VM_RAM_REGION_COUNT; i++) {
+            if (vm_get_str_opt(obj, vm_ram_region_names[i], &str) < 0)
+                goto tag_fail;
+            if (str && vm_parse_vmm_policy(tag_name, str, &p->vmm_region[i].policy) < 0)
+                goto tag_fail;
+        }
+    } else if (!json_is_undefined(obj)) {
+        vm_error("%s: string or object expected\n", tag_name);
+        goto tag_fail;
+    }
+
+    /* an object per region, e.g. vmm_region: { ram: { pages: 200, himem_blocks: 900 } },
+       parsed after vmm_policy so that its policy wins */
+    tag_name = "vmm_region";
+    obj = json_object_get(cfg, tag_name);
+    if (obj.type == JSON_OBJ) {
+        for(i = 0; i < VM_RAM_REGION_COUNT; i++) {
+            el = json_object_get(obj, vm_ram_region_names[i]);
+            if (!json_is_undefined(el) &&
+                vm_parse_vmm_region(vm_ram_region_names[i], el, &p->vmm_region[i]) < 0)
+                goto tag_fail;
+        }
+        if (p->vmm_region[VM_RAM_REGION_RAM].pagefile && p->vmm_region[VM_RAM_REGION_LOW_RAM].pagefile &&
+            !strcmp(p->vmm_region[VM_RAM_REGION_RAM].pagefile, p->vmm_region[VM_RAM_REGION_LOW_RAM].pagefile)) {
+            vm_error("%s: regions must not share a pagefile\n", tag_name);
+            goto tag_fail;
+        }
+    } else if (!json_is_undefined(obj)) {
+        vm_error("%s: object expected\n", tag_name);
+        goto tag_fail;
+    }
+
+    tag_name = "vmm_write_behind";
+    if (vm_get_int_opt(cfg, tag_name, &p->vmm_write_behind, 0) < 0)
+        goto tag_fail;
+    if (p->vmm_write_behind < 0) {
+        vm_error("%s: must not be negative\n", tag_name);
+        goto tag_fail;
+    }
+
+    if (vm_get_str_opt(cfg, "snapshot", &str) < 0)
+        goto tag_fail;
+    if (str) {
+        p->snapshot = strdup(str);
+    }
+
+    tag_name = "vmm_compressed_tier";
+    if (vm_get_int_opt(cfg, tag_name, &p->vmm_compressed_tier, 0) < 0)
+        goto tag_fail;
+    if (p->vmm_compressed_tier < 0) {
+        vm_error("%s: must not be negative\n", tag_name);
+        goto tag_fail;
+    }
     
     for(;;) {
         snprintf(buf1, sizeof(buf1), "drive%d", p->drive_count);
@@ -397,6 +558,16 @@ static int virt_machine_parse_config(VirtMachineParams *p,
         }
         p->rtc_local_time = el.u.b;
     }
+
+    tag_name = "print_stats";
+    el = json_object_get(cfg, tag_name);
+    if (!json_is_undefined(el)) {
+        if (el.type != JSON_BOOL) {
+            vm_error("%s: boolean expected\n", tag_name);
+            goto tag_fail;
+        }
+        p->print_stats = el.u.b;
+    }
     
     json_free(cfg);
     return 0;
@@ -620,6 +791,11 @@ void virt_machine_free_config(VirtMachineParams *p)
     
     free(p->machine_name);
     free(p->cmdline);
+    free(p->snapshot);
+    for(i = 0; i < VM_RAM_REGION_COUNT; i++) {
+        free(p->vmm_region[i].pagefile);
+        free(p->vmm_region[i].base);
+    }
     for(i = 0; i < VM_FILE_COUNT; i++) {
         free(p->files[i].filename);
         free(p->files[i].buf);
@@ -55,6 +55,14 @@ typedef enum {
     VM_FILE_COUNT,
 } VMFileTypeEnum;
 
+/* RAM regions that can be tuned separately in the configuration */
+typedef enum {
+    VM_RAM_REGION_RAM,     /* "ram", main memory */
+    VM_RAM_REGION_LOW_RAM, /* "low_ram", bios and firmware memory */
+
+    VM_RAM_REGION_COUNT,
+} VMRamRegionEnum;
+
 typedef struct {
     char *filename;
     uint8_t *buf;
@@ -102,6 +110,12 @@ typedef struct {
     char *cmdline; /* bios or kernel command line */
     BOOL accel_enable; /* enable acceleration (KVM) */
     char *input_device; /* NULL means no input */
+    int vmm_backend; /* vmm_backend_t used for the RAM regions */
+    VMMRegionConfig vmm_region[VM_RAM_REGION_COUNT]; /* VMM of each RAM region */
+    int vmm_write_behind; /* pages queued for the background writer, 0 writes synchronously */
+    int vmm_compressed_tier; /* KB of compressed pages in front of the himem page cache, 0 disables it */
+    char *snapshot; /* machine snapshot, resumed at start when it exists, NULL disables snapshots */
+    BOOL print_stats; /* print the CPU cache statistics when the machine ends */
     
     /* kernel, bios and other auxiliary files */
     VMFileEntry files[VM_FILE_COUNT];
@@ -116,6 +130,8 @@ typedef struct VirtMachine {
     CharacterDevice *console;
     /* graphics */
     FBDevice *fb_dev;
+    /* NULL when snapshots are disabled */
+    char *snapshot_filename;
 } VirtMachine;
 
 struct VirtMachineClass {
@@ -129,6 +145,8 @@ struct VirtMachineClass {
     void (*vm_send_mouse_event)(VirtMachine *s1, int dx, int dy, int dz,
                                 unsigned int buttons);
     void (*vm_send_key_event)(VirtMachine *s1, BOOL is_down, uint16_t key_code);
+    /* NULL when the machine has no snapshot support */
+    int (*virt_machine_save)(VirtMachine *s, const char *filename);
 };
 
 extern const VirtMachineClass riscv_machine_class;
@@ -156,6 +174,13 @@ static inline void virt_machine_interp(VirtMachine *s, int max_exec_cycle)
 {
     s->vmc->virt_machine_interp(s, max_exec_cycle);
 }
+/* saves the machine to its configured snapshot, returns -1 on error */
+static inline int virt_machine_save(VirtMachine *s)
+{
+    if (!s->vmc->virt_machine_save || !s->snapshot_filename)
+        return -1;
+    return s->vmc->virt_machine_save(s, s->snapshot_filename);
+}
 static inline BOOL vm_mouse_is_absolute(VirtMachine *s)
 {
     return s->vmc->vm_mouse_is_absolute(s);
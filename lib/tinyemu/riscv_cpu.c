@@ -204,6 +204,7 @@ PHYS_MEM_READ_WRITE(64, uint64_t)
 
 #define PTE_V_MASK (1 << 0)
 #define PTE_U_MASK (1 << 4)
+#define PTE_G_MASK (1 << 5)
 #define PTE_A_MASK (1 << 6)
 #define PTE_D_MASK (1 << 7)
 
@@ -211,6 +212,149 @@ PHYS_MEM_READ_WRITE(64, uint64_t)
 #define ACCESS_WRITE 1
 #define ACCESS_CODE  2
 
+static inline PTWCacheEntry *ptw_cache_entry(RISCVCPUState *s, target_ulong pte_addr,
+                                             int pte_size_log2)
+{
+    /* the table address spreads the same index of different tables */
+    return &s->ptw_cache[((pte_addr >> pte_size_log2) ^ (pte_addr >> PG_SHIFT)) &
+                         (PTW_CACHE_SIZE - 1)];
+}
+
+static void ptw_cache_init(RISCVCPUState *s)
+{
+    int i;
+
+    for(i = 0; i < PTW_CACHE_SIZE; i++) {
+        s->ptw_cache[i].pte_addr = -1;
+    }
+}
+
+static void ptw_cache_flush(RISCVCPUState *s)
+{
+    ptw_cache_init(s);
+    s->stats.ptw_cache_flushes++;
+}
+
+#if MAX_XLEN == 32
+#define SATP_ASID_SHIFT 22
+#define SATP_ASID_MASK 0x1ff
+#else
+#define SATP_ASID_SHIFT 44
+#define SATP_ASID_MASK 0xffff
+#endif
+
+static inline int get_satp_asid(RISCVCPUState *s)
+{
+    return (s->satp >> SATP_ASID_SHIFT) & SATP_ASID_MASK;
+}
+
+/* 4 KB pages and each superpage size have their own slots */
+static inline ASIDTLBEntry *asid_tlb_entry(RISCVCPUState *s, target_ulong vaddr,
+                                           int shift, int asid)
+{
+    if (shift == PG_SHIFT)
+        return &s->asid_tlb[((vaddr >> shift) ^ asid) & (ASID_TLB_SIZE - 1)];
+    else
+        return &s->superpage_tlb[((vaddr >> shift) ^ asid ^ shift) &
+                                 (SUPERPAGE_TLB_SIZE - 1)];
+}
+
+static inline BOOL asid_tlb_match(ASIDTLBEntry *te, target_ulong vaddr, int asid)
+{
+    return te->vaddr == (vaddr & ~(((target_ulong)1 << te->shift) - 1)) &&
+        (te->global || te->asid == asid);
+}
+
+static void asid_tlb_flush_entries(ASIDTLBEntry *tlb, int n, target_ulong vaddr, int asid)
+{
+    ASIDTLBEntry *te;
+    int i;
+
+    for(i = 0; i < n; i++) {
+        te = &tlb[i];
+        if (te->vaddr == (target_ulong)-1)
+            continue;
+        if (asid >= 0 && (te->global || te->asid != asid))
+            continue;
+        /* a superpage entry covers vaddr when the bits above the leaf match */
+        if (vaddr != (target_ulong)-1 && ((te->vaddr ^ vaddr) >> te->shift) != 0)
+            continue;
+        te->vaddr = -1;
+    }
+}
+
+/* asid < 0 flushes every address space including the global translations,
+   vaddr == -1 every address */
+static void asid_tlb_flush(RISCVCPUState *s, target_ulong vaddr, int asid)
+{
+    asid_tlb_flush_entries(s->superpage_tlb, SUPERPAGE_TLB_SIZE, vaddr, asid);
+    asid_tlb_flush_entries(s->asid_tlb, ASID_TLB_SIZE, vaddr, asid);
+}
+
+static inline DecodedPage *decode_page_entry(RISCVCPUState *s, target_ulong paddr)
+{
+    return &s->decode_pages[(paddr >> PG_SHIFT) & (DECODE_CACHE_PAGES - 1)];
+}
+
+static inline DecodedBlock *decode_block_entry(RISCVCPUState *s, target_ulong paddr)
+{
+    return &s->decode_blocks[((paddr >> 1) ^ (paddr >> PG_SHIFT)) &
+                             (DECODE_CACHE_BLOCKS - 1)];
+}
+
+/* drop the blocks of the page, the ops stay allocated until the next
+   flush so that the block being executed remains readable */
+static void decode_page_drop(DecodedPage *dp)
+{
+    dp->paddr = -1;
+    dp->generation++;
+}
+
+static void decode_cache_invalidate_page(RISCVCPUState *s, DecodedPage *dp)
+{
+    decode_page_drop(dp);
+    s->stats.decode_cache_invalidations++;
+}
+
+/* must not be called while the interpreter executes predecoded ops */
+static void decode_cache_flush(RISCVCPUState *s)
+{
+    int i;
+
+    for(i = 0; i < DECODE_CACHE_PAGES; i++) {
+        decode_page_drop(&s->decode_pages[i]);
+    }
+    s->decode_ops_used = 0;
+}
+
+/* permission checks of a leaf PTE. return -1 if the access faults, 1 if
+   it is allowed once the A or D bit is set, 0 otherwise */
+static inline int check_leaf_pte(RISCVCPUState *s, target_ulong pte,
+                                 int priv, int access)
+{
+    int xwr = (pte >> 1) & 7;
+
+    if (xwr == 2 || xwr == 6)
+        return -1;
+    /* priviledge check */
+    if (priv == PRV_S) {
+        if ((pte & PTE_U_MASK) && !(s->mstatus & MSTATUS_SUM))
+            return -1;
+    } else {
+        if (!(pte & PTE_U_MASK))
+            return -1;
+    }
+    /* protection check */
+    /* MXR allows read access to execute-only pages */
+    if (s->mstatus & MSTATUS_MXR)
+        xwr |= (xwr >> 2);
+
+    if (((xwr >> access) & 1) == 0)
+        return -1;
+    return !(pte & PTE_A_MASK) ||
+        (!(pte & PTE_D_MASK) && access == ACCESS_WRITE);
+}
+
 /* access = 0: read, 1 = write, 2 = code. Set the exception_pending
    field if necessary. return 0 if OK, -1 if translation error */
 static int get_phys_addr(RISCVCPUState *s,
@@ -218,8 +362,10 @@ static int get_phys_addr(RISCVCPUState *s,
                          int access)
 {
     int mode, levels, pte_bits, pte_idx, pte_mask, pte_size_log2, xwr, priv;
-    int need_write, vaddr_shift, i, pte_addr_bits;
-    target_ulong pte_addr, pte, vaddr_mask, paddr;
+    int need_write, vaddr_shift, i, pte_addr_bits, asid;
+    target_ulong pte_addr, pte, vaddr_mask, paddr, global;
+    PTWCacheEntry *ce;
+    ASIDTLBEntry *te;
 
     if ((s->mstatus & MSTATUS_MPRV) && access != ACCESS_CODE) {
         /* use previous priviledge */
@@ -266,13 +412,46 @@ static int get_phys_addr(RISCVCPUState *s,
         pte_addr_bits = 44;
     }
 #endif
-    pte_addr = (s->satp & (((target_ulong)1 << pte_addr_bits) - 1)) << PG_SHIFT;
+    /* a cached translation that faults or lacks the A or D bit is walked
+       again, the PTE may have changed since */
+    asid = get_satp_asid(s);
     pte_bits = 12 - pte_size_log2;
+    te = NULL;
+    for(i = levels - 1; i >= 0; i--) {
+        te = asid_tlb_entry(s, vaddr, PG_SHIFT + pte_bits * i, asid);
+        if (asid_tlb_match(te, vaddr, asid))
+            break;
+        te = NULL;
+    }
+    if (te && check_leaf_pte(s, te->pte, priv, access) == 0) {
+        s->stats.asid_tlb_hits++;
+        if (te->shift != PG_SHIFT)
+            s->stats.superpage_hits++;
+        paddr = (te->pte >> 10) << PG_SHIFT;
+        vaddr_mask = ((target_ulong)1 << te->shift) - 1;
+        *ppaddr = (vaddr & vaddr_mask) | (paddr  & ~vaddr_mask);
+        return 0;
+    }
+    s->stats.page_walks++;
+
+    pte_addr = (s->satp & (((target_ulong)1 << pte_addr_bits) - 1)) << PG_SHIFT;
     pte_mask = (1 << pte_bits) - 1;
+    /* a global non-leaf PTE makes every translation below it global */
+    global = 0;
     for(i = 0; i < levels; i++) {
         vaddr_shift = PG_SHIFT + pte_bits * (levels - 1 - i);
         pte_idx = (vaddr >> vaddr_shift) & pte_mask;
         pte_addr += pte_idx << pte_size_log2;
+        ce = NULL;
+        if (i < levels - 1) {
+            ce = ptw_cache_entry(s, pte_addr, pte_size_log2);
+            if (ce->pte_addr == pte_addr) {
+                s->stats.ptw_cache_hits++;
+                global |= ce->pte & PTE_G_MASK;
+                pte_addr = (ce->pte >> 10) << PG_SHIFT;
+                continue;
+            }
+        }
         if (pte_size_log2 == 2)
             pte = phys_read_u32(s, pte_addr);
         else
@@ -282,26 +461,11 @@ static int get_phys_addr(RISCVCPUState *s,
             return -1; /* invalid PTE */
         paddr = (pte >> 10) << PG_SHIFT;
         xwr = (pte >> 1) & 7;
+        global |= pte & PTE_G_MASK;
         if (xwr != 0) {
-            if (xwr == 2 || xwr == 6)
+            need_write = check_leaf_pte(s, pte, priv, access);
+            if (need_write < 0)
                 return -1;
-            /* priviledge check */
-            if (priv == PRV_S) {
-                if ((pte & PTE_U_MASK) && !(s->mstatus & MSTATUS_SUM))
-                    return -1;
-            } else {
-                if (!(pte & PTE_U_MASK))
-                    return -1;
-            }
-            /* protection check */
-            /* MXR allows read access to execute-only pages */
-            if (s->mstatus & MSTATUS_MXR)
-                xwr |= (xwr >> 2);
-
-            if (((xwr >> access) & 1) == 0)
-                return -1;
-            need_write = !(pte & PTE_A_MASK) ||
-                (!(pte & PTE_D_MASK) && access == ACCESS_WRITE);
             pte |= PTE_A_MASK;
             if (access == ACCESS_WRITE)
                 pte |= PTE_D_MASK;
@@ -313,19 +477,37 @@ static int get_phys_addr(RISCVCPUState *s,
             }
             vaddr_mask = ((target_ulong)1 << vaddr_shift) - 1;
             *ppaddr = (vaddr & vaddr_mask) | (paddr  & ~vaddr_mask);
+            te = asid_tlb_entry(s, vaddr, vaddr_shift, asid);
+            te->vaddr = vaddr & ~vaddr_mask;
+            te->pte = pte;
+            te->asid = asid;
+            te->global = global != 0;
+            te->shift = vaddr_shift;
             return 0;
         } else {
+            if (ce) {
+                ce->pte_addr = pte_addr;
+                ce->pte = pte;
+                s->stats.ptw_cache_misses++;
+            }
             pte_addr = paddr;
         }
     }
     return -1;
 }
 
+/* a TLB entry covers a whole target page, so it can only point into the
+   VMM page buffer when VMM pages are a multiple of the target page size */
+static inline BOOL vmm_can_map_tlb(PhysMemoryRange *pr)
+{
+    return (pr->vmm->page_size & PG_MASK) == 0;
+}
+
 /* return 0 if OK, != 0 if exception */
 int target_read_slow(RISCVCPUState *s, mem_uint_t *pval,
                      target_ulong addr, int size_log2)
 {
-    int size, err, al;// tlb_idx,
+    int size, err, al, tlb_idx;
     target_ulong paddr, offset;
     uint8_t *ptr;
     PhysMemoryRange *pr;
@@ -409,43 +591,25 @@ int target_read_slow(RISCVCPUState *s, mem_uint_t *pval,
 #endif
             return 0;
         } else if (pr->is_ram) {
-            // tlb_idx = (addr >> PG_SHIFT) & (TLB_SIZE - 1);
-            ptr = pr->phys_mem + /*(uintptr_t)*/(paddr - pr->addr);
-            // s->tlb_read[tlb_idx].vaddr = addr & ~PG_MASK;
-            // s->tlb_read[tlb_idx].mem_addend = (uintptr_t)ptr - addr;
+            ptr = vmm_get_page_ptr(pr->vmm, paddr - pr->addr, FALSE);
+            if (vmm_can_map_tlb(pr)) {
+                tlb_idx = (addr >> PG_SHIFT) & (TLB_SIZE - 1);
+                s->tlb_read[tlb_idx].vaddr = addr & ~PG_MASK;
+                s->tlb_read[tlb_idx].mem_addend = (uintptr_t)ptr - addr;
+            }
             switch(size_log2) {
             case 0:
-                {
-                // ret = *(uint8_t *)ptr;
-                uint8_t tret1;
-                vmm_read(pr->vmm, ptr - pr->phys_mem, &tret1, sizeof(uint8_t));
-                ret = tret1;
-                }
+                ret = *(uint8_t *)ptr;
                 break;
             case 1:
-                {
-                // ret = *(uint16_t *)ptr;
-                uint16_t tret2;
-                vmm_read(pr->vmm, ptr - pr->phys_mem, &tret2, sizeof(uint16_t));
-                ret = tret2;
-                }
+                ret = *(uint16_t *)ptr;
                 break;
             case 2:
-            {
-                // ret = *(uint32_t *)ptr;
-                uint32_t tret3;
-                vmm_read(pr->vmm, ptr - pr->phys_mem, &tret3, sizeof(uint32_t));
-                ret = tret3;
-            }
+                ret = *(uint32_t *)ptr;
                 break;
 #if MLEN >= 64
             case 3:
-            {
-                // ret = *(uint64_t *)ptr;
-                uint64_t tret4;
-                vmm_read(pr->vmm, ptr - pr->phys_mem, &tret4, sizeof(uint64_t));
-                ret = tret4;
-            }
+                ret = *(uint64_t *)ptr;
                 break;
 #endif
 #if MLEN >= 128
@@ -487,10 +651,11 @@ int target_read_slow(RISCVCPUState *s, mem_uint_t *pval,
 int target_write_slow(RISCVCPUState *s, target_ulong addr,
                       mem_uint_t val, int size_log2)
 {
-    int size, i, err;//, tlb_idx
+    int size, i, err, tlb_idx;
     target_ulong paddr, offset;
     uint8_t *ptr;
     PhysMemoryRange *pr;
+    DecodedPage *dp;
     
     /* first handle unaligned accesses */
     size = 1 << size_log2;
@@ -516,39 +681,30 @@ int target_write_slow(RISCVCPUState *s, target_ulong addr,
 #endif
         } else if (pr->is_ram) {
             phys_mem_set_dirty_bit(pr, paddr - pr->addr);
-            // tlb_idx = (addr >> PG_SHIFT) & (TLB_SIZE - 1);
-            ptr = pr->phys_mem + /*(uintptr_t)*/(paddr - pr->addr);
-            // s->tlb_write[tlb_idx].vaddr = addr & ~PG_MASK;
-            // s->tlb_write[tlb_idx].mem_addend = (uintptr_t)ptr - addr;
+            ptr = vmm_get_page_ptr(pr->vmm, paddr - pr->addr, TRUE);
+            dp = decode_page_entry(s, paddr);
+            if (unlikely(dp->paddr == (paddr & ~PG_MASK))) {
+                /* the page holds predecoded code */
+                decode_cache_invalidate_page(s, dp);
+            }
+            if (vmm_can_map_tlb(pr)) {
+                tlb_idx = (addr >> PG_SHIFT) & (TLB_SIZE - 1);
+                s->tlb_write[tlb_idx].vaddr = addr & ~PG_MASK;
+                s->tlb_write[tlb_idx].mem_addend = (uintptr_t)ptr - addr;
+            }
             switch(size_log2) {
             case 0:
-            {
-                // *(uint8_t *)ptr = val;
-                uint8_t tval1 = val;
-                vmm_write(pr->vmm, ptr - pr->phys_mem, &tval1, sizeof(uint8_t));
-            }
+                *(uint8_t *)ptr = val;
                 break;
             case 1:
-            {
-                // *(uint16_t *)ptr = val;
-                uint16_t tval2 = val;
-                vmm_write(pr->vmm, ptr - pr->phys_mem, &tval2, sizeof(uint16_t));
-            }
+                *(uint16_t *)ptr = val;
                 break;
             case 2:
-            {
-                // *(uint32_t *)ptr = val;
-                uint32_t tval3 = val;
-                vmm_write(pr->vmm, ptr - pr->phys_mem, &tval3, sizeof(uint32_t));
-            }
+                *(uint32_t *)ptr = val;
                 break;
 #if MLEN >= 64
             case 3:
-            {
-                // *(uint64_t *)ptr = val;
-                uint64_t tval4 = val;
-                vmm_write(pr->vmm, ptr - pr->phys_mem, &tval4, sizeof(uint64_t));
-            }
+                *(uint64_t *)ptr = val;
                 break;
 #endif
 #if MLEN >= 128
@@ -590,96 +746,33 @@ struct __attribute__((packed)) unaligned_u32 {
 };
 
 /* unaligned access at an address known to be a multiple of 2 */
-// static uint32_t get_insn32(uint8_t *ptr)
-// {
-    
-// #if defined(EMSCRIPTEN)
-//     return ((uint16_t *)ptr)[0] | (((uint16_t *)ptr)[1] << 16);
-// #else
-//     return ((struct unaligned_u32 *)ptr)->u32;
-// #endif
-// }
-
-
-/* unaligned access at an address known to be a multiple of 2 */
-static uint32_t get_vmm_insn32(RISCVCPUState *s, uint32_t ptr)
+static uint32_t get_insn32(uint8_t *ptr)
 {
-
 #if defined(EMSCRIPTEN)
     return ((uint16_t *)ptr)[0] | (((uint16_t *)ptr)[1] << 16);
 #else
-    // ptr = 0 | (uint32_t)ptr;
-    // printf("loading code from address 0x%" PRIx64 "\r\n", (uint64_t)ptr);
-    // target_ulong paddr;
-    // if (get_phys_addr(s, &paddr, ptr, ACCESS_CODE)) {
-    //     s->pending_tval = ptr;
-    //     // printf("fault: fetch page fault 0x%" PRIx64 "\r\n",(uint64_t)ptr);
-    //     s->pending_exception = CAUSE_FETCH_PAGE_FAULT;
-    //     return -1;
-    // }
-
-    PhysMemoryRange *pr = get_phys_mem_range(s->mem_map, ptr);
-    // assert(pr);
-    if (pr != NULL){
-        //printf("pr valid!\r\n");
-    }
-    else{
-        printf("pr invalid! 0x%" PRIX32 "\r\n", ptr);
-        return 0;
-    }
-
-    // if (!pr || !pr->is_ram) {
-    //     /* XXX: we only access to execute code from RAM */
-    //     printf("pr not in ram 0x%" PRIX64 "!\r\n",ptr);
-    //     s->pending_tval = ptr;
-    //     printf("fault: fault fetch\r\n");
-    //     s->pending_exception = CAUSE_FAULT_FETCH;
-    //     return -1;
-    // }   
-
-    struct unaligned_u32 pinsptr;
-    // vmm_read(pr->vmm, paddr - pr->addr, &pinsptr, sizeof(struct unaligned_u32));
-    // printf("reading inst32 from  0x%" PRIX64 " 0x%" PRIX64 "  0x%" PRIX64 " \r\n",ptr, ptr - pr->addr, pr->addr);
-    vmm_read(pr->vmm, ptr -  pr->addr, &pinsptr, sizeof(struct unaligned_u32));
-    return pinsptr.u32;
-    // return ((struct unaligned_u32 *)ptr)->u32;
+    return ((struct unaligned_u32 *)ptr)->u32;
 #endif
 }
 
-
-
-/* return 0 if OK, != 0 if exception */
-static no_inline __exception int target_read_insn_slow_vmm(RISCVCPUState *s,
-                                                       uint32_t *pptr,
-                                                       target_ulong addr)
-{
-    // printf("Reading Instruction Slow 0x%" PRIX32 "\r\n", addr);
-    // int tlb_idx;
-    target_ulong paddr;
-    // uint8_t *ptr;
-    
-    if (get_phys_addr(s, &paddr, addr, ACCESS_CODE)) {
-        s->pending_tval = addr;
-        // printf("fault: fetch page fault\r\n");
-        s->pending_exception = CAUSE_FETCH_PAGE_FAULT;
-        return -1;
-    }
-
-   
-   *pptr = (paddr);
-    return 0;
-}
-
-
-/* return 0 if OK, != 0 if exception */
+/* return 0 if OK, != 0 if exception. Code can be fetched from
+   [*pptr, *pend) without going through the slow path again, *ppage is
+   the VMM page holding it. *ppaddr is the physical address of addr, or
+   -1 when the code cannot be predecoded */
 static no_inline __exception int target_read_insn_slow(RISCVCPUState *s,
                                                        uint8_t **pptr,
+                                                       uint8_t **pend,
+                                                       vmTable_t **ppage,
+                                                       target_ulong *ppaddr,
                                                        target_ulong addr)
 {
-    // int tlb_idx;
+    int tlb_idx;
     target_ulong paddr;
+    uint64_t offset;
+    size_t page_left;
     uint8_t *ptr;
     PhysMemoryRange *pr;
+    vmTable_t *page;
     
     if (get_phys_addr(s, &paddr, addr, ACCESS_CODE)) {
         s->pending_tval = addr;
@@ -693,23 +786,24 @@ static no_inline __exception int target_read_insn_slow(RISCVCPUState *s,
         s->pending_exception = CAUSE_FAULT_FETCH;
         return -1;
     }
-    // tlb_idx = (addr >> PG_SHIFT) & (TLB_SIZE - 1);
-    ptr = pr->phys_mem + /*(uintptr_t)*/(paddr - pr->addr);
-    // s->tlb_code[tlb_idx].vaddr = addr & ~PG_MASK;
-    // s->tlb_code[tlb_idx].mem_addend = (uintptr_t)ptr - addr;
-    // pr = get_phys_mem_range(s->mem_map, addr);
-    // printf("reading from ptr: 0x%p, physmem: 0x%p paddr: 0x%" PRIX32 " pr addr: 0x%" PRIX64 " \r\n", ptr, pr->phys_mem, paddr, pr->addr);
-
-    // printf("read vmm from 0x%p\r\n",(ptr - pr->phys_mem) );
-    // uint8_t * rawptr;
-    // vmm_read(pr->vmm, ptr - pr->phys_mem, &rawptr, sizeof(rawptr));
-
-    
+    offset = paddr - pr->addr;
+    page = vmm_get_code_page(pr->vmm, offset);
+    ptr = page->page_cache + (offset - page->page_address);
+    page_left = pr->vmm->page_size - (offset - page->page_address);
+    if (vmm_can_map_tlb(pr)) {
+        tlb_idx = (addr >> PG_SHIFT) & (TLB_SIZE - 1);
+        s->tlb_code[tlb_idx].vaddr = addr & ~PG_MASK;
+        s->tlb_code[tlb_idx].mem_addend = (uintptr_t)ptr - addr;
+        s->tlb_code[tlb_idx].page = page;
+        s->tlb_code[tlb_idx].paddr = paddr & ~PG_MASK;
+        *ppaddr = paddr;
+    } else {
+        /* stores to the page cannot be kept out of tlb_write */
+        *ppaddr = -1;
+    }
     *pptr = ptr;
-    // // *pptr = rawptr;
-    // printf("read pptr 0x%" PRIx64 " ptr: 0x%p rawptr: 0x%p 0x%" PRIx32 " 0x%" PRIx64 "\r\n",(uint64_t)(*pptr - pr->phys_mem), ptr, rawptr, paddr, pr->addr);
-
-    // assert(rawptr == ptr);
+    *pend = ptr + min_int(PG_MASK + 1 - (addr & PG_MASK), page_left);
+    *ppage = page;
     return 0;
 }
 
@@ -717,32 +811,43 @@ static no_inline __exception int target_read_insn_slow(RISCVCPUState *s,
 static inline __exception int target_read_insn_u16(RISCVCPUState *s, uint16_t *pinsn,
                                                    target_ulong addr)
 {
-    // uint32_t tlb_idx;
-    uint8_t *ptr;
+    uint32_t tlb_idx;
+    uint8_t *ptr, *end;
+    vmTable_t *page;
+    target_ulong paddr;
     
-    // tlb_idx = (addr >> PG_SHIFT) & (TLB_SIZE - 1);
-    // if (likely(s->tlb_code[tlb_idx].vaddr == (addr & ~PG_MASK))) {
-    //     ptr = (uint8_t *)(s->tlb_code[tlb_idx].mem_addend +
-    //                       (uintptr_t)addr);
-    // } else {
-        if (target_read_insn_slow(s, &ptr, addr))
+    tlb_idx = (addr >> PG_SHIFT) & (TLB_SIZE - 1);
+    if (likely(s->tlb_code[tlb_idx].vaddr == (addr & ~PG_MASK))) {
+        ptr = (uint8_t *)(s->tlb_code[tlb_idx].mem_addend +
+                          (uintptr_t)addr);
+    } else {
+        if (target_read_insn_slow(s, &ptr, &end, &page, &paddr, addr))
             return -1;
-    // }
+    }
     *pinsn = *(uint16_t *)ptr;
     return 0;
 }
 
-
+/* pin the VMM page the interpreter fetches from so that code_ptr
+   stays valid when data accesses evict other pages */
+static inline void set_code_page(RISCVCPUState *s, vmTable_t *page)
+{
+    if (page != s->code_page) {
+        vmm_pin_page(page);
+        if (s->code_page)
+            vmm_unpin_page(s->code_page);
+        s->code_page = page;
+    }
+}
 
 static void tlb_init(RISCVCPUState *s)
 {
-    (void)(s);
     int i;
     
     for(i = 0; i < TLB_SIZE; i++) {
-        // s->tlb_read[i].vaddr = -1;
-        // s->tlb_write[i].vaddr = -1;
-        // s->tlb_code[i].vaddr = -1;
+        s->tlb_read[i].vaddr = -1;
+        s->tlb_write[i].vaddr = -1;
+        s->tlb_code[i].vaddr = -1;
     }
 }
 
@@ -762,22 +867,85 @@ static void glue(riscv_cpu_flush_tlb_write_range_ram,
                  MAX_XLEN)(RISCVCPUState *s,
                            uint8_t *ram_ptr, size_t ram_size)
 {
-    (void)(s);
+    int i;
+
+    /* RAM is accessed through VMM page buffers, so the write entries
+       cannot be matched against the ram_ptr range: flush them all */
     (void)(ram_ptr);
     (void)(ram_size);
-    // uint8_t *ptr, *ram_end;
-    // int i;
-    
-    // ram_end = ram_ptr + ram_size;
-    // for(i = 0; i < TLB_SIZE; i++) {
-        // if (s->tlb_write[i].vaddr != -1) {
-        //     ptr = (uint8_t *)(s->tlb_write[i].mem_addend +
-        //                       (uintptr_t)s->tlb_write[i].vaddr);
-        //     if (ptr >= ram_ptr && ptr < ram_end) {
-        //         s->tlb_write[i].vaddr = -1;
-        //     }
-        // }
-    // }
+    for(i = 0; i < TLB_SIZE; i++) {
+        s->tlb_write[i].vaddr = -1;
+    }
+}
+
+static inline void tlb_flush_host_entries(TLBEntry *tlb, uint8_t *host_ptr,
+                                          uint8_t *host_end)
+{
+    uint8_t *ptr;
+    int i;
+
+    for(i = 0; i < TLB_SIZE; i++) {
+        if (tlb[i].vaddr != (target_ulong)-1) {
+            ptr = (uint8_t *)(tlb[i].mem_addend + (uintptr_t)tlb[i].vaddr);
+            if (ptr >= host_ptr && ptr < host_end) {
+                tlb[i].vaddr = -1;
+            }
+        }
+    }
+}
+
+/* record that blocks were predecoded from the page of paddr, whose
+   code is at host address ptr */
+static DecodedPage *decode_cache_add_page(RISCVCPUState *s, target_ulong paddr,
+                                          uint8_t *ptr)
+{
+    DecodedPage *dp;
+    uint8_t *host_ptr;
+
+    dp = decode_page_entry(s, paddr);
+    if (dp->paddr != (paddr & ~PG_MASK)) {
+        /* the page using the entry loses its blocks, as its stores are
+           no longer detected */
+        decode_page_drop(dp);
+        host_ptr = ptr - (paddr & PG_MASK);
+        dp->paddr = paddr & ~PG_MASK;
+        dp->host_ptr = host_ptr;
+        tlb_flush_host_entries(s->tlb_write, host_ptr, host_ptr + PG_MASK + 1);
+    }
+    return dp;
+}
+
+/* called when the VMM evicts or writes back the page buffer at host_ptr */
+static void glue(riscv_cpu_flush_tlb_host_range,
+                 MAX_XLEN)(RISCVCPUState *s,
+                           uint8_t *host_ptr, size_t host_size)
+{
+    uint8_t *host_end = host_ptr + host_size;
+
+    uint8_t *ptr;
+    DecodedPage *dp;
+    int i;
+
+    tlb_flush_host_entries(s->tlb_read, host_ptr, host_end);
+    tlb_flush_host_entries(s->tlb_write, host_ptr, host_end);
+    for(i = 0; i < TLB_SIZE; i++) {
+        if (s->tlb_code[i].vaddr != (target_ulong)-1) {
+            ptr = (uint8_t *)(s->tlb_code[i].mem_addend +
+                              (uintptr_t)s->tlb_code[i].vaddr);
+            if (ptr >= host_ptr && ptr < host_end) {
+                s->tlb_code[i].vaddr = -1;
+            }
+        }
+    }
+    /* the predecoded blocks are dropped with the page buffer they were
+       decoded from */
+    for(i = 0; i < DECODE_CACHE_PAGES; i++) {
+        dp = &s->decode_pages[i];
+        if (dp->paddr != (target_ulong)-1 &&
+            dp->host_ptr >= host_ptr && dp->host_ptr < host_end) {
+            decode_cache_invalidate_page(s, dp);
+        }
+    }
 }
 
 
@@ -1088,12 +1256,13 @@ static int csr_write(RISCVCPUState *s, uint32_t csr, target_ulong val)
         s->mip = (s->mip & ~mask) | (val & mask);
         break;
     case 0x180:
-        /* no ASID implemented */
+        /* the ASID is kept, the TLBs below are refilled from the ASID
+           tagged TLB */
 #if MAX_XLEN == 32
         {
             int new_mode;
             new_mode = (val >> 31) & 1;
-            s->satp = (val & (((target_ulong)1 << 22) - 1)) |
+            s->satp = (val & (((target_ulong)1 << 31) - 1)) |
                 (new_mode << 31);
         }
 #else
@@ -1103,11 +1272,12 @@ static int csr_write(RISCVCPUState *s, uint32_t csr, target_ulong val)
             new_mode = (val >> 60) & 0xf;
             if (new_mode == 0 || (new_mode >= 8 && new_mode <= 9))
                 mode = new_mode;
-            s->satp = (val & (((uint64_t)1 << 44) - 1)) |
+            s->satp = (val & (((uint64_t)1 << 60) - 1)) |
                 ((uint64_t)mode << 60);
         }
 #endif
         tlb_flush_all(s);
+        ptw_cache_flush(s);
         return 2;
         
     case 0x300:
@@ -1368,6 +1538,23 @@ static inline uint32_t get_field1(uint32_t val, int src_pos,
         return (val >> (src_pos - dst_pos)) & mask;
 }
 
+static inline void decoded_op_set(DecodedOp *op, int dop, int rd, int rs1,
+                                  int rs2, int32_t imm)
+{
+    op->op = dop;
+    op->rd = rd;
+    op->rs1 = rs1;
+    op->rs2 = rs2;
+    op->imm = imm;
+}
+
+/* same for an instruction whose only effect is to write rd */
+static inline void decoded_op_set_rd(DecodedOp *op, int dop, int rd, int rs1,
+                                     int rs2, int32_t imm)
+{
+    decoded_op_set(op, rd == 0 ? DOP_NOP : dop, rd, rs1, rs2, imm);
+}
+
 #define XLEN 32
 #include "riscv_cpu_template.h"
 
@@ -1472,6 +1659,9 @@ static RISCVCPUState *glue(riscv_cpu_init, MAX_XLEN)(PhysMemoryMap *mem_map)
     s->misa |= MCPUID_C;
 #endif
     tlb_init(s);
+    ptw_cache_init(s);
+    asid_tlb_flush(s, -1, -1);
+    decode_cache_flush(s);
     return s;
 }
 
@@ -1488,6 +1678,41 @@ static uint32_t glue(riscv_cpu_get_misa, MAX_XLEN)(RISCVCPUState *s)
     return s->misa;
 }
 
+static void glue(riscv_cpu_get_stats, MAX_XLEN)(RISCVCPUState *s, RISCVCPUStats *stats)
+{
+    *stats = s->stats;
+}
+
+/* the state from pc up to mem_map is saved as is, the TLBs are refilled on demand */
+#define CPU_SAVED_STATE_SIZE (offsetof(RISCVCPUState, mem_map) - offsetof(RISCVCPUState, pc))
+
+static int glue(riscv_cpu_save, MAX_XLEN)(RISCVCPUState *s, FILE *f)
+{
+    uint32_t header[2] = { MAX_XLEN, CPU_SAVED_STATE_SIZE };
+    if (fwrite(header, sizeof(header), 1, f) != 1 ||
+        fwrite(&s->pc, CPU_SAVED_STATE_SIZE, 1, f) != 1)
+        return -1;
+    return 0;
+}
+
+static int glue(riscv_cpu_load, MAX_XLEN)(RISCVCPUState *s, FILE *f)
+{
+    uint32_t header[2];
+    if (fread(header, sizeof(header), 1, f) != 1 ||
+        header[0] != MAX_XLEN || header[1] != CPU_SAVED_STATE_SIZE ||
+        fread(&s->pc, CPU_SAVED_STATE_SIZE, 1, f) != 1)
+        return -1;
+    tlb_flush_all(s);
+    ptw_cache_flush(s);
+    asid_tlb_flush(s, -1, -1);
+    decode_cache_flush(s);
+    if (s->code_page) {
+        vmm_unpin_page(s->code_page);
+        s->code_page = NULL;
+    }
+    return 0;
+}
+
 const RISCVCPUClass glue(riscv_cpu_class, MAX_XLEN) = {
     glue(riscv_cpu_init, MAX_XLEN),
     glue(riscv_cpu_end, MAX_XLEN),
@@ -1499,6 +1724,10 @@ const RISCVCPUClass glue(riscv_cpu_class, MAX_XLEN) = {
     glue(riscv_cpu_get_power_down, MAX_XLEN),
     glue(riscv_cpu_get_misa, MAX_XLEN),
     glue(riscv_cpu_flush_tlb_write_range_ram, MAX_XLEN),
+    glue(riscv_cpu_flush_tlb_host_range, MAX_XLEN),
+    glue(riscv_cpu_save, MAX_XLEN),
+    glue(riscv_cpu_load, MAX_XLEN),
+    glue(riscv_cpu_get_stats, MAX_XLEN),
 };
 
 #if CONFIG_RISCV_MAX_XLEN == MAX_XLEN
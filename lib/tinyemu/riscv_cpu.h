@@ -25,6 +25,7 @@
 #define RISCV_CPU_H
 
 #include <stdlib.h>
+#include <stdio.h>
 #include "cutils.h"
 #include "iomem.h"
 
@@ -43,6 +44,19 @@
 
 typedef struct RISCVCPUState RISCVCPUState;
 
+/* address translation and decode cache counters, always maintained */
+typedef struct {
+    uint64_t ptw_cache_hits; /* non-leaf PTEs found in the page walk cache */
+    uint64_t ptw_cache_misses; /* non-leaf PTEs read from memory */
+    uint64_t ptw_cache_flushes; /* satp writes and sfence.vma */
+    uint64_t asid_tlb_hits; /* translations found in the ASID tagged TLB */
+    uint64_t superpage_hits; /* of which were superpage entries */
+    uint64_t page_walks; /* translations that walked the page tables */
+    uint64_t decode_cache_hits; /* basic blocks found predecoded */
+    uint64_t decode_cache_misses; /* basic blocks decoded */
+    uint64_t decode_cache_invalidations; /* code pages written or evicted */
+} RISCVCPUStats;
+
 typedef struct {
     RISCVCPUState *(*riscv_cpu_init)(PhysMemoryMap *mem_map);
     void (*riscv_cpu_end)(RISCVCPUState *s);
@@ -55,6 +69,11 @@ typedef struct {
     uint32_t (*riscv_cpu_get_misa)(RISCVCPUState *s);
     void (*riscv_cpu_flush_tlb_write_range_ram)(RISCVCPUState *s,
                                                 uint8_t *ram_ptr, size_t ram_size);
+    void (*riscv_cpu_flush_tlb_host_range)(RISCVCPUState *s,
+                                           uint8_t *host_ptr, size_t host_size);
+    int (*riscv_cpu_save)(RISCVCPUState *s, FILE *f);
+    int (*riscv_cpu_load)(RISCVCPUState *s, FILE *f);
+    void (*riscv_cpu_get_stats)(RISCVCPUState *s, RISCVCPUStats *stats);
 } RISCVCPUClass;
 
 typedef struct {
@@ -114,5 +133,27 @@ static inline void riscv_cpu_flush_tlb_write_range_ram(RISCVCPUState *s,
     const RISCVCPUClass *c = ((RISCVCPUCommonState *)s)->class_ptr;
     c->riscv_cpu_flush_tlb_write_range_ram(s, ram_ptr, ram_size);
 }
+static inline void riscv_cpu_flush_tlb_host_range(RISCVCPUState *s,
+                                                  uint8_t *host_ptr, size_t host_size)
+{
+    const RISCVCPUClass *c = ((RISCVCPUCommonState *)s)->class_ptr;
+    c->riscv_cpu_flush_tlb_host_range(s, host_ptr, host_size);
+}
+/* registers, CSRs and FP state, return -1 on error */
+static inline int riscv_cpu_save(RISCVCPUState *s, FILE *f)
+{
+    const RISCVCPUClass *c = ((RISCVCPUCommonState *)s)->class_ptr;
+    return c->riscv_cpu_save(s, f);
+}
+static inline int riscv_cpu_load(RISCVCPUState *s, FILE *f)
+{
+    const RISCVCPUClass *c = ((RISCVCPUCommonState *)s)->class_ptr;
+    return c->riscv_cpu_load(s, f);
+}
+static inline void riscv_cpu_get_stats(RISCVCPUState *s, RISCVCPUStats *stats)
+{
+    const RISCVCPUClass *c = ((RISCVCPUCommonState *)s)->class_ptr;
+    c->riscv_cpu_get_stats(s, stats);
+}
 
 #endif /* RISCV_CPU_H */
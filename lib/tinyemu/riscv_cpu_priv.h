@@ -39,6 +39,13 @@
 
 #define CONFIG_EXT_C /* compressed instructions */
 
+/* dispatch the predecoded ops with computed gotos when the compiler
+   supports them. Define CONFIG_SWITCH_DISPATCH to use the switch. */
+#if defined(__GNUC__) && !defined(EMSCRIPTEN) && \
+    !defined(CONFIG_SWITCH_DISPATCH)
+#define CONFIG_THREADED_DISPATCH
+#endif
+
 #if defined(EMSCRIPTEN)
 #define USE_GLOBAL_STATE
 /* use local variables slows down the generated JS code */
@@ -99,6 +106,19 @@ typedef uint128_t mem_uint_t;
 #endif
 
 #define TLB_SIZE 256
+#define PTW_CACHE_SIZE 64 /* must be a power of two */
+#define ASID_TLB_SIZE 256 /* must be a power of two */
+#define SUPERPAGE_TLB_SIZE 16 /* must be a power of two */
+#ifdef ESP32
+#define DECODE_CACHE_BLOCKS 128 /* must be a power of two */
+#define DECODE_CACHE_OPS 1024
+#define DECODE_CACHE_PAGES 32 /* must be a power of two */
+#else
+#define DECODE_CACHE_BLOCKS 1024 /* must be a power of two */
+#define DECODE_CACHE_OPS 16384
+#define DECODE_CACHE_PAGES 256 /* must be a power of two */
+#endif
+#define DECODE_BLOCK_MAX_OPS 64
 
 #define CAUSE_MISALIGNED_FETCH    0x0
 #define CAUSE_FAULT_FETCH         0x1
@@ -175,6 +195,132 @@ typedef struct {
     uintptr_t mem_addend;
 } TLBEntry;
 
+typedef struct {
+    target_ulong vaddr;
+    uintptr_t mem_addend;
+    vmTable_t *page; /* VMM page to pin while executing from it */
+    target_ulong paddr; /* physical address of the page */
+} TLBCodeEntry;
+
+/* non-leaf PTE of a page table walk, pte_addr is -1 when the entry is empty */
+typedef struct {
+    target_ulong pte_addr;
+    target_ulong pte;
+} PTWCacheEntry;
+
+/* leaf PTE of a translation tagged with the ASID of satp, vaddr is the
+   start of the page or superpage and -1 when the entry is empty */
+typedef struct {
+    target_ulong vaddr;
+    target_ulong pte;
+    uint16_t asid;
+    uint8_t global; /* the translation is valid in every address space */
+    uint8_t shift; /* vaddr bits below the leaf, PG_SHIFT unless a superpage */
+} ASIDTLBEntry;
+
+/* micro-ops of the decode cache. DOP_GENERIC instructions are decoded
+   again by the interpreter, writes to x0 are DOP_NOP */
+enum {
+    DOP_GENERIC,
+    DOP_NOP,
+    DOP_LI, /* lui, c.li, c.lui */
+    DOP_AUIPC,
+    DOP_J,
+    DOP_JAL,
+    DOP_JR,
+    DOP_JALR,
+    DOP_BEQ,
+    DOP_BNE,
+    DOP_BLT,
+    DOP_BGE,
+    DOP_BLTU,
+    DOP_BGEU,
+    DOP_LB,
+    DOP_LH,
+    DOP_LW,
+    DOP_LBU,
+    DOP_LHU,
+    DOP_LWU,
+    DOP_LD,
+    DOP_SB,
+    DOP_SH,
+    DOP_SW,
+    DOP_SD,
+    DOP_ADDI,
+    DOP_SLTI,
+    DOP_SLTIU,
+    DOP_XORI,
+    DOP_ORI,
+    DOP_ANDI,
+    DOP_SLLI,
+    DOP_SRLI,
+    DOP_SRAI,
+    DOP_ADD,
+    DOP_SUB,
+    DOP_SLL,
+    DOP_SLT,
+    DOP_SLTU,
+    DOP_XOR,
+    DOP_SRL,
+    DOP_SRA,
+    DOP_OR,
+    DOP_AND,
+    DOP_MUL,
+    DOP_MULH,
+    DOP_MULHSU,
+    DOP_MULHU,
+    DOP_DIV,
+    DOP_DIVU,
+    DOP_REM,
+    DOP_REMU,
+    DOP_ADDIW,
+    DOP_SLLIW,
+    DOP_SRLIW,
+    DOP_SRAIW,
+    DOP_ADDW,
+    DOP_SUBW,
+    DOP_SLLW,
+    DOP_SRLW,
+    DOP_SRAW,
+    DOP_MULW,
+    DOP_DIVW,
+    DOP_DIVUW,
+    DOP_REMW,
+    DOP_REMUW,
+    DOP_COUNT,
+};
+
+/* predecoded instruction, compressed instructions are stored in their
+   expanded form and imm is the resolved immediate */
+typedef struct {
+    uint8_t op; /* DOP_x */
+    uint8_t rd;
+    uint8_t rs1;
+    uint8_t rs2;
+    uint8_t len; /* 2 for a compressed instruction, 4 otherwise */
+    int32_t imm;
+} DecodedOp;
+
+/* basic block predecoded from physical address paddr, ops is NULL when
+   the entry is empty. It is only valid while the DecodedPage of paddr
+   has the same generation */
+typedef struct {
+    target_ulong paddr;
+    DecodedOp *ops;
+    uint32_t generation;
+    uint16_t size; /* bytes of code covered by ops */
+    uint8_t xlen;
+} DecodedBlock;
+
+/* physical page holding predecoded blocks, paddr is -1 when the entry
+   is empty. Invalidating the page increments generation, which drops
+   all of its blocks at once */
+typedef struct {
+    target_ulong paddr;
+    uint8_t *host_ptr; /* VMM page buffer the blocks were decoded from */
+    uint32_t generation;
+} DecodedPage;
+
 struct RISCVCPUState {
     RISCVCPUCommonState common; /* must be first */
     
@@ -183,7 +329,7 @@ struct RISCVCPUState {
 
 #ifdef USE_GLOBAL_VARIABLES
     /* faster to use global variables with emscripten */
-    uint32_t __code_ptr, __code_end;
+    uint8_t *__code_ptr, *__code_end;
     target_ulong __code_to_pc_addend;
 #endif
     
@@ -234,9 +380,30 @@ struct RISCVCPUState {
 
     PhysMemoryMap *mem_map;
 
-    // TLBEntry tlb_read[TLB_SIZE];
-    // TLBEntry tlb_write[TLB_SIZE];
-    // TLBEntry tlb_code[TLB_SIZE];
+    /* RAM entries point into VMM page buffers, they are flushed when
+       the VMM evicts or writes back the page */
+    TLBEntry tlb_read[TLB_SIZE];
+    TLBEntry tlb_write[TLB_SIZE];
+    TLBCodeEntry tlb_code[TLB_SIZE];
+    /* VMM page pinned by the instruction fetch, code_ptr points into it */
+    vmTable_t *code_page;
+    /* non-leaf PTEs by physical address, unlike the TLBs they are kept
+       across privilege changes and only flushed by satp and sfence.vma */
+    PTWCacheEntry ptw_cache[PTW_CACHE_SIZE];
+    /* translations the TLBs above are refilled from without a page table
+       walk, kept across satp switches and privilege changes */
+    ASIDTLBEntry asid_tlb[ASID_TLB_SIZE];
+    /* one entry per megapage or gigapage, looked up before asid_tlb */
+    ASIDTLBEntry superpage_tlb[SUPERPAGE_TLB_SIZE];
+    /* basic blocks by physical address, ops are allocated from
+       decode_ops until it is full and the whole cache is flushed */
+    DecodedBlock decode_blocks[DECODE_CACHE_BLOCKS];
+    DecodedOp decode_ops[DECODE_CACHE_OPS];
+    int decode_ops_used;
+    /* pages with predecoded blocks are kept out of tlb_write so that
+       stores to them go through target_write_slow */
+    DecodedPage decode_pages[DECODE_CACHE_PAGES];
+    RISCVCPUStats stats;
 };
 
 #define target_read_slow glue(glue(riscv, MAX_XLEN), _read_slow)
@@ -248,7 +415,7 @@ DLL_PUBLIC int target_write_slow(RISCVCPUState *s, target_ulong addr,
                                  mem_uint_t val, int size_log2);
 
 
-// #define WITH_TLB
+#define WITH_TLB
 
 #ifdef WITH_TLB
 /* return 0 if OK, != 0 if exception */
@@ -276,7 +443,7 @@ static inline __exception int target_write_u ## size(RISCVCPUState *s, target_ul
     uint32_t tlb_idx;\
     tlb_idx = (addr >> PG_SHIFT) & (TLB_SIZE - 1);\
     if (likely(s->tlb_write[tlb_idx].vaddr == (addr & ~(PG_MASK & ~((size / 8) - 1))))) { \
-        *(uint_type *)(s->tlb_write[tlb_idx].mem_addend + /*(uintptr_t)*/addr) = val;\
+        *(uint_type *)(s->tlb_write[tlb_idx].mem_addend + (uintptr_t)addr) = val;\
         return 0;\
     } else {\
         return target_write_slow(s, addr, val, size_log2);\
@@ -189,14 +189,491 @@ static inline uintx_t glue(mulhsu, XLEN)(intx_t a, uintx_t b)
     case n+(24 << 2): case n+(25 << 2): case n+(26 << 2): case n+(27 << 2): \
     case n+(28 << 2): case n+(29 << 2): case n+(30 << 2): case n+(31 << 2): 
 
-#define GET_PC() (code_ptr + code_to_pc_addend)
+#if XLEN <= 64
+
+#ifdef CONFIG_EXT_C
+/* predecode a compressed instruction into its expanded form, return
+   TRUE if it ends the basic block */
+static BOOL glue(decode_insn_c, XLEN)(DecodedOp *op, uint32_t insn)
+{
+    static const uint8_t alu_ops[8] = {
+        DOP_SUB, DOP_XOR, DOP_OR, DOP_AND,
+#if XLEN >= 64
+        DOP_SUBW, DOP_ADDW,
+#else
+        DOP_GENERIC, DOP_GENERIC,
+#endif
+        DOP_GENERIC, DOP_GENERIC,
+    };
+    uint32_t rd, rs1, rs2, funct3;
+    int32_t imm;
+
+    rd = (insn >> 7) & 0x1f;
+    funct3 = (insn >> 13) & 7;
+    switch(insn & 3) {
+    case 0:
+        rd = ((insn >> 2) & 7) | 8;
+        rs1 = ((insn >> 7) & 7) | 8;
+        switch(funct3) {
+        case 0: /* c.addi4spn */
+            imm = get_field1(insn, 11, 4, 5) |
+                get_field1(insn, 7, 6, 9) |
+                get_field1(insn, 6, 2, 2) |
+                get_field1(insn, 5, 3, 3);
+            if (imm != 0)
+                decoded_op_set(op, DOP_ADDI, rd, 2, 0, imm);
+            break;
+        case 2: /* c.lw */
+            imm = get_field1(insn, 10, 3, 5) |
+                get_field1(insn, 6, 2, 2) |
+                get_field1(insn, 5, 6, 6);
+            decoded_op_set(op, DOP_LW, rd, rs1, 0, imm);
+            break;
+        case 6: /* c.sw */
+            imm = get_field1(insn, 10, 3, 5) |
+                get_field1(insn, 6, 2, 2) |
+                get_field1(insn, 5, 6, 6);
+            decoded_op_set(op, DOP_SW, 0, rs1, rd, imm);
+            break;
+#if XLEN >= 64
+        case 3: /* c.ld */
+            imm = get_field1(insn, 10, 3, 5) |
+                get_field1(insn, 5, 6, 7);
+            decoded_op_set(op, DOP_LD, rd, rs1, 0, imm);
+            break;
+        case 7: /* c.sd */
+            imm = get_field1(insn, 10, 3, 5) |
+                get_field1(insn, 5, 6, 7);
+            decoded_op_set(op, DOP_SD, 0, rs1, rd, imm);
+            break;
+#endif
+        }
+        return FALSE;
+    case 1:
+        switch(funct3) {
+        case 0: /* c.addi/c.nop */
+            imm = sext(get_field1(insn, 12, 5, 5) |
+                       get_field1(insn, 2, 0, 4), 6);
+            decoded_op_set_rd(op, DOP_ADDI, rd, rd, 0, imm);
+            break;
+#if XLEN == 32
+        case 1: /* c.jal */
+            imm = sext(get_field1(insn, 12, 11, 11) | 
+                       get_field1(insn, 11, 4, 4) |
+                       get_field1(insn, 9, 8, 9) |
+                       get_field1(insn, 8, 10, 10) |
+                       get_field1(insn, 7, 6, 6) |
+                       get_field1(insn, 6, 7, 7) |
+                       get_field1(insn, 3, 1, 3) |
+                       get_field1(insn, 2, 5, 5), 12);
+            decoded_op_set(op, DOP_JAL, 1, 0, 0, imm);
+            return TRUE;
+#else
+        case 1: /* c.addiw */
+            imm = sext(get_field1(insn, 12, 5, 5) |
+                       get_field1(insn, 2, 0, 4), 6);
+            decoded_op_set_rd(op, DOP_ADDIW, rd, rd, 0, imm);
+            break;
+#endif
+        case 2: /* c.li */
+            imm = sext(get_field1(insn, 12, 5, 5) |
+                       get_field1(insn, 2, 0, 4), 6);
+            decoded_op_set_rd(op, DOP_LI, rd, 0, 0, imm);
+            break;
+        case 3:
+            if (rd == 2) {
+                /* c.addi16sp */
+                imm = sext(get_field1(insn, 12, 9, 9) |
+                           get_field1(insn, 6, 4, 4) |
+                           get_field1(insn, 5, 6, 6) |
+                           get_field1(insn, 3, 7, 8) |
+                           get_field1(insn, 2, 5, 5), 10);
+                if (imm != 0)
+                    decoded_op_set(op, DOP_ADDI, 2, 2, 0, imm);
+            } else {
+                /* c.lui */
+                imm = sext(get_field1(insn, 12, 17, 17) |
+                           get_field1(insn, 2, 12, 16), 18);
+                decoded_op_set_rd(op, DOP_LI, rd, 0, 0, imm);
+            }
+            break;
+        case 4:
+            rd = ((insn >> 7) & 7) | 8;
+            switch((insn >> 10) & 3) {
+            case 0: /* c.srli */
+            case 1: /* c.srai */
+                imm = get_field1(insn, 12, 5, 5) |
+                    get_field1(insn, 2, 0, 4);
+#if XLEN == 32
+                if (imm & 0x20)
+                    break;
+#endif
+                decoded_op_set(op, (insn & (1 << 10)) ? DOP_SRAI : DOP_SRLI,
+                               rd, rd, 0, imm);
+                break;
+            case 2: /* c.andi */
+                imm = sext(get_field1(insn, 12, 5, 5) |
+                           get_field1(insn, 2, 0, 4), 6);
+                decoded_op_set(op, DOP_ANDI, rd, rd, 0, imm);
+                break;
+            case 3:
+                rs2 = ((insn >> 2) & 7) | 8;
+                funct3 = ((insn >> 5) & 3) | ((insn >> (12 - 2)) & 4);
+                if (alu_ops[funct3] != DOP_GENERIC)
+                    decoded_op_set(op, alu_ops[funct3], rd, rd, rs2, 0);
+                break;
+            }
+            break;
+        case 5: /* c.j */
+            imm = sext(get_field1(insn, 12, 11, 11) | 
+                       get_field1(insn, 11, 4, 4) |
+                       get_field1(insn, 9, 8, 9) |
+                       get_field1(insn, 8, 10, 10) |
+                       get_field1(insn, 7, 6, 6) |
+                       get_field1(insn, 6, 7, 7) |
+                       get_field1(insn, 3, 1, 3) |
+                       get_field1(insn, 2, 5, 5), 12);
+            decoded_op_set(op, DOP_J, 0, 0, 0, imm);
+            return TRUE;
+        case 6: /* c.beqz */
+        case 7: /* c.bnez */
+            rs1 = ((insn >> 7) & 7) | 8;
+            imm = sext(get_field1(insn, 12, 8, 8) | 
+                       get_field1(insn, 10, 3, 4) |
+                       get_field1(insn, 5, 6, 7) |
+                       get_field1(insn, 3, 1, 2) |
+                       get_field1(insn, 2, 5, 5), 9);
+            decoded_op_set(op, funct3 == 6 ? DOP_BEQ : DOP_BNE, 0, rs1, 0, imm);
+            return TRUE;
+        }
+        return FALSE;
+    case 2:
+        rs2 = (insn >> 2) & 0x1f;
+        switch(funct3) {
+        case 0: /* c.slli */
+            imm = get_field1(insn, 12, 5, 5) | rs2;
+#if XLEN == 32
+            if (imm & 0x20)
+                break;
+#endif
+            decoded_op_set_rd(op, DOP_SLLI, rd, rd, 0, imm);
+            break;
+        case 2: /* c.lwsp */
+            imm = get_field1(insn, 12, 5, 5) |
+                (rs2 & (7 << 2)) |
+                get_field1(insn, 2, 6, 7);
+            if (rd != 0)
+                decoded_op_set(op, DOP_LW, rd, 2, 0, imm);
+            break;
+        case 6: /* c.swsp */
+            imm = get_field1(insn, 9, 2, 5) |
+                get_field1(insn, 7, 6, 7);
+            decoded_op_set(op, DOP_SW, 0, 2, rs2, imm);
+            break;
+#if XLEN >= 64
+        case 3: /* c.ldsp */
+            imm = get_field1(insn, 12, 5, 5) |
+                (rs2 & (3 << 3)) |
+                get_field1(insn, 2, 6, 8);
+            if (rd != 0)
+                decoded_op_set(op, DOP_LD, rd, 2, 0, imm);
+            break;
+        case 7: /* c.sdsp */
+            imm = get_field1(insn, 10, 3, 5) |
+                get_field1(insn, 7, 6, 8);
+            decoded_op_set(op, DOP_SD, 0, 2, rs2, imm);
+            break;
+#endif
+        case 4:
+            if (rs2 == 0) {
+                /* c.jr/c.jalr, c.ebreak when rd is x0 */
+                if (rd != 0) {
+                    if (insn & (1 << 12))
+                        decoded_op_set(op, DOP_JALR, 1, rd, 0, 0);
+                    else
+                        decoded_op_set(op, DOP_JR, 0, rd, 0, 0);
+                }
+                return TRUE;
+            } else if (insn & (1 << 12)) {
+                /* c.add */
+                decoded_op_set_rd(op, DOP_ADD, rd, rd, rs2, 0);
+            } else {
+                /* c.mv */
+                decoded_op_set_rd(op, DOP_ADDI, rd, rs2, 0, 0);
+            }
+            break;
+        }
+        return FALSE;
+    }
+    return FALSE;
+}
+#endif /* CONFIG_EXT_C */
+
+/* predecode insn, return TRUE if it ends the basic block. Instructions
+   left as DOP_GENERIC keep their encoding in imm */
+static BOOL glue(decode_insn, XLEN)(DecodedOp *op, uint32_t insn)
+{
+    static const uint8_t branch_ops[8] = {
+        DOP_BEQ, DOP_BNE, DOP_GENERIC, DOP_GENERIC,
+        DOP_BLT, DOP_BGE, DOP_BLTU, DOP_BGEU,
+    };
+    static const uint8_t load_ops[8] = {
+        DOP_LB, DOP_LH, DOP_LW,
+#if XLEN >= 64
+        DOP_LD,
+#else
+        DOP_GENERIC,
+#endif
+        DOP_LBU, DOP_LHU,
+#if XLEN >= 64
+        DOP_LWU,
+#else
+        DOP_GENERIC,
+#endif
+        DOP_GENERIC,
+    };
+    static const uint8_t store_ops[8] = {
+        DOP_SB, DOP_SH, DOP_SW,
+#if XLEN >= 64
+        DOP_SD,
+#else
+        DOP_GENERIC,
+#endif
+        DOP_GENERIC, DOP_GENERIC, DOP_GENERIC, DOP_GENERIC,
+    };
+    static const uint8_t imm_ops[8] = {
+        DOP_ADDI, DOP_SLLI, DOP_SLTI, DOP_SLTIU,
+        DOP_XORI, DOP_SRLI, DOP_ORI, DOP_ANDI,
+    };
+    /* funct3 | (funct7 bit 5) << 3 */
+    static const uint8_t alu_ops[16] = {
+        DOP_ADD, DOP_SLL, DOP_SLT, DOP_SLTU,
+        DOP_XOR, DOP_SRL, DOP_OR, DOP_AND,
+        DOP_SUB, DOP_GENERIC, DOP_GENERIC, DOP_GENERIC,
+        DOP_GENERIC, DOP_SRA, DOP_GENERIC, DOP_GENERIC,
+    };
+    static const uint8_t mul_ops[8] = {
+        DOP_MUL, DOP_MULH, DOP_MULHSU, DOP_MULHU,
+        DOP_DIV, DOP_DIVU, DOP_REM, DOP_REMU,
+    };
+#if XLEN >= 64
+    static const uint8_t alu32_ops[16] = {
+        DOP_ADDW, DOP_SLLW, DOP_GENERIC, DOP_GENERIC,
+        DOP_GENERIC, DOP_SRLW, DOP_GENERIC, DOP_GENERIC,
+        DOP_SUBW, DOP_GENERIC, DOP_GENERIC, DOP_GENERIC,
+        DOP_GENERIC, DOP_SRAW, DOP_GENERIC, DOP_GENERIC,
+    };
+    static const uint8_t mul32_ops[8] = {
+        DOP_MULW, DOP_GENERIC, DOP_GENERIC, DOP_GENERIC,
+        DOP_DIVW, DOP_DIVUW, DOP_REMW, DOP_REMUW,
+    };
+#endif
+    uint32_t opcode, rd, rs1, rs2, funct3;
+    int32_t imm;
+    int dop;
+
+    decoded_op_set(op, DOP_GENERIC, 0, 0, 0, insn);
+    if ((insn & 3) != 3) {
+        op->len = 2;
+#ifdef CONFIG_EXT_C
+        return glue(decode_insn_c, XLEN)(op, insn);
+#else
+        return TRUE;
+#endif
+    }
+    op->len = 4;
+    opcode = insn & 0x7f;
+    rd = (insn >> 7) & 0x1f;
+    rs1 = (insn >> 15) & 0x1f;
+    rs2 = (insn >> 20) & 0x1f;
+    funct3 = (insn >> 12) & 7;
+    switch(opcode) {
+    case 0x37: /* lui */
+        decoded_op_set_rd(op, DOP_LI, rd, 0, 0, (int32_t)(insn & 0xfffff000));
+        break;
+    case 0x17: /* auipc */
+        decoded_op_set_rd(op, DOP_AUIPC, rd, 0, 0,
+                          (int32_t)(insn & 0xfffff000));
+        break;
+    case 0x6f: /* jal */
+        imm = ((insn >> (31 - 20)) & (1 << 20)) |
+            ((insn >> (21 - 1)) & 0x7fe) |
+            ((insn >> (20 - 11)) & (1 << 11)) |
+            (insn & 0xff000);
+        imm = (imm << 11) >> 11;
+        decoded_op_set(op, rd != 0 ? DOP_JAL : DOP_J, rd, 0, 0, imm);
+        return TRUE;
+    case 0x67: /* jalr */
+        imm = (int32_t)insn >> 20;
+        decoded_op_set(op, rd != 0 ? DOP_JALR : DOP_JR, rd, rs1, 0, imm);
+        return TRUE;
+    case 0x63:
+        imm = ((insn >> (31 - 12)) & (1 << 12)) |
+            ((insn >> (25 - 5)) & 0x7e0) |
+            ((insn >> (8 - 1)) & 0x1e) |
+            ((insn << (11 - 7)) & (1 << 11));
+        imm = (imm << 19) >> 19;
+        if (branch_ops[funct3] != DOP_GENERIC)
+            decoded_op_set(op, branch_ops[funct3], 0, rs1, rs2, imm);
+        return TRUE;
+    case 0x03: /* load */
+        /* loads to x0 still access memory */
+        if (load_ops[funct3] != DOP_GENERIC && rd != 0)
+            decoded_op_set(op, load_ops[funct3], rd, rs1, 0,
+                           (int32_t)insn >> 20);
+        break;
+    case 0x23: /* store */
+        imm = rd | ((insn >> (25 - 5)) & 0xfe0);
+        imm = (imm << 20) >> 20;
+        if (store_ops[funct3] != DOP_GENERIC)
+            decoded_op_set(op, store_ops[funct3], 0, rs1, rs2, imm);
+        break;
+    case 0x13:
+        imm = (int32_t)insn >> 20;
+        dop = imm_ops[funct3];
+        if (funct3 == 1) {
+            if ((imm & ~(XLEN - 1)) != 0)
+                break;
+        } else if (funct3 == 5) {
+            if ((imm & ~((XLEN - 1) | 0x400)) != 0)
+                break;
+            if (imm & 0x400)
+                dop = DOP_SRAI;
+            imm &= XLEN - 1;
+        }
+        decoded_op_set_rd(op, dop, rd, rs1, 0, imm);
+        break;
+#if XLEN >= 64
+    case 0x1b: /* OP-IMM-32 */
+        imm = (int32_t)insn >> 20;
+        if (funct3 == 0) {
+            dop = DOP_ADDIW;
+        } else if (funct3 == 1) {
+            if ((imm & ~31) != 0)
+                break;
+            dop = DOP_SLLIW;
+        } else if (funct3 == 5) {
+            if ((imm & ~(31 | 0x400)) != 0)
+                break;
+            dop = (imm & 0x400) ? DOP_SRAIW : DOP_SRLIW;
+            imm &= 31;
+        } else {
+            break;
+        }
+        decoded_op_set_rd(op, dop, rd, rs1, 0, imm);
+        break;
+#endif
+    case 0x33:
+        imm = insn >> 25;
+        if (imm == 1)
+            dop = mul_ops[funct3];
+        else if ((imm & ~0x20) == 0)
+            dop = alu_ops[funct3 | ((insn >> (30 - 3)) & (1 << 3))];
+        else
+            break;
+        if (dop != DOP_GENERIC)
+            decoded_op_set_rd(op, dop, rd, rs1, rs2, 0);
+        break;
+#if XLEN >= 64
+    case 0x3b: /* OP-32 */
+        imm = insn >> 25;
+        if (imm == 1)
+            dop = mul32_ops[funct3];
+        else if ((imm & ~0x20) == 0)
+            dop = alu32_ops[funct3 | ((insn >> (30 - 3)) & (1 << 3))];
+        else
+            break;
+        if (dop != DOP_GENERIC)
+            decoded_op_set_rd(op, dop, rd, rs1, rs2, 0);
+        break;
+#endif
+    case 0x73: /* system */
+    case 0x0f: /* misc-mem, fence.i must see the flushed decode cache */
+        return TRUE;
+    }
+    return FALSE;
+}
+
+/* return the block predecoded from physical address paddr, whose code
+   is at [ptr, end), decoding it on a miss. NULL if the first
+   instruction is not entirely in the range */
+static DecodedBlock *glue(decode_cache_lookup, XLEN)(RISCVCPUState *s,
+                                                   target_ulong paddr,
+                                                   uint8_t *ptr, uint8_t *end)
+{
+    DecodedBlock *b;
+    DecodedPage *dp;
+    DecodedOp *op, *op_end;
+    uint8_t *start;
+    uint32_t insn;
+    BOOL stop;
+
+    b = decode_block_entry(s, paddr);
+    dp = decode_page_entry(s, paddr);
+    if (likely(b->paddr == paddr && dp->paddr == (paddr & ~PG_MASK) &&
+               b->generation == dp->generation && b->xlen == XLEN)) {
+        s->stats.decode_cache_hits++;
+        return b;
+    }
+    if (s->decode_ops_used + DECODE_BLOCK_MAX_OPS > DECODE_CACHE_OPS)
+        decode_cache_flush(s);
+    op = s->decode_ops + s->decode_ops_used;
+    op_end = op + DECODE_BLOCK_MAX_OPS;
+    start = ptr;
+    while (op < op_end && ptr + 2 <= end) {
+        insn = *(uint16_t *)ptr;
+        if ((insn & 3) == 3) {
+            if (ptr + 4 > end)
+                break;
+            insn = get_insn32(ptr);
+        }
+        stop = glue(decode_insn, XLEN)(op, insn);
+        ptr += op->len;
+        op++;
+        if (stop)
+            break;
+    }
+    if (ptr == start)
+        return NULL;
+    dp = decode_cache_add_page(s, paddr, start);
+    b->paddr = paddr;
+    b->ops = s->decode_ops + s->decode_ops_used;
+    b->generation = dp->generation;
+    b->size = ptr - start;
+    b->xlen = XLEN;
+    s->decode_ops_used = op - s->decode_ops;
+    s->stats.decode_cache_misses++;
+    return b;
+}
+
+#endif /* XLEN <= 64 */
+
+#define GET_PC() (target_ulong)((uintptr_t)code_ptr + code_to_pc_addend)
 #define GET_INSN_COUNTER() (insn_counter_addend - n_cycles)
 
 #define C_NEXT_INSN code_ptr += 2; break
 #define NEXT_INSN code_ptr += 4; break
+#ifdef CONFIG_THREADED_DISPATCH
+/* each op jumps to the handler of the next one of the block, so that
+   the host predicts the indirect jumps per handler */
+#define DOP_DISPATCH() goto *dop_labels[uop->op];
+#define DOP_CASE(op) dop_ ## op
+#define DOP_LABEL(op) [DOP_ ## op] = &&dop_ ## op
+#define DOP_NEXT_INSN code_ptr += uop->len;          \
+    if (likely(code_ptr < code_end)) {              \
+        --n_cycles;                                 \
+        uop = dop++;                                \
+        goto *dop_labels[uop->op];                  \
+    }                                               \
+    continue
+#else
+#define DOP_DISPATCH() switch(uop->op)
+#define DOP_CASE(op) case DOP_ ## op
+#define DOP_NEXT_INSN code_ptr += uop->len; continue
+#endif
 #define JUMP_INSN do {   \
-        code_ptr = 0;           \
-        code_end = 0;           \
+        code_ptr = NULL;           \
+        code_end = NULL;           \
         code_to_pc_addend = s->pc; \
         goto jump_insn;            \
     } while (0)
@@ -205,12 +682,39 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                                                    int n_cycles)
 {
     uint32_t opcode, insn, rd, rs1, rs2, funct3;
-    uint32_t insnvmm;
     int32_t imm, cond, err;
     target_ulong addr, val, val2;
 #ifndef USE_GLOBAL_VARIABLES
-    uint32_t code_ptr, code_end;
+    uint8_t *code_ptr, *code_end;
     target_ulong code_to_pc_addend;
+#endif
+    /* next op of the predecoded block code_ptr is in, NULL when the
+       code is decoded as it is fetched */
+    DecodedOp *dop;
+#if XLEN <= 64 && defined(CONFIG_THREADED_DISPATCH)
+    /* the ops the decoder does not emit for this XLEN are left NULL */
+    static const void *const dop_labels[DOP_COUNT] = {
+        DOP_LABEL(GENERIC), DOP_LABEL(NOP), DOP_LABEL(LI), DOP_LABEL(AUIPC),
+        DOP_LABEL(J), DOP_LABEL(JAL), DOP_LABEL(JR), DOP_LABEL(JALR),
+        DOP_LABEL(BEQ), DOP_LABEL(BNE), DOP_LABEL(BLT), DOP_LABEL(BGE),
+        DOP_LABEL(BLTU), DOP_LABEL(BGEU), DOP_LABEL(LB), DOP_LABEL(LH),
+        DOP_LABEL(LW), DOP_LABEL(LBU), DOP_LABEL(LHU), DOP_LABEL(SB),
+        DOP_LABEL(SH), DOP_LABEL(SW), DOP_LABEL(ADDI), DOP_LABEL(SLTI),
+        DOP_LABEL(SLTIU), DOP_LABEL(XORI), DOP_LABEL(ORI), DOP_LABEL(ANDI),
+        DOP_LABEL(SLLI), DOP_LABEL(SRLI), DOP_LABEL(SRAI), DOP_LABEL(ADD),
+        DOP_LABEL(SUB), DOP_LABEL(SLL), DOP_LABEL(SLT), DOP_LABEL(SLTU),
+        DOP_LABEL(XOR), DOP_LABEL(SRL), DOP_LABEL(SRA), DOP_LABEL(OR),
+        DOP_LABEL(AND),
+        DOP_LABEL(MUL), DOP_LABEL(MULH), DOP_LABEL(MULHSU), DOP_LABEL(MULHU),
+        DOP_LABEL(DIV), DOP_LABEL(DIVU), DOP_LABEL(REM), DOP_LABEL(REMU),
+#if XLEN >= 64
+        DOP_LABEL(LWU), DOP_LABEL(LD), DOP_LABEL(SD),
+        DOP_LABEL(ADDIW), DOP_LABEL(SLLIW), DOP_LABEL(SRLIW),
+        DOP_LABEL(SRAIW), DOP_LABEL(ADDW), DOP_LABEL(SUBW), DOP_LABEL(SLLW),
+        DOP_LABEL(SRLW), DOP_LABEL(SRAW), DOP_LABEL(MULW), DOP_LABEL(DIVW),
+        DOP_LABEL(DIVUW), DOP_LABEL(REMW), DOP_LABEL(REMUW),
+#endif
+    };
 #endif
     uint64_t insn_counter_addend;
 #if FLEN > 0
@@ -232,9 +736,11 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
     s->pending_exception = -1;
     n_cycles++;
     /* Note: we assume NULL is represented as a zero number */
-    code_ptr = 0;
-    code_end = 0;
+    code_ptr = NULL;
+    code_end = NULL;
     code_to_pc_addend = s->pc;
+    dop = NULL;
+    insn = 0;
     
     /* we use a single execution loop to keep a simple control flow
        for emscripten */
@@ -258,10 +764,18 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
 
 
         --n_cycles;
-        if (unlikely(code_ptr >= code_end))
-        {
+        if (unlikely(code_ptr >= code_end)) {
+            uint32_t tlb_idx;
+            uint16_t insn_high;
+            uint8_t *ptr, *end;
+            vmTable_t *page;
+            target_ulong paddr;
+            DecodedBlock *b;
+
             s->pc = GET_PC();
-            
+            /* we test n_cycles only between blocks so that timer
+               interrupts only happen between the blocks. It is
+               important to reduce the translated code size. */
             if (unlikely(n_cycles <= 0))
                 goto the_end;
 
@@ -273,180 +787,315 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
             }
 
             addr = s->pc;
+            tlb_idx = (addr >> PG_SHIFT) & (TLB_SIZE - 1);
+            if (likely(s->tlb_code[tlb_idx].vaddr == (addr & ~PG_MASK))) {
+                /* TLB match */ 
+                ptr = (uint8_t *)(s->tlb_code[tlb_idx].mem_addend +
+                                  (uintptr_t)addr);
+                end = ptr + (PG_MASK + 1 - (addr & PG_MASK));
+                page = s->tlb_code[tlb_idx].page;
+                paddr = s->tlb_code[tlb_idx].paddr + (addr & PG_MASK);
+            } else {
+                if (unlikely(target_read_insn_slow(s, &ptr, &end, &page,
+                                                   &paddr, addr)))
+                    goto mmu_exception;
+            }
+            /* the VMM page must stay resident while code_ptr points
+               into it */
+            set_code_page(s, page);
+            code_ptr = ptr;
+            code_to_pc_addend = addr - (uintptr_t)code_ptr;
+            b = NULL;
+#if XLEN <= 64
+            if (paddr != (target_ulong)-1)
+                b = glue(decode_cache_lookup, XLEN)(s, paddr, ptr, end);
+#endif
+            if (likely(b != NULL)) {
+                /* the block ends before the end of the page */
+                dop = b->ops;
+                code_end = ptr + b->size;
+            } else {
+                dop = NULL;
+                code_end = end - 2;
+                if (unlikely(code_ptr >= code_end)) {
+                    /* instruction is potentially half way between two
+                       pages ? */
+                    insn = *(uint16_t *)code_ptr;
+                    if ((insn & 3) == 3) {
+                        /* instruction is half way between two pages */
+                        if (unlikely(target_read_insn_u16(s, &insn_high, addr + 2)))
+                            goto mmu_exception;
+                        insn |= insn_high << 16;
+                    }
+                } else {
+                    insn = get_insn32(code_ptr);
+                }
+            }
+        } else if (!dop) {
+            /* fast path */
+            insn = get_insn32(code_ptr);
+        }
 
-            uint32_t vmm_address;
-            if (unlikely(target_read_insn_slow_vmm(s, &vmm_address,addr)))
+#if XLEN <= 64
+        if (likely(dop != NULL)) {
+            DecodedOp *uop = dop++;
+            DOP_DISPATCH() {
+            DOP_CASE(NOP):
+                DOP_NEXT_INSN;
+            DOP_CASE(LI):
+                s->reg[uop->rd] = uop->imm;
+                DOP_NEXT_INSN;
+            DOP_CASE(AUIPC):
+                s->reg[uop->rd] = (intx_t)(GET_PC() + uop->imm);
+                DOP_NEXT_INSN;
+            DOP_CASE(JAL):
+                s->reg[uop->rd] = GET_PC() + uop->len;
+                /* fall through */
+            DOP_CASE(J):
+            dop_branch:
+                s->pc = (intx_t)(GET_PC() + uop->imm);
+                JUMP_INSN;
+            DOP_CASE(JALR):
+                val = GET_PC() + uop->len;
+                s->pc = (intx_t)(s->reg[uop->rs1] + uop->imm) & ~1;
+                s->reg[uop->rd] = val;
+                JUMP_INSN;
+            DOP_CASE(JR):
+                s->pc = (intx_t)(s->reg[uop->rs1] + uop->imm) & ~1;
+                JUMP_INSN;
+            DOP_CASE(BEQ):
+                if (s->reg[uop->rs1] == s->reg[uop->rs2])
+                    goto dop_branch;
+                DOP_NEXT_INSN;
+            DOP_CASE(BNE):
+                if (s->reg[uop->rs1] != s->reg[uop->rs2])
+                    goto dop_branch;
+                DOP_NEXT_INSN;
+            DOP_CASE(BLT):
+                if ((target_long)s->reg[uop->rs1] < (target_long)s->reg[uop->rs2])
+                    goto dop_branch;
+                DOP_NEXT_INSN;
+            DOP_CASE(BGE):
+                if ((target_long)s->reg[uop->rs1] >= (target_long)s->reg[uop->rs2])
+                    goto dop_branch;
+                DOP_NEXT_INSN;
+            DOP_CASE(BLTU):
+                if (s->reg[uop->rs1] < s->reg[uop->rs2])
+                    goto dop_branch;
+                DOP_NEXT_INSN;
+            DOP_CASE(BGEU):
+                if (s->reg[uop->rs1] >= s->reg[uop->rs2])
+                    goto dop_branch;
+                DOP_NEXT_INSN;
+            DOP_CASE(LB):
+                {
+                    uint8_t rval;
+                    if (target_read_u8(s, &rval, s->reg[uop->rs1] + uop->imm))
                         goto mmu_exception;
-            
-            code_ptr = vmm_address;
-            code_end = vmm_address + (PG_MASK - 1 - ( addr & PG_MASK));
-            code_to_pc_addend =  addr -code_ptr;
-
-            // printf("code ptr 0x%" PRIX32 " end 0x%" PRIX32 " addend 0x%" PRIX32"\r\n", code_ptr, code_end, code_to_pc_addend );
-
-            if (unlikely(code_ptr >= code_end)) {
-                /* instruction is potentially half way between two
-                   pages ? */
-                // printf("half!\r\n");
-                uint32_t full_insn = get_vmm_insn32(s, vmm_address);;
-                insnvmm = (uint16_t )full_insn;
-                // insnvmm = vmmptr;
-                // insn = (uint16_t)code_ptr;
-                if ((insnvmm & 3) == 3) {
-                    // printf("half vmm insn 0x%" PRIX32 " at 0x%" PRIX32 "\r\n", full_insn, vmm_address);
-                    /* instruction is half way between two pages */
-                    uint32_t vmm_address_high;
-
-
-                    if (unlikely(target_read_insn_slow_vmm(s, &vmm_address_high, GET_PC() + 2)))
+                    s->reg[uop->rd] = (int8_t)rval;
+                }
+                DOP_NEXT_INSN;
+            DOP_CASE(LH):
+                {
+                    uint16_t rval;
+                    if (target_read_u16(s, &rval, s->reg[uop->rs1] + uop->imm))
                         goto mmu_exception;
-                    uint32_t other_half_insn = get_vmm_insn32(s, vmm_address_high);
-                    // printf("other half vmm insn 0x%" PRIX32 " at 0x%" PRIX32 "\r\n", other_half_insn, vmm_address_high);
-                    insnvmm |= ((uint16_t)other_half_insn) << 16;
+                    s->reg[uop->rd] = (int16_t)rval;
                 }
-            }else{
-                insnvmm = get_vmm_insn32(s, code_ptr);
+                DOP_NEXT_INSN;
+            DOP_CASE(LW):
+                {
+                    uint32_t rval;
+                    if (target_read_u32(s, &rval, s->reg[uop->rs1] + uop->imm))
+                        goto mmu_exception;
+                    s->reg[uop->rd] = (int32_t)rval;
+                }
+                DOP_NEXT_INSN;
+            DOP_CASE(LBU):
+                {
+                    uint8_t rval;
+                    if (target_read_u8(s, &rval, s->reg[uop->rs1] + uop->imm))
+                        goto mmu_exception;
+                    s->reg[uop->rd] = rval;
+                }
+                DOP_NEXT_INSN;
+            DOP_CASE(LHU):
+                {
+                    uint16_t rval;
+                    if (target_read_u16(s, &rval, s->reg[uop->rs1] + uop->imm))
+                        goto mmu_exception;
+                    s->reg[uop->rd] = rval;
+                }
+                DOP_NEXT_INSN;
+#if XLEN >= 64
+            DOP_CASE(LWU):
+                {
+                    uint32_t rval;
+                    if (target_read_u32(s, &rval, s->reg[uop->rs1] + uop->imm))
+                        goto mmu_exception;
+                    s->reg[uop->rd] = rval;
+                }
+                DOP_NEXT_INSN;
+            DOP_CASE(LD):
+                {
+                    uint64_t rval;
+                    if (target_read_u64(s, &rval, s->reg[uop->rs1] + uop->imm))
+                        goto mmu_exception;
+                    s->reg[uop->rd] = (int64_t)rval;
+                }
+                DOP_NEXT_INSN;
+#endif
+            DOP_CASE(SB):
+                if (target_write_u8(s, s->reg[uop->rs1] + uop->imm, s->reg[uop->rs2]))
+                    goto mmu_exception;
+                DOP_NEXT_INSN;
+            DOP_CASE(SH):
+                if (target_write_u16(s, s->reg[uop->rs1] + uop->imm, s->reg[uop->rs2]))
+                    goto mmu_exception;
+                DOP_NEXT_INSN;
+            DOP_CASE(SW):
+                if (target_write_u32(s, s->reg[uop->rs1] + uop->imm, s->reg[uop->rs2]))
+                    goto mmu_exception;
+                DOP_NEXT_INSN;
+#if XLEN >= 64
+            DOP_CASE(SD):
+                if (target_write_u64(s, s->reg[uop->rs1] + uop->imm, s->reg[uop->rs2]))
+                    goto mmu_exception;
+                DOP_NEXT_INSN;
+#endif
+            DOP_CASE(ADDI):
+                s->reg[uop->rd] = (intx_t)(s->reg[uop->rs1] + uop->imm);
+                DOP_NEXT_INSN;
+            DOP_CASE(SLTI):
+                s->reg[uop->rd] = (target_long)s->reg[uop->rs1] < (target_long)uop->imm;
+                DOP_NEXT_INSN;
+            DOP_CASE(SLTIU):
+                s->reg[uop->rd] = s->reg[uop->rs1] < (target_ulong)uop->imm;
+                DOP_NEXT_INSN;
+            DOP_CASE(XORI):
+                s->reg[uop->rd] = s->reg[uop->rs1] ^ uop->imm;
+                DOP_NEXT_INSN;
+            DOP_CASE(ORI):
+                s->reg[uop->rd] = s->reg[uop->rs1] | uop->imm;
+                DOP_NEXT_INSN;
+            DOP_CASE(ANDI):
+                s->reg[uop->rd] = s->reg[uop->rs1] & uop->imm;
+                DOP_NEXT_INSN;
+            DOP_CASE(SLLI):
+                s->reg[uop->rd] = (intx_t)(s->reg[uop->rs1] << uop->imm);
+                DOP_NEXT_INSN;
+            DOP_CASE(SRLI):
+                s->reg[uop->rd] = (intx_t)((uintx_t)s->reg[uop->rs1] >> uop->imm);
+                DOP_NEXT_INSN;
+            DOP_CASE(SRAI):
+                s->reg[uop->rd] = (intx_t)s->reg[uop->rs1] >> uop->imm;
+                DOP_NEXT_INSN;
+            DOP_CASE(ADD):
+                s->reg[uop->rd] = (intx_t)(s->reg[uop->rs1] + s->reg[uop->rs2]);
+                DOP_NEXT_INSN;
+            DOP_CASE(SUB):
+                s->reg[uop->rd] = (intx_t)(s->reg[uop->rs1] - s->reg[uop->rs2]);
+                DOP_NEXT_INSN;
+            DOP_CASE(SLL):
+                s->reg[uop->rd] = (intx_t)(s->reg[uop->rs1] << (s->reg[uop->rs2] & (XLEN - 1)));
+                DOP_NEXT_INSN;
+            DOP_CASE(SLT):
+                s->reg[uop->rd] = (target_long)s->reg[uop->rs1] < (target_long)s->reg[uop->rs2];
+                DOP_NEXT_INSN;
+            DOP_CASE(SLTU):
+                s->reg[uop->rd] = s->reg[uop->rs1] < s->reg[uop->rs2];
+                DOP_NEXT_INSN;
+            DOP_CASE(XOR):
+                s->reg[uop->rd] = s->reg[uop->rs1] ^ s->reg[uop->rs2];
+                DOP_NEXT_INSN;
+            DOP_CASE(SRL):
+                s->reg[uop->rd] = (intx_t)((uintx_t)s->reg[uop->rs1] >> (s->reg[uop->rs2] & (XLEN - 1)));
+                DOP_NEXT_INSN;
+            DOP_CASE(SRA):
+                s->reg[uop->rd] = (intx_t)s->reg[uop->rs1] >> (s->reg[uop->rs2] & (XLEN - 1));
+                DOP_NEXT_INSN;
+            DOP_CASE(OR):
+                s->reg[uop->rd] = s->reg[uop->rs1] | s->reg[uop->rs2];
+                DOP_NEXT_INSN;
+            DOP_CASE(AND):
+                s->reg[uop->rd] = s->reg[uop->rs1] & s->reg[uop->rs2];
+                DOP_NEXT_INSN;
+            DOP_CASE(MUL):
+                s->reg[uop->rd] = (intx_t)((intx_t)s->reg[uop->rs1] * (intx_t)s->reg[uop->rs2]);
+                DOP_NEXT_INSN;
+            DOP_CASE(MULH):
+                s->reg[uop->rd] = (intx_t)glue(mulh, XLEN)(s->reg[uop->rs1], s->reg[uop->rs2]);
+                DOP_NEXT_INSN;
+            DOP_CASE(MULHSU):
+                s->reg[uop->rd] = (intx_t)glue(mulhsu, XLEN)(s->reg[uop->rs1], s->reg[uop->rs2]);
+                DOP_NEXT_INSN;
+            DOP_CASE(MULHU):
+                s->reg[uop->rd] = (intx_t)glue(mulhu, XLEN)(s->reg[uop->rs1], s->reg[uop->rs2]);
+                DOP_NEXT_INSN;
+            DOP_CASE(DIV):
+                s->reg[uop->rd] = glue(div, XLEN)(s->reg[uop->rs1], s->reg[uop->rs2]);
+                DOP_NEXT_INSN;
+            DOP_CASE(DIVU):
+                s->reg[uop->rd] = (intx_t)glue(divu, XLEN)(s->reg[uop->rs1], s->reg[uop->rs2]);
+                DOP_NEXT_INSN;
+            DOP_CASE(REM):
+                s->reg[uop->rd] = glue(rem, XLEN)(s->reg[uop->rs1], s->reg[uop->rs2]);
+                DOP_NEXT_INSN;
+            DOP_CASE(REMU):
+                s->reg[uop->rd] = (intx_t)glue(remu, XLEN)(s->reg[uop->rs1], s->reg[uop->rs2]);
+                DOP_NEXT_INSN;
+#if XLEN >= 64
+            DOP_CASE(ADDIW):
+                s->reg[uop->rd] = (int32_t)(s->reg[uop->rs1] + uop->imm);
+                DOP_NEXT_INSN;
+            DOP_CASE(SLLIW):
+                s->reg[uop->rd] = (int32_t)(s->reg[uop->rs1] << uop->imm);
+                DOP_NEXT_INSN;
+            DOP_CASE(SRLIW):
+                s->reg[uop->rd] = (int32_t)((uint32_t)s->reg[uop->rs1] >> uop->imm);
+                DOP_NEXT_INSN;
+            DOP_CASE(SRAIW):
+                s->reg[uop->rd] = (int32_t)s->reg[uop->rs1] >> uop->imm;
+                DOP_NEXT_INSN;
+            DOP_CASE(ADDW):
+                s->reg[uop->rd] = (int32_t)(s->reg[uop->rs1] + s->reg[uop->rs2]);
+                DOP_NEXT_INSN;
+            DOP_CASE(SUBW):
+                s->reg[uop->rd] = (int32_t)(s->reg[uop->rs1] - s->reg[uop->rs2]);
+                DOP_NEXT_INSN;
+            DOP_CASE(SLLW):
+                s->reg[uop->rd] = (int32_t)((uint32_t)s->reg[uop->rs1] << (s->reg[uop->rs2] & 31));
+                DOP_NEXT_INSN;
+            DOP_CASE(SRLW):
+                s->reg[uop->rd] = (int32_t)((uint32_t)s->reg[uop->rs1] >> (s->reg[uop->rs2] & 31));
+                DOP_NEXT_INSN;
+            DOP_CASE(SRAW):
+                s->reg[uop->rd] = (int32_t)s->reg[uop->rs1] >> (s->reg[uop->rs2] & 31);
+                DOP_NEXT_INSN;
+            DOP_CASE(MULW):
+                s->reg[uop->rd] = (int32_t)((int32_t)s->reg[uop->rs1] * (int32_t)s->reg[uop->rs2]);
+                DOP_NEXT_INSN;
+            DOP_CASE(DIVW):
+                s->reg[uop->rd] = div32(s->reg[uop->rs1], s->reg[uop->rs2]);
+                DOP_NEXT_INSN;
+            DOP_CASE(DIVUW):
+                s->reg[uop->rd] = (int32_t)divu32(s->reg[uop->rs1], s->reg[uop->rs2]);
+                DOP_NEXT_INSN;
+            DOP_CASE(REMW):
+                s->reg[uop->rd] = rem32(s->reg[uop->rs1], s->reg[uop->rs2]);
+                DOP_NEXT_INSN;
+            DOP_CASE(REMUW):
+                s->reg[uop->rd] = (int32_t)remu32(s->reg[uop->rs1], s->reg[uop->rs2]);
+                DOP_NEXT_INSN;
+#endif
+            DOP_CASE(GENERIC):
+                ;
             }
-        }else{
-            insnvmm = get_vmm_insn32(s, code_ptr);
+            /* decoded again below */
+            insn = uop->imm;
         }
+#endif
 
-        insn = insnvmm;
-
-
-        // printf("Executing 0x%"  PRIX32 " \r\n", code_ptr);
-        // --n_cycles;
-        // if (unlikely(code_ptr >= code_end)) {
-        //     if (display_cycle){
-        //         printf("code ptr1 0x%p code end 0x%p\r\n", code_ptr, code_end);
-        //     }
-        //     // uint32_t tlb_idx;
-        //     uint16_t insn_high;
-        //     // uint16_t insn_high_vmm;
-        //     target_ulong addr;
-        //     uint8_t *ptr;
-        //     // uint8_t *vmmptr;
-            
-        //     s->pc = GET_PC();
-        //     if (display_cycle){
-        //      printf("s->pc 0x%" PRIX32 "\r\n", GET_PC());
-        //     }
-        //     /* we test n_cycles only between blocks so that timer
-        //        interrupts only happen between the blocks. It is
-        //        important to reduce the translated code size. */
-        //     if (unlikely(n_cycles <= 0))
-        //         goto the_end;
-
-        //     /* check pending interrupts */
-        //     if (unlikely((s->mip & s->mie) != 0)) {
-        //         if (raise_interrupt(s)) {
-        //             goto the_end;
-        //         }
-        //     }
-    
-        //     addr = s->pc;
-        //     // tlb_idx = (addr >> PG_SHIFT) & (TLB_SIZE - 1);
-        //     // if (likely(s->tlb_code[tlb_idx].vaddr == (addr & ~PG_MASK))) {
-        //     //     /* TLB match */ 
-        //     //     ptr = (uint8_t *)(s->tlb_code[tlb_idx].mem_addend +
-        //     //                       (uintptr_t)addr);
-        //     //     printf("from tlb\r\n");
-        //     // } else {
-        //         if (unlikely(target_read_insn_slow(s, &ptr, addr)))
-        //             goto mmu_exception;
-        //         // if (unlikely(target_read_insn_slow_vmm(s, &vmmptr, addr)))
-        //         //     goto mmu_exception;
-        //         if (display_cycle){
-        //             printf("from insn\r\n");
-        //         }
-        //     // }
-        //     code_ptr = ptr;
-        //     if (display_cycle){
-        //         printf("setting next code ptr to 0x%p \r\n", code_ptr);
-        //     }
-        //     code_end = ptr + (PG_MASK - 1 - (addr & PG_MASK));
-        //     code_to_pc_addend = addr - (uintptr_t)code_ptr;
-
-        //     if (display_cycle){
-        //         printf("code ptr2 0x%p code end 0x%p\r\n", code_ptr, code_end);
-        //     }
-        //     if (unlikely(code_ptr >= code_end)) {
-        //         /* instruction is potentially half way between two
-        //            pages ? */
-        //         insn = *(uint16_t *)code_ptr;
-        //         // insnvmm = vmmptr;
-        //         // insn = (uint16_t)code_ptr;
-        //         if ((insn & 3) == 3) {
-        //             /* instruction is half way between two pages */
-        //             if (unlikely(target_read_insn_u16(s, &insn_high, addr + 2)))
-        //                 goto mmu_exception;
-        //             insn |= insn_high << 16;
-        //         }
-        //         // if ((insnvmm & 3) == 3){
-        //         //     if (unlikely(target_read_insn_u16_vmm(s, &insn_high_vmm, addr+2)))
-        //         //         goto mmu_exception;
-        //         //     insnvmm |= insn_high_vmm << 16;
-        //         // }
-
-        //         // if (insn != insnvmm){
-        //                 // printf("insn1 0x%" PRIX32 " != 0x%" PRIX32"\r\n", insn, insnvmm);
-        //             if (display_cycle){
-        //                 printf("Load1 Inst32 0x%p 0x%" PRIX32 " \r\n", code_ptr, insn);
-        //             }
-        //         // }
-        //     } else {
-        //         // printf("code ptr3 0x%" PRIX32" code end 0x%" PRIX32"\r\n", code_ptr, code_end);
-        //         // PhysMemoryRange *pr = get_phys_mem_range(s->mem_map, code_ptr);
-        //         // assert(pr);
-        //         // printf("loading code from address 0x%" PRIx64 "\r\n", (uint64_t)code_ptr - pr->addr);
-        //         // printf("loading code from address 1 0x%" PRIx64 "\r\n", (uint64_t)(uint32_t)code_ptr );
-
-        //         // uint32_t insn1 = get_vmm_insn32(s, code_ptr);
-
-        //         // assert(insn == insn1);
-        //         insn = get_insn32(code_ptr);
-        //         // insnvmm = get_vmm_insn32(s,s->pc);
-        //         // if (insn != insnvmm){
-        //         //     printf("insn2 0x%" PRIX32 " != 0x%" PRIX32"\r\n", insn, insnvmm);
-        //         // }
-        //         // insn = get_vmm_insn32(s, (uint32_t)code_ptr);
-        //     //     cc++;
-        //     //     if (cc % 1000 == 0){
-        //         if (display_cycle){
-        //             printf("Load2 Inst32 0x%p 0x%" PRIX32 " \r\n", code_ptr, insn);
-        //         }
-        //     //     }
-        //     }
-        // } else {
-        //     // printf("code ptr4 0x%" PRIX32" code end 0x%" PRIX32"\r\n", code_ptr, code_end);
-        //     // PhysMemoryRange *pr = get_phys_mem_range(s->mem_map, code_ptr);
-        //     // assert(pr);
-        //     // printf("loading code from address 0x%" PRIx64 "\r\n", (uint64_t)code_ptr - pr->addr);
-        //     // printf("loading code from address 2 0x%" PRIx64 "\r\n", (uint64_t)(uint32_t)code_ptr );
-        //     /* fast path */
-        //     // uint32_t insn1 = get_vmm_insn32(s, code_ptr);
-        //     // assert(insn == insn1);
-        //     insn = get_insn32(code_ptr);
-        //     // insnvmm = get_vmm_insn32(s,code_ptr - pr->phys_mem);
-        //     // if (insn != insnvmm){
-        //     //     printf("insn3 0x%" PRIX32 " != 0x%" PRIX32"\r\n", insn, insnvmm);
-        //     // }
-        //     // insn = get_vmm_insn32(s, (uint32_t)code_ptr);
-
-        //     //     cc++;
-        //     //     if (cc % 1000 == 0){
-        //         if (display_cycle){
-        //             printf("Load3 Inst32 0x%p 0x%" PRIX32 " \r\n", code_ptr, insn);
-        //         }
-        //     //     }
-        // }
-        
-        // {
-           
-        //     if (insnvmm != insn){
-        //         printf("insn vmm 0x%" PRIX32 " != 0x%" PRIX32" at 0x%p\r\n", insn, insnvmm, GET_PC());
-        //     }
-        // }
 
 #if 1
         if (1) {
@@ -1518,6 +2167,12 @@ static uint32_t ccc = 0;
                         } else {
                             tlb_flush_vaddr(s, s->reg[rs1]);
                         }
+                        /* only the ASID tagged translations are flushed
+                           selectively, by address and ASID, x0 is all of them */
+                        asid_tlb_flush(s, rs1 == 0 ? (target_ulong)-1 : s->reg[rs1],
+                                       rs2 == 0 ? -1 : (int)(s->reg[rs2] & SATP_ASID_MASK));
+                        /* the page tables may have changed at any level */
+                        ptw_cache_flush(s);
                         /* the current code TLB may have been flushed */
                         s->pc = GET_PC() + 4;
                         JUMP_INSN;
@@ -1541,6 +2196,9 @@ static uint32_t ccc = 0;
             case 1: /* fence.i */
                 if (insn != 0x0000100f)
                     goto illegal_insn;
+                /* it ends the predecoded block, so no op of the
+                   flushed cache is executed after it */
+                decode_cache_flush(s);
                 break;
 #if XLEN >= 128
             case 2: /* lq */
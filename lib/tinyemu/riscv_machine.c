@@ -31,6 +31,7 @@
 #include <errno.h>
 #include <unistd.h>
 #include <time.h>
+#include <sys/stat.h>
 
 #include "cutils.h"
 #include "iomem.h"
@@ -48,6 +49,7 @@ typedef struct RISCVMachine {
     int max_xlen;
     RISCVCPUState *cpu_state;
     uint64_t ram_size;
+    BOOL print_stats;
     /* RTC */
     BOOL rtc_real_time;
     uint64_t rtc_start_time;
@@ -62,8 +64,24 @@ typedef struct RISCVMachine {
     VIRTIODevice *mouse_dev;
 
     int virtio_count;
+    VIRTIODevice *virtio_dev[31]; /* one per PLIC IRQ */
 } RISCVMachine;
 
+/* machine snapshot file: the magic followed by RISCVMachineSnapshot, the CPU
+   state and the state of each virtio device, every RAM range is saved next
+   to it as <snapshot>.0x<address> */
+#define RISCV_SNAPSHOT_MAGIC "RVSNAP01"
+
+typedef struct {
+    uint32_t max_xlen;
+    uint32_t virtio_count;
+    uint64_t ram_size;
+    uint64_t rtc_time;
+    uint64_t timecmp;
+    uint32_t plic_pending_irq, plic_served_irq;
+    uint64_t htif_tohost, htif_fromhost;
+} RISCVMachineSnapshot;
+
 #define LOW_RAM_SIZE   0x00010000 /* 64KB */
 #define RAM_BASE_ADDR  0x80000000
 #define CLINT_BASE_ADDR 0x02000000
@@ -144,6 +162,21 @@ static uint32_t htif_read(void *opaque, uint32_t offset,
     return val;
 }
 
+static void riscv_print_stats(RISCVMachine *s)
+{
+    RISCVCPUStats stats;
+    if (!s->print_stats)
+        return;
+    riscv_cpu_get_stats(s->cpu_state, &stats);
+    printf("page walk cache: %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64 " flushes\r\n",
+           stats.ptw_cache_hits, stats.ptw_cache_misses, stats.ptw_cache_flushes);
+    printf("asid tlb: %" PRIu64 " hits, %" PRIu64 " on superpages, %" PRIu64 " page walks\r\n",
+           stats.asid_tlb_hits, stats.superpage_hits, stats.page_walks);
+    printf("decode cache: %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64 " invalidations\r\n",
+           stats.decode_cache_hits, stats.decode_cache_misses,
+           stats.decode_cache_invalidations);
+}
+
 static void htif_handle_cmd(RISCVMachine *s)
 {
     uint32_t device, cmd;
@@ -153,6 +186,7 @@ static void htif_handle_cmd(RISCVMachine *s)
     if (s->htif_tohost == 1) {
         /* shuthost */
         printf("\nPower off.\n");
+        riscv_print_stats(s);
         exit(0);
     } else if (device == 1 && cmd == 1) {
         uint8_t buf[1];
@@ -848,10 +882,19 @@ static void load_file_to_vmm(VMM_t *vmm, const char * filename, uint32_t address
     fseek(f, 0, SEEK_SET);
 
     uint32_t total_read = 0;
+    uint32_t total_kept = 0;
 
     uint8_t * buffer = malloc(1024);
     assert(buffer);
     do{
+        /* chunks a persistent pagefile kept from the previous boot or a base image holds are not copied again */
+        size_t length = MIN(1024, *read_size - total_read);
+        if (length > 0 && vmm_is_persistent(vmm, address, length) && fseek(f, length, SEEK_CUR) == 0) {
+            address += length;
+            total_read += length;
+            total_kept += length;
+            continue;
+        }
         size_t bytes_read = fread(buffer, 1, 1024, f);
         if (bytes_read > 0){
             vmm_write(vmm,address, buffer, bytes_read);
@@ -862,6 +905,8 @@ static void load_file_to_vmm(VMM_t *vmm, const char * filename, uint32_t address
         }
     }while(true);
     free(buffer);
+    if (total_kept > 0)
+        printf("%s: %d bytes already loaded\r\n", filename, total_kept);
 
     if (total_read != *read_size){
     // if (fread(buf, 1, read_size, f) != read_size) {
@@ -960,6 +1005,10 @@ static void copy_bios(RISCVMachine *s, const char * bios_filename,
     qbuf[4] = 0x00028067; /* jalr zero, t0, jump_addr */
     vmm_write(pr->vmm, ram_ptr  - pr->phys_mem+  0x1000, &qbuf, sizeof(qbuf));
 
+    /* persistent pagefiles keep the loaded images for the next boot */
+    vmm_persist(pr->vmm);
+    vmm_persist(get_phys_mem_range(s->mem_map, RAM_BASE_ADDR)->vmm);
+
 
     // printf("writing jump address ram ptr: 0x%" PRIx64 " phy: 0x%p\r\n", ram_ptr + 0x1000, pr->phys_mem);
     // q = (uint32_t *)(ram_ptr + 0x1000);
@@ -980,16 +1029,243 @@ static void riscv_flush_tlb_write_range(void *opaque, uint8_t *ram_addr,
     riscv_cpu_flush_tlb_write_range_ram(s->cpu_state, ram_addr, ram_size);
 }
 
+static void riscv_flush_tlb_host_range(void *opaque, uint8_t *host_addr,
+                                       size_t host_size)
+{
+    RISCVMachine *s = opaque;
+    riscv_cpu_flush_tlb_host_range(s->cpu_state, host_addr, host_size);
+}
+
+/* identifies the boot images by name, size and modification time, persistent pagefiles
+   are only kept for the same images */
+static uint64_t boot_image_generation(const VirtMachineParams *p, int max_xlen)
+{
+    static const int files[] = { VM_FILE_BIOS, VM_FILE_KERNEL, VM_FILE_INITRD };
+    uint64_t hash = 0xcbf29ce484222325ULL; /* FNV-1a */
+    uint64_t values[3];
+    char fullpath[256];
+    struct stat st;
+    const uint8_t *q;
+    size_t i, j;
+
+    for (i = 0; i < countof(files); i++) {
+        const char *filename = p->files[files[i]].filename;
+        if (!filename)
+            filename = "";
+        memset(values, 0, sizeof(values));
+        vd_cwd(fullpath, sizeof(fullpath));
+        strncat(fullpath, filename, sizeof(fullpath) - strlen(fullpath) - 1);
+        if (filename[0] != '\0' && stat(fullpath, &st) == 0) {
+            values[0] = st.st_size;
+            values[1] = st.st_mtime;
+        }
+        values[2] = max_xlen;
+        for (q = (const uint8_t *)filename; *q != '\0'; q++)
+            hash = (hash ^ *q) * 0x100000001b3ULL;
+        q = (const uint8_t *)values;
+        for (j = 0; j < sizeof(values); j++)
+            hash = (hash ^ q[j]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/* the RAM regions in VM_RAM_REGION_* order */
+static const uint64_t riscv_ram_region_addr[VM_RAM_REGION_COUNT] = {
+    RAM_BASE_ADDR,
+    0x00000000,
+};
+
+/* absolute paths are kept, the others are in the working directory */
+static void riscv_resolve_path(char *path, size_t path_size, const char *filename)
+{
+    if (filename[0] == '/') {
+        snprintf(path, path_size, "%s", filename);
+    } else {
+        vd_cwd(path, path_size);
+        strncat(path, filename, path_size - strlen(path) - 1);
+    }
+}
+
+/* a region with a base image boots as a copy-on-write overlay of it, without one
+   for these boot images the base is captured once they are loaded */
+static BOOL riscv_attach_base(RISCVMachine *s, int region, const char *base)
+{
+    PhysMemoryRange *pr = get_phys_mem_range(s->mem_map, riscv_ram_region_addr[region]);
+    char path[256];
+
+    if (!base || !pr || pr->vmm->backend != VMM_BACKEND_PAGED)
+        return TRUE;
+    riscv_resolve_path(path, sizeof(path), base);
+    if (!vmm_attach_base(pr->vmm, path, s->mem_map->vmm_generation))
+        return FALSE;
+    printf("RAM 0x%" PRIx64 ": overlay of %s\r\n", riscv_ram_region_addr[region], path);
+    return TRUE;
+}
+
+static void riscv_save_base(RISCVMachine *s, int region, const char *base)
+{
+    PhysMemoryRange *pr = get_phys_mem_range(s->mem_map, riscv_ram_region_addr[region]);
+    char path[256];
+
+    riscv_resolve_path(path, sizeof(path), base);
+    if (vmm_save_base(pr->vmm, path, s->mem_map->vmm_generation))
+        printf("RAM 0x%" PRIx64 ": saved base image %s\r\n", riscv_ram_region_addr[region], path);
+    else
+        printf("RAM 0x%" PRIx64 ": could not save base image %s\r\n", riscv_ram_region_addr[region], path);
+}
+
 static void riscv_machine_set_defaults(VirtMachineParams *p)
 {
     (void)(p);
 }
 
+static void riscv_snapshot_ram_filename(char *buf, size_t buf_size,
+                                        const char *filename, PhysMemoryRange *pr)
+{
+    snprintf(buf, buf_size, "%s.0x%" PRIx64, filename, pr->addr);
+}
+
+/* only called between two interpreter runs, the CPU is at an instruction boundary */
+static int riscv_machine_save(VirtMachine *s1, const char *filename)
+{
+    RISCVMachine *s = (RISCVMachine *)s1;
+    RISCVMachineSnapshot snap;
+    char buf[256];
+    char ram_filename[256];
+    FILE *f;
+    int i, ret;
+
+    /* nothing is written unless every device can be saved */
+    for(i = 0; i < s->virtio_count; i++) {
+        if (!virtio_can_save(s->virtio_dev[i])) {
+            vm_error("virtio device %d is busy or cannot be saved\n", i);
+            return -1;
+        }
+    }
+
+    memset(&snap, 0, sizeof(snap));
+    snap.max_xlen = s->max_xlen;
+    snap.virtio_count = s->virtio_count;
+    snap.ram_size = s->ram_size;
+    snap.rtc_time = rtc_get_time(s);
+    snap.timecmp = s->timecmp;
+    snap.plic_pending_irq = s->plic_pending_irq;
+    snap.plic_served_irq = s->plic_served_irq;
+    snap.htif_tohost = s->htif_tohost;
+    snap.htif_fromhost = s->htif_fromhost;
+
+    /* the machine file is replaced last, it is what makes a snapshot resumable */
+    snprintf(buf, sizeof(buf), "%s.tmp", filename);
+    f = fopen(buf, "wb");
+    if (!f) {
+        vm_error("%s: could not create\n", buf);
+        return -1;
+    }
+    ret = 0;
+    if (fwrite(RISCV_SNAPSHOT_MAGIC, 8, 1, f) != 1 ||
+        fwrite(&snap, sizeof(snap), 1, f) != 1 ||
+        riscv_cpu_save(s->cpu_state, f) < 0)
+        ret = -1;
+    for(i = 0; ret == 0 && i < s->virtio_count; i++) {
+        if (virtio_save(s->virtio_dev[i], f) < 0)
+            ret = -1;
+    }
+    if (fclose(f) != 0)
+        ret = -1;
+    if (ret < 0)
+        vm_error("%s: could not write\n", buf);
+
+    for(i = 0; ret == 0 && i < s->mem_map->n_phys_mem_range; i++) {
+        PhysMemoryRange *pr = &s->mem_map->phys_mem_range[i];
+        if (pr->is_ram && pr->vmm) {
+            riscv_snapshot_ram_filename(ram_filename, sizeof(ram_filename), filename, pr);
+            if (!vmm_snapshot_save(pr->vmm, ram_filename)) {
+                vm_error("%s: could not save RAM\n", ram_filename);
+                /* the RAM files already replaced do not match the old
+                   machine file anymore */
+                remove(filename);
+                ret = -1;
+            }
+        }
+    }
+    if (ret == 0) {
+        remove(filename);
+        if (rename(buf, filename) != 0)
+            ret = -1;
+    }
+    if (ret < 0) {
+        remove(buf);
+        return -1;
+    }
+    printf("Saved snapshot %s\r\n", filename);
+    return 0;
+}
+
+/* resumes a snapshot instead of loading the bios, returns -1 when there is
+   none for this machine and -2 when it is broken after RAM was resumed */
+static int riscv_machine_load(RISCVMachine *s, const char *filename)
+{
+    RISCVMachineSnapshot snap;
+    char magic[8];
+    char buf[256];
+    FILE *f;
+    int i;
+
+    f = fopen(filename, "rb");
+    if (!f)
+        return -1;
+    if (fread(magic, sizeof(magic), 1, f) != 1 ||
+        memcmp(magic, RISCV_SNAPSHOT_MAGIC, sizeof(magic)) != 0 ||
+        fread(&snap, sizeof(snap), 1, f) != 1 ||
+        snap.max_xlen != s->max_xlen || snap.ram_size != s->ram_size ||
+        snap.virtio_count != s->virtio_count) {
+        vm_error("%s: snapshot of a different machine\n", filename);
+        fclose(f);
+        return -1;
+    }
+
+    for(i = 0; i < s->mem_map->n_phys_mem_range; i++) {
+        PhysMemoryRange *pr = &s->mem_map->phys_mem_range[i];
+        if (pr->is_ram && pr->vmm) {
+            riscv_snapshot_ram_filename(buf, sizeof(buf), filename, pr);
+            if (!vmm_snapshot_load(pr->vmm, buf)) {
+                vm_error("%s: could not resume RAM\n", buf);
+                fclose(f);
+                return -2;
+            }
+        }
+    }
+
+    if (riscv_cpu_load(s->cpu_state, f) < 0) {
+        vm_error("%s: could not resume the CPU\n", filename);
+        fclose(f);
+        return -2;
+    }
+    for(i = 0; i < s->virtio_count; i++) {
+        if (virtio_load(s->virtio_dev[i], f) < 0) {
+            vm_error("%s: could not resume virtio device %d\n", filename, i);
+            fclose(f);
+            return -2;
+        }
+    }
+    fclose(f);
+
+    s->timecmp = snap.timecmp;
+    s->plic_pending_irq = snap.plic_pending_irq;
+    s->plic_served_irq = snap.plic_served_irq;
+    s->htif_tohost = snap.htif_tohost;
+    s->htif_fromhost = snap.htif_fromhost;
+    if (s->rtc_real_time)
+        s->rtc_start_time = rtc_get_real_time(s) - snap.rtc_time;
+    printf("Resumed snapshot %s\r\n", filename);
+    return 0;
+}
+
 static VirtMachine *riscv_machine_init(const VirtMachineParams *p)
 {
     RISCVMachine *s;
     VIRTIODevice *blk_dev;
-    int irq_num, i, max_xlen, ram_flags;
+    int irq_num, i, max_xlen, ram_flags, ret;
     VIRTIOBusDef vbus_s, *vbus = &vbus_s;
 
 
@@ -1012,6 +1288,11 @@ static VirtMachine *riscv_machine_init(const VirtMachineParams *p)
     /* needed to handle the RAM dirty bits */
     s->mem_map->opaque = s;
     s->mem_map->flush_tlb_write_range = riscv_flush_tlb_write_range;
+    s->mem_map->flush_tlb_host_range = riscv_flush_tlb_host_range;
+    s->mem_map->vmm_backend = p->vmm_backend;
+    s->mem_map->vmm_write_behind = p->vmm_write_behind;
+    s->mem_map->vmm_compressed_tier = p->vmm_compressed_tier;
+    s->mem_map->vmm_generation = boot_image_generation(p, max_xlen);
 
     s->cpu_state = riscv_cpu_init(s->mem_map, max_xlen);
     if (!s->cpu_state) {
@@ -1021,9 +1302,14 @@ static VirtMachine *riscv_machine_init(const VirtMachineParams *p)
     }
     /* RAM */
     ram_flags = 0;
+    s->mem_map->vmm_region = p->vmm_region[VM_RAM_REGION_RAM];
     cpu_register_ram(s->mem_map, RAM_BASE_ADDR, p->ram_size, ram_flags);
+    s->mem_map->vmm_region = p->vmm_region[VM_RAM_REGION_LOW_RAM];
     cpu_register_ram(s->mem_map, 0x00000000, LOW_RAM_SIZE, 0);
+    /* other RAM, e.g. the frame buffer, uses the defaults */
+    memset(&s->mem_map->vmm_region, 0, sizeof(s->mem_map->vmm_region));
     s->rtc_real_time = p->rtc_real_time;
+    s->print_stats = p->print_stats;
     if (p->rtc_real_time) {
         s->rtc_start_time = rtc_get_real_time(s);
     }
@@ -1054,13 +1340,13 @@ static VirtMachine *riscv_machine_init(const VirtMachineParams *p)
         s->common.console_dev = virtio_console_init(vbus, p->console);
         vbus->addr += VIRTIO_SIZE;
         irq_num++;
-        s->virtio_count++;
+        s->virtio_dev[s->virtio_count++] = s->common.console_dev;
     }
     
     /* virtio net device */
     for(i = 0; i < p->eth_count; i++) {
         vbus->irq = &s->plic_irq[irq_num];
-        virtio_net_init(vbus, p->tab_eth[i].net);
+        s->virtio_dev[s->virtio_count] = virtio_net_init(vbus, p->tab_eth[i].net);
         s->common.net = p->tab_eth[i].net;
         vbus->addr += VIRTIO_SIZE;
         irq_num++;
@@ -1071,10 +1357,9 @@ static VirtMachine *riscv_machine_init(const VirtMachineParams *p)
     for(i = 0; i < p->drive_count; i++) {
         vbus->irq = &s->plic_irq[irq_num];
         blk_dev = virtio_block_init(vbus, p->tab_drive[i].block_dev);
-        (void)blk_dev;
         vbus->addr += VIRTIO_SIZE;
         irq_num++;
-        s->virtio_count++;
+        s->virtio_dev[s->virtio_count++] = blk_dev;
     }
 
     /* virtio filesystem */
@@ -1083,11 +1368,10 @@ static VirtMachine *riscv_machine_init(const VirtMachineParams *p)
         vbus->irq = &s->plic_irq[irq_num];
         fs_dev = virtio_9p_init(vbus, p->tab_fs[i].fs_dev,
                                 p->tab_fs[i].tag);
-        (void)fs_dev;
         //        virtio_set_debug(fs_dev, VIRTIO_DEBUG_9P);
         vbus->addr += VIRTIO_SIZE;
         irq_num++;
-        s->virtio_count++;
+        s->virtio_dev[s->virtio_count++] = fs_dev;
     }
 
     if (p->display_device) {
@@ -1113,14 +1397,14 @@ static VirtMachine *riscv_machine_init(const VirtMachineParams *p)
                                                 VIRTIO_INPUT_TYPE_KEYBOARD);
             vbus->addr += VIRTIO_SIZE;
             irq_num++;
-            s->virtio_count++;
+            s->virtio_dev[s->virtio_count++] = s->keyboard_dev;
 
             vbus->irq = &s->plic_irq[irq_num];
             s->mouse_dev = virtio_input_init(vbus,
                                              VIRTIO_INPUT_TYPE_TABLET);
             vbus->addr += VIRTIO_SIZE;
             irq_num++;
-            s->virtio_count++;
+            s->virtio_dev[s->virtio_count++] = s->mouse_dev;
         } else {
             vm_error("unsupported input device: %s\n", p->input_device);
             exit(1);
@@ -1131,10 +1415,30 @@ static VirtMachine *riscv_machine_init(const VirtMachineParams *p)
     //     vm_error("No bios found\r\n");
     // }
 
-    copy_bios(s, p->files[VM_FILE_BIOS].filename, 
-                p->files[VM_FILE_KERNEL].filename,
-                p->files[VM_FILE_INITRD].filename,
-              p->cmdline);
+    if (p->snapshot) {
+        char path[256];
+        riscv_resolve_path(path, sizeof(path), p->snapshot);
+        s->common.snapshot_filename = strdup(path);
+    }
+
+    /* without a snapshot for this machine it boots, the snapshot is left alone */
+    ret = s->common.snapshot_filename ? riscv_machine_load(s, s->common.snapshot_filename) : -1;
+    if (ret == -2) {
+        return NULL;
+    } else if (ret < 0) {
+        BOOL attached[VM_RAM_REGION_COUNT];
+        for(i = 0; i < VM_RAM_REGION_COUNT; i++)
+            attached[i] = riscv_attach_base(s, i, p->vmm_region[i].base);
+        /* the images are only copied to the pages the base image does not hold */
+        copy_bios(s, p->files[VM_FILE_BIOS].filename, 
+                    p->files[VM_FILE_KERNEL].filename,
+                    p->files[VM_FILE_INITRD].filename,
+                  p->cmdline);
+        for(i = 0; i < VM_RAM_REGION_COUNT; i++) {
+            if (!attached[i])
+                riscv_save_base(s, i, p->vmm_region[i].base);
+        }
+    }
     
     return (VirtMachine *)s;
 }
@@ -1143,9 +1447,11 @@ static void riscv_machine_end(VirtMachine *s1)
 {
     printf("machine end\r\n");
     RISCVMachine *s = (RISCVMachine *)s1;
+    riscv_print_stats(s);
     /* XXX: stop all */
     riscv_cpu_end(s->cpu_state);
     phys_mem_map_end(s->mem_map);
+    free(s->common.snapshot_filename);
     free(s);
 }
 
@@ -1218,4 +1524,5 @@ const VirtMachineClass riscv_machine_class = {
     riscv_vm_mouse_is_absolute,
     riscv_vm_send_mouse_event,
     riscv_vm_send_key_event,
+    riscv_machine_save,
 };
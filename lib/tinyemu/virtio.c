@@ -298,108 +298,101 @@ static void virtio_init(VIRTIODevice *s, VIRTIOBusDef *bus,
     virtio_reset(s);
 }
 
+/* host pointer into the VMM page buffer holding addr, only valid until
+   the next access to the same VMM */
+static uint8_t *virtio_get_vmm_ptr(VIRTIODevice *s, virtio_phys_addr_t addr,
+                                   BOOL is_rw)
+{
+    PhysMemoryRange *pr = get_phys_mem_range(s->mem_map, addr);
+    if (!pr || !pr->is_ram)
+        return NULL;
+    if (is_rw)
+        phys_mem_set_dirty_bit(pr, addr - pr->addr);
+    return vmm_get_page_ptr(pr->vmm, addr - pr->addr, is_rw);
+}
+
 static uint16_t virtio_read16(VIRTIODevice *s, virtio_phys_addr_t addr)
 {
-    // printf("reading 16 from %" PRIX64 " \r\n", addr);
-    // uint8_t *ptr;
+    uint8_t *ptr;
     if (addr & 1)
         return 0; /* unaligned access are not supported */
-
-    PhysMemoryRange *pr = get_phys_mem_range(s->mem_map, addr);
-    assert(pr);
-    uint16_t vbuf;
-    vmm_read(pr->vmm, addr - pr->addr,&vbuf, sizeof(uint16_t) );
-    // ptr = s->get_ram_ptr(s, addr, FALSE);
-    // if (*(uint16_t *)ptr != vbuf){
-    //     printf("virtio_read16 0x%" PRIX16 " !=  0x%" PRIX16 " at 0x%" PRIX64 " \r\n", *(uint16_t *)ptr, vbuf, addr);
-    // }
-    // if (!ptr)
-    //     return 0;
-    // return *(uint16_t *)ptr;
-    return vbuf;
+    ptr = virtio_get_vmm_ptr(s, addr, FALSE);
+    if (!ptr)
+        return 0;
+    return *(uint16_t *)ptr;
 }
 
 static void virtio_write16(VIRTIODevice *s, virtio_phys_addr_t addr,
                            uint16_t val)
 {
-    // printf("writing 16 from %" PRIX64 " \r\n", addr);
-    // uint8_t *ptr;
+    uint8_t *ptr;
     if (addr & 1)
         return; /* unaligned access are not supported */
-
-    PhysMemoryRange *pr = get_phys_mem_range(s->mem_map, addr);
-    assert(pr);
-    vmm_write(pr->vmm, addr- pr->addr, &val, sizeof(uint16_t));
-    // ptr = s->get_ram_ptr(s, addr, TRUE);
-    // if (!ptr)
-    //     return;
-    // *(uint16_t *)ptr = val;
+    ptr = virtio_get_vmm_ptr(s, addr, TRUE);
+    if (!ptr)
+        return;
+    *(uint16_t *)ptr = val;
 }
 
 static void virtio_write32(VIRTIODevice *s, virtio_phys_addr_t addr,
                            uint32_t val)
 {
-    // printf("writing 32 from %" PRIX64 " \r\n", addr);
-    // uint8_t *ptr;
+    uint8_t *ptr;
     if (addr & 3)
         return; /* unaligned access are not supported */
-    PhysMemoryRange *pr = get_phys_mem_range(s->mem_map, addr);
-    assert(pr);
-    vmm_write(pr->vmm, addr- pr->addr, &val, sizeof(uint32_t));
-    // ptr = s->get_ram_ptr(s, addr, TRUE);
-    // if (!ptr)
-    //     return;
-    // *(uint32_t *)ptr = val;
+    ptr = virtio_get_vmm_ptr(s, addr, TRUE);
+    if (!ptr)
+        return;
+    *(uint32_t *)ptr = val;
 }
 
+/* copy one VMM page at a time straight from/to the page buffers, the
+   page is pinned while it is accessed */
 static int virtio_memcpy_from_ram(VIRTIODevice *s, uint8_t *buf,
                                   virtio_phys_addr_t addr, int count)
 {
-    // printf("memcpy from %" PRIX64 " %d bytes to 0x%p\r\n", addr, count, buf);
-    // uint8_t *ptr;
-    // int l;
-    PhysMemoryRange *pr = get_phys_mem_range(s->mem_map, addr);
-    assert(pr);
-
-    vmm_read(pr->vmm, addr- pr->addr, buf, count);
-
-    // while (count > 0) {
-    //     l = min_int(count, VIRTIO_PAGE_SIZE - (addr & (VIRTIO_PAGE_SIZE - 1)));
-    //     ptr = s->get_ram_ptr(s, addr, FALSE);
-    //     if (!ptr)
-    //         return -1;
-    //     memcpy(buf, ptr, l);
-    //     addr += l;
-    //     buf += l;
-    //     count -= l;
-    // }
-   
+    PhysMemoryRange *pr;
+    vmTable_t *page;
+    uint8_t *ptr;
+    size_t l;
+
+    while (count > 0) {
+        pr = get_phys_mem_range(s->mem_map, addr);
+        if (!pr || !pr->is_ram)
+            return -1;
+        ptr = vmm_acquire_ptr(pr->vmm, addr - pr->addr, FALSE, &l, &page);
+        l = min_int(count, l);
+        memcpy(buf, ptr, l);
+        vmm_release_ptr(pr->vmm, page, FALSE);
+        addr += l;
+        buf += l;
+        count -= l;
+    }
     return 0;
 }
 
 static int virtio_memcpy_to_ram(VIRTIODevice *s, virtio_phys_addr_t addr, 
                                 const uint8_t *buf, int count)
 {
-    // printf("memcpy to %" PRIX64 " %d bytes\r\n", addr, count);
-    // uint8_t *ptr;
-    // int l;
-
-    PhysMemoryRange *pr = get_phys_mem_range(s->mem_map, addr);
-    assert(pr);
-
-    vmm_write(pr->vmm, addr- pr->addr, buf , count);
-
-    // while (count > 0) {
-    //     l = min_int(count, VIRTIO_PAGE_SIZE - (addr & (VIRTIO_PAGE_SIZE - 1)));
-    //     ptr = s->get_ram_ptr(s, addr, TRUE);
-    //     if (!ptr)
-    //         return -1;
-    //     memcpy(ptr, buf, l);
-    //     addr += l;
-    //     buf += l;
-    //     count -= l;
-    // }
+    PhysMemoryRange *pr;
+    vmTable_t *page;
+    uint8_t *ptr;
+    size_t l;
 
+    while (count > 0) {
+        pr = get_phys_mem_range(s->mem_map, addr);
+        if (!pr || !pr->is_ram)
+            return -1;
+        ptr = vmm_acquire_ptr(pr->vmm, addr - pr->addr, TRUE, &l, &page);
+        /* one dirty bit per chunk */
+        l = min_int(count, min_int(l, VIRTIO_PAGE_SIZE - (addr & (VIRTIO_PAGE_SIZE - 1))));
+        phys_mem_set_dirty_bit(pr, addr - pr->addr);
+        memcpy(ptr, buf, l);
+        vmm_release_ptr(pr->vmm, page, TRUE);
+        addr += l;
+        buf += l;
+        count -= l;
+    }
     return 0;
 }
 
@@ -2712,3 +2705,43 @@ VIRTIODevice *virtio_9p_init(VIRTIOBusDef *bus, FSDevice *fs,
     return (VIRTIODevice *)s;
 }
 
+
+/*********************************************************************/
+/* snapshot */
+
+BOOL virtio_can_save(VIRTIODevice *s)
+{
+    if (s->device_id == 2 && ((VIRTIOBlockDevice *)s)->req_in_progress)
+        return FALSE;
+    return s->device_id != 9;
+}
+
+int virtio_save(VIRTIODevice *s, FILE *f)
+{
+    if (!virtio_can_save(s))
+        return -1;
+    if (fwrite(&s->device_id, sizeof(s->device_id), 1, f) != 1 ||
+        fwrite(&s->int_status, sizeof(s->int_status), 1, f) != 1 ||
+        fwrite(&s->status, sizeof(s->status), 1, f) != 1 ||
+        fwrite(&s->device_features_sel, sizeof(s->device_features_sel), 1, f) != 1 ||
+        fwrite(&s->queue_sel, sizeof(s->queue_sel), 1, f) != 1 ||
+        fwrite(s->queue, sizeof(s->queue), 1, f) != 1 ||
+        fwrite(s->config_space, sizeof(s->config_space), 1, f) != 1)
+        return -1;
+    return 0;
+}
+
+int virtio_load(VIRTIODevice *s, FILE *f)
+{
+    uint32_t device_id;
+    if (fread(&device_id, sizeof(device_id), 1, f) != 1 ||
+        device_id != s->device_id ||
+        fread(&s->int_status, sizeof(s->int_status), 1, f) != 1 ||
+        fread(&s->status, sizeof(s->status), 1, f) != 1 ||
+        fread(&s->device_features_sel, sizeof(s->device_features_sel), 1, f) != 1 ||
+        fread(&s->queue_sel, sizeof(s->queue_sel), 1, f) != 1 ||
+        fread(s->queue, sizeof(s->queue), 1, f) != 1 ||
+        fread(s->config_space, sizeof(s->config_space), 1, f) != 1)
+        return -1;
+    return 0;
+}
@@ -61,6 +61,13 @@ typedef struct VIRTIODevice VIRTIODevice;
 
 void virtio_set_debug(VIRTIODevice *s, int debug_flags);
 
+/* transport and queue state for a machine snapshot, the rings are in
+   guest RAM. They cannot be saved while a request is in progress and
+   for 9P devices, whose open files cannot be saved */
+BOOL virtio_can_save(VIRTIODevice *s);
+int virtio_save(VIRTIODevice *s, FILE *f);
+int virtio_load(VIRTIODevice *s, FILE *f);
+
 /* block device */
 
 typedef void BlockDeviceCompletionFunc(void *opaque, int ret);
@@ -8,6 +8,7 @@ typedef struct
 {
     int console_esc_state;
     BOOL resize_pending;
+    BOOL snapshot_pending;
 } STDIODevice;
 
 #include <stdio.h>
@@ -23,9 +24,38 @@ static void uart_console_get_size(STDIODevice *s, int *pw, int *ph)
     *ph = height;
 }
 
+/* C-a s requests a snapshot, C-a C-a sends C-a */
 static int uart_console_read(void *opaque, uint8_t *buf, int len)
 {
-    return uart_read_bytes(CONFIG_ESP_CONSOLE_UART_NUM, buf, len,0);
+    STDIODevice *s = opaque;
+    int ret, i, j;
+
+    ret = uart_read_bytes(CONFIG_ESP_CONSOLE_UART_NUM, buf, len,0);
+    if (ret <= 0)
+        return ret;
+
+    j = 0;
+    for (i = 0; i < ret; i++)
+    {
+        uint8_t ch = buf[i];
+        if (s->console_esc_state)
+        {
+            s->console_esc_state = 0;
+            if (ch == 's')
+                s->snapshot_pending = TRUE;
+            else if (ch == 1)
+                buf[j++] = ch;
+        }
+        else if (ch == 1)
+        {
+            s->console_esc_state = 1;
+        }
+        else
+        {
+            buf[j++] = ch;
+        }
+    }
+    return j;
 }
 
 static void uart_console_write(void *opaque, const uint8_t *buf, int len)
@@ -88,6 +88,7 @@ typedef struct
     int stdin_fd;
     int console_esc_state;
     BOOL resize_pending;
+    BOOL snapshot_pending;
 } STDIODevice;
 
 static struct termios oldtty;
@@ -160,10 +161,14 @@ static int console_read(void *opaque, uint8_t *buf, int len)
             case 'x':
                 printf("Terminated\n");
                 exit(0);
+            case 's':
+                s->snapshot_pending = TRUE;
+                break;
             case 'h':
                 printf("\n"
                        "C-a h   print this help\n"
                        "C-a x   exit emulator\n"
+                       "C-a s   save a snapshot\n"
                        "C-a C-a send C-a\n");
                 break;
             case 1:
@@ -660,6 +665,14 @@ void virt_machine_run(VirtMachine *m)
             virtio_console_resize_event(m->console_dev, width, height);
             s->resize_pending = FALSE;
         }
+        if (s->snapshot_pending)
+        {
+            s->snapshot_pending = FALSE;
+            if (virt_machine_save(m) < 0)
+            {
+                printf("Snapshot not saved\r\n");
+            }
+        }
     }
     // #endif
     if (m->net)
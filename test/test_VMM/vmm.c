@@ -1,6 +1,7 @@
 #include <unity.h>
 #include <vmm.h>
 #include <inttypes.h>
+#include <unistd.h>
 
 void setUp()
 {
@@ -96,6 +97,699 @@ void write_sequential_and_verify()
     vmm_destroy(vmm);
 }
 
+static size_t evicted_pages;
+
+static void on_evict(void *context, uint8_t *page, size_t page_size)
+{
+    (void)context;
+    (void)page;
+    (void)page_size;
+    evicted_pages++;
+}
+
+void page_ptr_and_evict_callback()
+{
+    VMM_t *vmm = vmm_create("pagefile4.bin", 1024 * 16, 128, 4, 128);
+    TEST_ASSERT_EQUAL(0, vmm_subscribe_evict(vmm, on_evict, NULL));
+    evicted_pages = 0;
+
+    uint8_t *ptr = vmm_get_page_ptr(vmm, 130, true);
+    memcpy(ptr, "ptr", 4);
+
+    char buffer[4];
+    vmm_read(vmm, 130, buffer, sizeof(buffer));
+    TEST_ASSERT_EQUAL_STRING("ptr", buffer);
+
+    // touch enough pages to evict the first one
+    for (size_t i = 2; i < 8; i++)
+    {
+        vmm_read(vmm, i * 128, buffer, 1);
+    }
+    TEST_ASSERT_TRUE(evicted_pages > 0);
+
+    // the dirty page content must survive the eviction
+    memset(buffer, 0, sizeof(buffer));
+    vmm_read(vmm, 130, buffer, sizeof(buffer));
+    TEST_ASSERT_EQUAL_STRING("ptr", buffer);
+
+    vmm_destroy(vmm);
+}
+
+void pinned_page_is_not_evicted()
+{
+    VMM_t *vmm = vmm_create("pagefile5.bin", 1024 * 16, 128, 4, 128);
+
+    vmTable_t *page = vmm_get_page(vmm, 0, true);
+    vmm_pin_page(page);
+    uint8_t *buffer = page->page_cache;
+    memcpy(buffer, "pin", 4);
+
+    char tmpbuffer[4];
+    for (size_t i = 1; i < 64; i++)
+    {
+        vmm_read(vmm, i * 128, tmpbuffer, 1);
+    }
+
+    TEST_ASSERT_TRUE(vmm_get_page(vmm, 0, false) == page);
+    TEST_ASSERT_TRUE(page->page_cache == buffer);
+    TEST_ASSERT_EQUAL_STRING("pin", (char *)buffer);
+
+    vmm_unpin_page(page);
+    vmm_destroy(vmm);
+}
+
+static size_t second_evicted_pages;
+
+static void on_evict_second(void *context, uint8_t *page, size_t page_size)
+{
+    (void)context;
+    (void)page;
+    (void)page_size;
+    second_evicted_pages++;
+}
+
+void acquire_ptr_stays_dirty_while_pinned()
+{
+    VMM_t *vmm = vmm_create("pagefile6.bin", 1024 * 16, 128, 4, 128);
+    evicted_pages = 0;
+    second_evicted_pages = 0;
+    TEST_ASSERT_EQUAL(0, vmm_subscribe_evict(vmm, on_evict, NULL));
+    TEST_ASSERT_EQUAL(0, vmm_subscribe_evict(vmm, on_evict_second, NULL));
+
+    size_t len;
+    vmTable_t *page;
+    uint8_t *ptr = vmm_acquire_ptr(vmm, 200, true, &len, &page);
+    TEST_ASSERT_EQUAL(56, len);
+    memcpy(ptr, "one", 4);
+
+    // a write back while pinned must not lose later writes through ptr
+    vmm_flush(vmm);
+    TEST_ASSERT_TRUE(page->dirty);
+    memcpy(ptr, "two", 4);
+    vmm_release_ptr(vmm, page, true);
+
+    char buffer[4];
+    for (size_t i = 2; i < 64; i++)
+    {
+        vmm_read(vmm, i * 128, buffer, 1);
+    }
+    TEST_ASSERT_TRUE(evicted_pages > 0);
+    TEST_ASSERT_EQUAL(evicted_pages, second_evicted_pages);
+
+    vmm_unsubscribe_evict(vmm, on_evict_second, NULL);
+    vmm_read(vmm, 200, buffer, sizeof(buffer));
+    TEST_ASSERT_EQUAL_STRING("two", buffer);
+    TEST_ASSERT_TRUE(evicted_pages > second_evicted_pages);
+
+    vmm_destroy(vmm);
+}
+
+void flush_cleans_pinned_page()
+{
+    VMM_t *vmm = vmm_create("pagefile19.bin", 1024 * 16, 128, 4, 128);
+
+    vmTable_t *page = vmm_get_page(vmm, 0, true);
+    vmm_pin_page(page);
+    memcpy(page->page_cache, "pin", 4);
+
+    vmm_flush(vmm);
+    TEST_ASSERT_FALSE(page->dirty);
+    vmm_stats_t stats;
+    vmm_get_stats(vmm, &stats);
+    size_t dirty_writebacks = stats.dirty_writebacks;
+
+    // a clean pinned page is not written back again
+    vmm_flush(vmm);
+    vmm_get_stats(vmm, &stats);
+    TEST_ASSERT_EQUAL(dirty_writebacks, stats.dirty_writebacks);
+
+    vmm_unpin_page(page);
+    vmm_destroy(vmm);
+}
+
+void mmap_backend_read_write()
+{
+    vmm_backend_t backend;
+    TEST_ASSERT_TRUE(vmm_parse_backend("mmap", &backend));
+    TEST_ASSERT_EQUAL(VMM_BACKEND_MMAP_FILE, backend);
+    TEST_ASSERT_TRUE(vmm_parse_backend("mmap_anonymous", &backend));
+    TEST_ASSERT_EQUAL(VMM_BACKEND_MMAP_ANONYMOUS, backend);
+    TEST_ASSERT_FALSE(vmm_parse_backend("bogus", &backend));
+
+    vmm_backend_t backends[] = {VMM_BACKEND_MMAP_FILE, VMM_BACKEND_MMAP_ANONYMOUS};
+    for (int i = 0; i < 2; i++)
+    {
+        VMM_t *vmm = vmm_create_backend(backends[i], "pagefile18.bin", 64 * 1024, 1024, 4, 4, EVICTION_POLICY_CLOCK);
+        char buffer[64];
+        for (size_t addr = 0; addr < 64 * 1024; addr += 1024)
+        {
+            sprintf(buffer, "page %d", (int)addr);
+            vmm_write(vmm, addr + 1000, buffer, strlen(buffer) + 1);
+        }
+        for (size_t addr = 0; addr < 64 * 1024; addr += 1024)
+        {
+            char expected[64];
+            sprintf(expected, "page %d", (int)addr);
+            vmm_read(vmm, addr + 1000, buffer, strlen(expected) + 1);
+            TEST_ASSERT_EQUAL_STRING(expected, buffer);
+        }
+
+        uint8_t *ptr = vmm_get_page_ptr(vmm, 2048, true);
+        memcpy(ptr, "map", 4);
+        vmm_read(vmm, 2048, buffer, 4);
+        TEST_ASSERT_EQUAL_STRING("map", buffer);
+        vmm_destroy(vmm);
+    }
+}
+
+void page_pool_clock_gives_second_chance()
+{
+    page_pool_t *pool = page_pool_init(64, 3, EVICTION_POLICY_CLOCK);
+    vmTable_t *frames[3];
+    for (size_t i = 0; i < 3; i++)
+    {
+        // the pool is not full yet, free frames come first
+        frames[i] = page_pool_select_victim(pool, i + 10);
+        TEST_ASSERT_NOT_NULL(frames[i]);
+        TEST_ASSERT_FALSE(frames[i]->mapped);
+        page_pool_map(pool, frames[i], i + 10, (i + 10) * 64);
+    }
+    TEST_ASSERT_EQUAL(3, page_pool_count(pool));
+    TEST_ASSERT_TRUE(page_pool_lookup(pool, 11) == frames[1]);
+    TEST_ASSERT_NULL(page_pool_lookup(pool, 13));
+
+    // all frames were just mapped, the first sweep clears every referenced bit
+    page_pool_touch(pool, frames[1]);
+    vmm_pin_page(frames[0]);
+    vmTable_t *victim = page_pool_select_victim(pool, 13);
+    TEST_ASSERT_TRUE(victim == frames[1]);
+    page_pool_unmap(pool, victim);
+    page_pool_map(pool, victim, 13, 13 * 64);
+
+    // page 12 lost its referenced bit in the first sweep, page 13 was just mapped
+    victim = page_pool_select_victim(pool, 14);
+    TEST_ASSERT_TRUE(victim == frames[2]);
+
+    page_pool_unmap(pool, victim);
+    TEST_ASSERT_NULL(page_pool_lookup(pool, 12));
+    TEST_ASSERT_EQUAL(2, page_pool_count(pool));
+
+    vmm_pin_page(frames[1]);
+    page_pool_map(pool, victim, 12, 12 * 64);
+    vmm_pin_page(victim);
+    TEST_ASSERT_NULL(page_pool_select_victim(pool, 14));
+    page_pool_free(pool);
+}
+
+void stats_count_tiers_and_evictions()
+{
+    // 4 resident pages, 2 himem blocks, 16 pages of guest memory
+    VMM_t *vmm = vmm_create("pagefile7.bin", 16 * 1024, 1024, 4, 2);
+    char buffer[8] = "stats";
+    for (size_t addr = 0; addr < 16 * 1024; addr += 1024)
+    {
+        vmm_write(vmm, addr, buffer, sizeof(buffer));
+    }
+    vmm_read(vmm, 15 * 1024, buffer, sizeof(buffer));
+
+    vmm_stats_t stats;
+    vmm_get_stats(vmm, &stats);
+    TEST_ASSERT_EQUAL(16, stats.writes);
+    TEST_ASSERT_EQUAL(16 * sizeof(buffer), stats.write_bytes);
+    TEST_ASSERT_EQUAL(1, stats.reads);
+    TEST_ASSERT_EQUAL(16, stats.page_faults);
+    TEST_ASSERT_EQUAL(12, stats.evictions);
+    TEST_ASSERT_EQUAL(12, stats.dirty_writebacks);
+    TEST_ASSERT_EQUAL(10, stats.store_writes);
+    // first touches are zero pages, they never reach the page cache or backing store
+    TEST_ASSERT_EQUAL(16, stats.zero_fills);
+    TEST_ASSERT_EQUAL(0, stats.store_reads + stats.page_cache_hits);
+    TEST_ASSERT_EQUAL(1, stats.direct_cache_hits + stats.page_pool_hits);
+
+    size_t latency_samples = 0;
+    for (size_t i = 0; i < VMM_LATENCY_BUCKETS; i++)
+    {
+        latency_samples += stats.store_read_latency[i];
+    }
+    TEST_ASSERT_EQUAL(stats.store_reads, latency_samples);
+
+    vmm_reset_stats(vmm);
+    vmm_get_stats(vmm, &stats);
+    TEST_ASSERT_EQUAL(0, stats.page_faults);
+    vmm_destroy(vmm);
+}
+
+void trace_records_page_stream()
+{
+    VMM_t *vmm = vmm_create("pagefile8.bin", 16 * 1024, 1024, 4, 2);
+    TEST_ASSERT_TRUE(vmm_trace_start(vmm, "pagefile8.trace"));
+    char buffer[4] = "abc";
+    vmm_write(vmm, 3 * 1024, buffer, sizeof(buffer));
+    vmm_read(vmm, 1024, buffer, sizeof(buffer));
+    vmm_get_code_page(vmm, 1024);
+    vmm_trace_stop(vmm);
+    vmm_destroy(vmm);
+
+    uint8_t trace[32];
+    FILE *f = fopen("pagefile8.trace", "rb");
+    TEST_ASSERT_NOT_NULL(f);
+    size_t length = fread(trace, 1, sizeof(trace), f);
+    fclose(f);
+
+    TEST_ASSERT_EQUAL(15, length);
+    TEST_ASSERT_EQUAL_MEMORY(VMM_TRACE_MAGIC, trace, 8);
+    TEST_ASSERT_EQUAL(1024, trace[8] | (trace[9] << 8));
+    // page 3 written, page 1 read (delta -2), page 1 executed (delta 0)
+    TEST_ASSERT_EQUAL((6 << 2) | VMM_ACCESS_WRITE, trace[12]);
+    TEST_ASSERT_EQUAL((3 << 2) | VMM_ACCESS_READ, trace[13]);
+    TEST_ASSERT_EQUAL((0 << 2) | VMM_ACCESS_CODE, trace[14]);
+}
+
+void flush_merges_adjacent_dirty_pages()
+{
+    VMM_t *vmm = vmm_create("pagefile9.bin", 16 * 1024, 1024, 16, 16);
+    char buffer[16];
+    // pages 0 to 7 written backwards and page 10 apart from them
+    for (int page = 7; page >= 0; page--)
+    {
+        sprintf(buffer, "page %d", page);
+        vmm_write(vmm, page * 1024, buffer, strlen(buffer) + 1);
+    }
+    vmm_write(vmm, 10 * 1024, "page 10", 8);
+    vmm_flush(vmm);
+
+    vmm_stats_t stats;
+    vmm_get_stats(vmm, &stats);
+    TEST_ASSERT_EQUAL(9, stats.dirty_writebacks);
+    TEST_ASSERT_EQUAL(9, stats.store_writes);
+    TEST_ASSERT_EQUAL((8 + PAGE_CACHE_BATCH - 1) / PAGE_CACHE_BATCH + 1, stats.store_write_requests);
+
+    // nothing is dirty after the flush
+    vmm_flush(vmm);
+    vmm_get_stats(vmm, &stats);
+    TEST_ASSERT_EQUAL(9, stats.store_writes);
+
+    FILE *f = fopen("pagefile9.bin", "rb");
+    TEST_ASSERT_NOT_NULL(f);
+    for (int page = 0; page < 8; page++)
+    {
+        char expected[16];
+        sprintf(expected, "page %d", page);
+        fseek(f, page * 1024, SEEK_SET);
+        TEST_ASSERT_EQUAL(sizeof(buffer), fread(buffer, 1, sizeof(buffer), f));
+        TEST_ASSERT_EQUAL_STRING(expected, buffer);
+    }
+    fclose(f);
+    vmm_destroy(vmm);
+}
+
+void full_pool_evicts_in_batches()
+{
+    // 16 resident pages evict a quarter of the pool at a time
+    VMM_t *vmm = vmm_create("pagefile10.bin", 64 * 1024, 1024, 16, 16);
+    vmm_set_readahead(vmm, 0);
+    char buffer[4];
+    for (size_t page = 0; page < 16; page++)
+    {
+        vmm_read(vmm, page * 1024, buffer, 1);
+    }
+    vmm_stats_t stats;
+    vmm_get_stats(vmm, &stats);
+    TEST_ASSERT_EQUAL(0, stats.evictions);
+
+    vmm_read(vmm, 16 * 1024, buffer, 1);
+    vmm_get_stats(vmm, &stats);
+    TEST_ASSERT_EQUAL(4, stats.evictions);
+
+    for (size_t page = 17; page < 20; page++)
+    {
+        vmm_read(vmm, page * 1024, buffer, 1);
+    }
+    vmm_get_stats(vmm, &stats);
+    TEST_ASSERT_EQUAL(4, stats.evictions);
+    TEST_ASSERT_EQUAL(20, stats.page_faults);
+
+    vmm_read(vmm, 20 * 1024, buffer, 1);
+    vmm_get_stats(vmm, &stats);
+    TEST_ASSERT_EQUAL(8, stats.evictions);
+    vmm_destroy(vmm);
+}
+
+static volatile bool writer_released;
+static size_t written_pages[4];
+static size_t number_of_written_pages;
+
+static void on_write_page(void *context, size_t page_number, const uint8_t *page)
+{
+    (void)context;
+    (void)page;
+    while (!writer_released)
+    {
+        usleep(1000);
+    }
+    written_pages[number_of_written_pages++] = page_number;
+}
+
+void write_behind_keeps_queued_pages_readable()
+{
+    writer_released = false;
+    number_of_written_pages = 0;
+    write_behind_t *write_behind = write_behind_init(16, 2, on_write_page, NULL);
+    uint8_t page[16] = "first";
+    write_behind_push(write_behind, 1, page);
+    memcpy(page, "second", 7);
+    write_behind_push(write_behind, 2, page);
+
+    // the writer is held back, both pages are still queued
+    TEST_ASSERT_FALSE(write_behind_read(write_behind, 3, page));
+    TEST_ASSERT_TRUE(write_behind_read(write_behind, 1, page));
+    TEST_ASSERT_EQUAL_STRING("first", (char *)page);
+    TEST_ASSERT_TRUE(write_behind_read(write_behind, 2, page));
+    TEST_ASSERT_EQUAL_STRING("second", (char *)page);
+    writer_released = true;
+
+    write_behind_drain(write_behind);
+    TEST_ASSERT_FALSE(write_behind_read(write_behind, 1, page));
+    TEST_ASSERT_EQUAL(2, number_of_written_pages);
+    TEST_ASSERT_EQUAL(1, written_pages[0]);
+    TEST_ASSERT_EQUAL(2, written_pages[1]);
+    write_behind_free(write_behind);
+}
+
+void vmm_write_behind_read_write()
+{
+    VMM_t *vmm = vmm_create("pagefile11.bin", 64 * 1024, 1024, 4, 4);
+    TEST_ASSERT_TRUE(vmm_start_write_behind(vmm, 2));
+    char buffer[16];
+    for (int round = 0; round < 2; round++)
+    {
+        for (int page = 0; page < 64; page++)
+        {
+            sprintf(buffer, "page %d %d", page, round);
+            vmm_write(vmm, page * 1024 + 100, buffer, strlen(buffer) + 1);
+        }
+        for (int page = 63; page >= 0; page--)
+        {
+            char expected[16];
+            sprintf(expected, "page %d %d", page, round);
+            vmm_read(vmm, page * 1024 + 100, buffer, strlen(expected) + 1);
+            TEST_ASSERT_EQUAL_STRING(expected, buffer);
+        }
+    }
+    vmm_flush(vmm);
+
+    vmm_stats_t stats;
+    vmm_get_stats(vmm, &stats);
+    TEST_ASSERT_EQUAL(stats.page_faults, stats.zero_fills + stats.write_behind_hits + stats.page_cache_hits + stats.store_reads);
+
+    FILE *f = fopen("pagefile11.bin", "rb");
+    TEST_ASSERT_NOT_NULL(f);
+    fseek(f, 5 * 1024 + 100, SEEK_SET);
+    TEST_ASSERT_EQUAL(sizeof(buffer), fread(buffer, 1, sizeof(buffer), f));
+    TEST_ASSERT_EQUAL_STRING("page 5 1", buffer);
+    fclose(f);
+    vmm_destroy(vmm);
+}
+
+void sequential_faults_read_ahead()
+{
+    // 128 pages of guest memory, 32 resident pages read up to 8 pages ahead
+    VMM_t *vmm = vmm_create("pagefile12.bin", 128 * 1024, 1024, 32, 4);
+    char buffer[16];
+    for (int page = 0; page < 128; page++)
+    {
+        sprintf(buffer, "page %d", page);
+        vmm_write(vmm, page * 1024 + 8, buffer, strlen(buffer) + 1);
+    }
+    vmm_flush(vmm);
+    vmm_reset_stats(vmm);
+
+    for (int page = 0; page < 64; page++)
+    {
+        char expected[16];
+        sprintf(expected, "page %d", page);
+        vmm_read(vmm, page * 1024 + 8, buffer, strlen(expected) + 1);
+        TEST_ASSERT_EQUAL_STRING(expected, buffer);
+    }
+
+    vmm_stats_t stats;
+    vmm_get_stats(vmm, &stats);
+    TEST_ASSERT_EQUAL(64, stats.page_faults + stats.readahead_hits);
+    TEST_ASSERT_TRUE(stats.page_faults < 32);
+    TEST_ASSERT_TRUE(stats.store_read_bytes > stats.store_reads * 1024);
+
+    // a random fault does not read ahead, the unused read ahead pages can be dropped
+    vmm_read(vmm, 100 * 1024 + 8, buffer, 1);
+    vmm_cancel_readahead(vmm);
+    vmm_get_stats(vmm, &stats);
+    TEST_ASSERT_EQUAL(stats.readahead_pages, stats.readahead_hits + stats.readahead_wasted);
+    vmm_destroy(vmm);
+}
+
+void compressed_tier_keeps_evicted_pages()
+{
+    // 8 resident pages, a 16KB arena and 4 himem blocks for 128 pages of guest memory
+    VMM_t *vmm = vmm_create("pagefile13.bin", 128 * 1024, 1024, 8, 4);
+    vmm_set_readahead(vmm, 0);
+    TEST_ASSERT_TRUE(vmm_start_compressed_tier(vmm, 16 * 1024));
+    TEST_ASSERT_FALSE(vmm_start_compressed_tier(vmm, 16 * 1024));
+
+    char buffer[16];
+    for (int page = 0; page < 128; page++)
+    {
+        sprintf(buffer, "page %d", page);
+        vmm_write(vmm, page * 1024 + 8, buffer, strlen(buffer) + 1);
+    }
+    vmm_stats_t stats;
+    vmm_get_stats(vmm, &stats);
+    TEST_ASSERT_EQUAL(120, stats.compressed_stores);
+    TEST_ASSERT_EQUAL(0, stats.compressed_rejects);
+
+    vmm_reset_stats(vmm);
+    for (int page = 127; page >= 0; page--)
+    {
+        char expected[16];
+        sprintf(expected, "page %d", page);
+        vmm_read(vmm, page * 1024 + 8, buffer, strlen(expected) + 1);
+        TEST_ASSERT_EQUAL_STRING(expected, buffer);
+    }
+    vmm_get_stats(vmm, &stats);
+    TEST_ASSERT_TRUE(stats.compressed_hits > 100);
+    TEST_ASSERT_EQUAL(0, stats.store_reads);
+
+    // flushed pages reach the pagefile
+    vmm_flush(vmm);
+    vmm_destroy(vmm);
+    FILE *pagefile = fopen("pagefile13.bin", "rb");
+    TEST_ASSERT_NOT_NULL(pagefile);
+    for (int page = 0; page < 128; page++)
+    {
+        char expected[16];
+        sprintf(expected, "page %d", page);
+        fseek(pagefile, page * 1024 + 8, SEEK_SET);
+        TEST_ASSERT_EQUAL(strlen(expected) + 1, fread(buffer, 1, strlen(expected) + 1, pagefile));
+        TEST_ASSERT_EQUAL_STRING(expected, buffer);
+    }
+    fclose(pagefile);
+}
+
+void zero_pages_skip_backing_store()
+{
+    // 4 resident pages, 1 himem block, 1MB of guest memory
+    VMM_t *vmm = vmm_create("pagefile14.bin", 1024 * 1024, 1024, 4, 1);
+    vmm_set_readahead(vmm, 0);
+    char buffer[16] = "data";
+    char zeros[16] = {0};
+    vmm_write(vmm, 2 * 1024, buffer, sizeof(buffer));
+    vmm_write(vmm, 3 * 1024, buffer, sizeof(buffer));
+    vmm_write(vmm, 3 * 1024, zeros, sizeof(zeros));
+    for (int page = 100; page < 108; page++)
+    {
+        vmm_read(vmm, page * 1024, buffer, sizeof(buffer));
+        TEST_ASSERT_EQUAL_MEMORY(zeros, buffer, sizeof(buffer));
+    }
+
+    vmm_stats_t stats;
+    vmm_get_stats(vmm, &stats);
+    TEST_ASSERT_EQUAL(10, stats.zero_fills);
+    TEST_ASSERT_EQUAL(0, stats.store_reads);
+    TEST_ASSERT_EQUAL(1, stats.zero_writebacks);
+    TEST_ASSERT_EQUAL(1, stats.dirty_writebacks);
+
+    // the written page comes back from himem, the zeroed one from the zero page
+    vmm_read(vmm, 2 * 1024, buffer, sizeof(buffer));
+    TEST_ASSERT_EQUAL_STRING("data", buffer);
+    vmm_read(vmm, 3 * 1024, buffer, sizeof(buffer));
+    TEST_ASSERT_EQUAL_MEMORY(zeros, buffer, sizeof(buffer));
+    vmm_get_stats(vmm, &stats);
+    TEST_ASSERT_EQUAL(1, stats.store_reads + stats.page_cache_hits);
+    TEST_ASSERT_EQUAL(11, stats.zero_fills);
+    vmm_destroy(vmm);
+
+    // the pagefile only extends to the last page written
+    FILE *pagefile = fopen("pagefile14.bin", "rb");
+    TEST_ASSERT_NOT_NULL(pagefile);
+    fseek(pagefile, 0, SEEK_END);
+    TEST_ASSERT_EQUAL(3 * 1024, ftell(pagefile));
+    fclose(pagefile);
+}
+
+void snapshot_resumes_touched_pages()
+{
+    // 8 resident pages for 64 pages of guest memory, every fourth page is touched
+    VMM_t *vmm = vmm_create("pagefile15.bin", 64 * 1024, 1024, 8, 4);
+    char buffer[16];
+    for (int page = 0; page < 64; page += 4)
+    {
+        sprintf(buffer, "page %d", page);
+        vmm_write(vmm, page * 1024 + 8, buffer, strlen(buffer) + 1);
+    }
+    TEST_ASSERT_TRUE(vmm_snapshot_save(vmm, "pagefile15.snap"));
+    vmm_destroy(vmm);
+
+    vmm = vmm_create("pagefile15.bin", 64 * 1024, 1024, 8, 4);
+    TEST_ASSERT_TRUE(vmm_snapshot_load(vmm, "pagefile15.snap"));
+    TEST_ASSERT_EQUAL(16, vmm->snapshot_count);
+    vmm_write(vmm, 8 * 1024 + 8, "changed", 8);
+    for (int page = 63; page >= 0; page--)
+    {
+        char expected[16] = {0};
+        if (page == 8)
+        {
+            strcpy(expected, "changed");
+        }
+        else if (page % 4 == 0)
+        {
+            sprintf(expected, "page %d", page);
+        }
+        vmm_read(vmm, page * 1024 + 8, buffer, sizeof(buffer));
+        TEST_ASSERT_EQUAL_STRING(expected, buffer);
+    }
+    vmm_stats_t stats;
+    vmm_get_stats(vmm, &stats);
+    TEST_ASSERT_TRUE(stats.snapshot_reads >= 16);
+    TEST_ASSERT_EQUAL(48, stats.zero_fills);
+
+    // saving again replaces the snapshot the pages are faulted in from
+    TEST_ASSERT_TRUE(vmm_snapshot_save(vmm, "pagefile15.snap"));
+    vmm_read(vmm, 8 * 1024 + 8, buffer, sizeof(buffer));
+    TEST_ASSERT_EQUAL_STRING("changed", buffer);
+    vmm_destroy(vmm);
+
+    vmm = vmm_create("pagefile15.bin", 64 * 1024, 1024, 8, 4);
+    TEST_ASSERT_TRUE(vmm_snapshot_load(vmm, "pagefile15.snap"));
+    vmm_read(vmm, 8 * 1024 + 8, buffer, sizeof(buffer));
+    TEST_ASSERT_EQUAL_STRING("changed", buffer);
+    vmm_read(vmm, 60 * 1024 + 8, buffer, sizeof(buffer));
+    TEST_ASSERT_EQUAL_STRING("page 60", buffer);
+    TEST_ASSERT_FALSE(vmm_snapshot_load(vmm, "pagefile15.snap"));
+    vmm_destroy(vmm);
+
+    // a snapshot of different geometry is rejected
+    vmm = vmm_create("pagefile15.bin", 32 * 1024, 1024, 8, 4);
+    TEST_ASSERT_FALSE(vmm_snapshot_load(vmm, "pagefile15.snap"));
+    vmm_destroy(vmm);
+}
+
+void persistent_pagefile_keeps_persisted_pages()
+{
+    // pages 0 to 3 are persisted, then page 1 is changed and page 2 is zeroed
+    VMM_t *vmm = vmm_create_persistent("pagefile16.bin", 64 * 1024, 1024, 8, 4, EVICTION_POLICY_CLOCK, 1);
+    TEST_ASSERT_FALSE(vmm_is_persistent(vmm, 0, 4 * 1024));
+    char buffer[16];
+    for (int page = 0; page < 4; page++)
+    {
+        sprintf(buffer, "page %d", page);
+        vmm_write(vmm, page * 1024 + 8, buffer, strlen(buffer) + 1);
+    }
+    TEST_ASSERT_TRUE(vmm_persist(vmm));
+    TEST_ASSERT_TRUE(vmm_is_persistent(vmm, 0, 4 * 1024));
+    TEST_ASSERT_FALSE(vmm_is_persistent(vmm, 0, 5 * 1024));
+    vmm_write(vmm, 1 * 1024 + 8, "changed", 8);
+    TEST_ASSERT_FALSE(vmm_is_persistent(vmm, 1 * 1024, 1));
+    memset(buffer, 0, sizeof(buffer));
+    vmm_write(vmm, 2 * 1024 + 8, buffer, sizeof(buffer));
+    vmm_destroy(vmm);
+
+    // the changed page dropped out, the zeroed page still has its persisted contents
+    vmm = vmm_create_persistent("pagefile16.bin", 64 * 1024, 1024, 8, 4, EVICTION_POLICY_CLOCK, 1);
+    TEST_ASSERT_TRUE(vmm_is_persistent(vmm, 0, 1024));
+    TEST_ASSERT_FALSE(vmm_is_persistent(vmm, 1 * 1024, 1024));
+    TEST_ASSERT_TRUE(vmm_is_persistent(vmm, 2 * 1024, 2 * 1024));
+    const char *expected[] = {"page 0", "", "page 2", "page 3", ""};
+    for (int page = 0; page < 5; page++)
+    {
+        vmm_read(vmm, page * 1024 + 8, buffer, sizeof(buffer));
+        TEST_ASSERT_EQUAL_STRING(expected[page], buffer);
+    }
+    vmm_stats_t stats;
+    vmm_get_stats(vmm, &stats);
+    TEST_ASSERT_EQUAL(2, stats.zero_fills);
+    vmm_destroy(vmm);
+
+    // another generation or a VMM that is not persistent starts from an empty pagefile
+    vmm = vmm_create_persistent("pagefile16.bin", 64 * 1024, 1024, 8, 4, EVICTION_POLICY_CLOCK, 2);
+    TEST_ASSERT_FALSE(vmm_is_persistent(vmm, 0, 1024));
+    vmm_read(vmm, 8, buffer, sizeof(buffer));
+    TEST_ASSERT_EQUAL_STRING("", buffer);
+    vmm_write(vmm, 8, "page 0", 7);
+    TEST_ASSERT_TRUE(vmm_persist(vmm));
+    vmm_destroy(vmm);
+
+    vmm = vmm_create("pagefile16.bin", 64 * 1024, 1024, 8, 4);
+    TEST_ASSERT_FALSE(vmm_persist(vmm));
+    vmm_destroy(vmm);
+    vmm = vmm_create_persistent("pagefile16.bin", 64 * 1024, 1024, 8, 4, EVICTION_POLICY_CLOCK, 2);
+    TEST_ASSERT_FALSE(vmm_is_persistent(vmm, 0, 1024));
+    vmm_destroy(vmm);
+}
+
+void base_image_is_shared_copy_on_write()
+{
+    VMM_t *vmm = vmm_create("pagefile17.bin", 64 * 1024, 1024, 8, 4);
+    char buffer[16];
+    for (int page = 0; page < 4; page++)
+    {
+        sprintf(buffer, "page %d", page);
+        vmm_write(vmm, page * 1024 + 8, buffer, strlen(buffer) + 1);
+    }
+    TEST_ASSERT_TRUE(vmm_save_base(vmm, "pagefile17.base", 7));
+    vmm_destroy(vmm);
+
+    // two overlays of the same base, only the changed page reaches their pagefiles
+    VMM_t *first = vmm_create("pagefile17a.bin", 64 * 1024, 1024, 8, 4);
+    VMM_t *second = vmm_create("pagefile17b.bin", 64 * 1024, 1024, 8, 4);
+    TEST_ASSERT_TRUE(vmm_attach_base(first, "pagefile17.base", 7));
+    TEST_ASSERT_TRUE(vmm_attach_base(second, "pagefile17.base", 7));
+    TEST_ASSERT_TRUE(vmm_is_persistent(first, 0, 4 * 1024));
+    vmm_write(first, 1 * 1024 + 8, "changed", 8);
+    TEST_ASSERT_FALSE(vmm_is_persistent(first, 1 * 1024, 1));
+    vmm_flush(first);
+    for (int page = 0; page < 4; page++)
+    {
+        char expected[16];
+        sprintf(expected, "page %d", page);
+        vmm_read(second, page * 1024 + 8, buffer, sizeof(buffer));
+        TEST_ASSERT_EQUAL_STRING(expected, buffer);
+        vmm_read(first, page * 1024 + 8, buffer, sizeof(buffer));
+        TEST_ASSERT_EQUAL_STRING(page == 1 ? "changed" : expected, buffer);
+    }
+    FILE *f = fopen("pagefile17a.bin", "rb");
+    fseek(f, 0, SEEK_END);
+    TEST_ASSERT_EQUAL(2 * 1024, ftell(f));
+    fclose(f);
+    vmm_destroy(first);
+    vmm_destroy(second);
+
+    // the base is never written, another generation is rejected
+    vmm = vmm_create("pagefile17a.bin", 64 * 1024, 1024, 8, 4);
+    TEST_ASSERT_FALSE(vmm_attach_base(vmm, "pagefile17.base", 8));
+    TEST_ASSERT_TRUE(vmm_attach_base(vmm, "pagefile17.base", 7));
+    vmm_read(vmm, 1 * 1024 + 8, buffer, sizeof(buffer));
+    TEST_ASSERT_EQUAL_STRING("page 1", buffer);
+    vmm_destroy(vmm);
+}
+
 int main()
 {
     UNITY_BEGIN(); // IMPORTANT LINE!
@@ -104,5 +798,23 @@ int main()
     RUN_TEST(write_1st_page);
     RUN_TEST(write_1st_page_at_start_write_2nd_page_at_1MB);
     RUN_TEST(write_sequential_and_verify);
+    RUN_TEST(page_ptr_and_evict_callback);
+    RUN_TEST(pinned_page_is_not_evicted);
+    RUN_TEST(acquire_ptr_stays_dirty_while_pinned);
+    RUN_TEST(flush_cleans_pinned_page);
+    RUN_TEST(mmap_backend_read_write);
+    RUN_TEST(page_pool_clock_gives_second_chance);
+    RUN_TEST(stats_count_tiers_and_evictions);
+    RUN_TEST(trace_records_page_stream);
+    RUN_TEST(flush_merges_adjacent_dirty_pages);
+    RUN_TEST(full_pool_evicts_in_batches);
+    RUN_TEST(write_behind_keeps_queued_pages_readable);
+    RUN_TEST(vmm_write_behind_read_write);
+    RUN_TEST(sequential_faults_read_ahead);
+    RUN_TEST(compressed_tier_keeps_evicted_pages);
+    RUN_TEST(zero_pages_skip_backing_store);
+    RUN_TEST(snapshot_resumes_touched_pages);
+    RUN_TEST(persistent_pagefile_keeps_persisted_pages);
+    RUN_TEST(base_image_is_shared_copy_on_write);
     UNITY_END(); // stop unit testing
 }
\ No newline at end of file
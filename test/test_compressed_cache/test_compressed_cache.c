@@ -0,0 +1,183 @@
+
+#include <unity.h>
+#include <runner.h>
+
+#include <compressed_cache.h>
+#include <lz.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PAGE_SIZE 1024
+
+void setUp()
+{
+}
+void tearDown()
+{
+}
+
+static void fill_text(uint8_t *page, size_t page_number)
+{
+    memset(page, 0, PAGE_SIZE);
+    for (size_t offset = 0; offset + 32 < PAGE_SIZE; offset += 64)
+    {
+        sprintf((char *)page + offset, "page %d offset %d", (int)page_number, (int)offset);
+    }
+}
+
+static void fill_random(uint8_t *page, unsigned seed)
+{
+    srand(seed);
+    for (size_t i = 0; i < PAGE_SIZE; i++)
+    {
+        page[i] = rand() & 0xff;
+    }
+}
+
+void test_lz_round_trip(){
+    static uint16_t hash_table[LZ_HASH_SIZE];
+    uint8_t page[PAGE_SIZE];
+    uint8_t compressed[PAGE_SIZE * 2];
+    uint8_t decompressed[PAGE_SIZE];
+
+    fill_text(page, 1);
+    size_t size = lz_compress(page, PAGE_SIZE, compressed, sizeof(compressed), hash_table);
+    TEST_ASSERT_TRUE(size > 0 && size < PAGE_SIZE / 2);
+    TEST_ASSERT_TRUE(lz_decompress(compressed, size, decompressed, PAGE_SIZE));
+    TEST_ASSERT_EQUAL_MEMORY(page, decompressed, PAGE_SIZE);
+    TEST_ASSERT_FALSE(lz_decompress(compressed, size - 1, decompressed, PAGE_SIZE));
+
+    // random data does not compress but still round trips
+    fill_random(page, 1);
+    size = lz_compress(page, PAGE_SIZE, compressed, sizeof(compressed), hash_table);
+    TEST_ASSERT_TRUE(size > PAGE_SIZE);
+    TEST_ASSERT_TRUE(lz_decompress(compressed, size, decompressed, PAGE_SIZE));
+    TEST_ASSERT_EQUAL_MEMORY(page, decompressed, PAGE_SIZE);
+    TEST_ASSERT_EQUAL(0, lz_compress(page, PAGE_SIZE, compressed, PAGE_SIZE, hash_table));
+
+    // short inputs are stored as literals
+    size = lz_compress((const uint8_t *)"abc", 3, compressed, sizeof(compressed), hash_table);
+    TEST_ASSERT_TRUE(lz_decompress(compressed, size, decompressed, 3));
+    TEST_ASSERT_EQUAL_MEMORY("abc", decompressed, 3);
+}
+
+static size_t evicted[64];
+static size_t number_of_evicted;
+static size_t flushed_calls;
+static size_t flushed_pages;
+
+static void on_evict(size_t page_number, void *buf, void *context)
+{
+    uint8_t expected[PAGE_SIZE];
+    fill_text(expected, page_number);
+    TEST_ASSERT_EQUAL_MEMORY(expected, buf, PAGE_SIZE);
+    evicted[number_of_evicted++] = page_number;
+}
+
+static void on_flush(size_t page_number, void *buf, size_t number_of_pages, void *context)
+{
+    for (size_t i = 0; i < number_of_pages; i++)
+    {
+        uint8_t expected[PAGE_SIZE];
+        fill_text(expected, page_number + i);
+        TEST_ASSERT_EQUAL_MEMORY(expected, (uint8_t *)buf + i * PAGE_SIZE, PAGE_SIZE);
+    }
+    flushed_calls++;
+    flushed_pages += number_of_pages;
+}
+
+void test_set_get(){
+    compressed_cache_t *cache = compressed_cache_init(PAGE_SIZE, 4 * PAGE_SIZE, EVICTION_POLICY_LRU, on_evict, on_flush, NULL);
+    uint8_t page[PAGE_SIZE];
+    uint8_t read_page[PAGE_SIZE];
+
+    fill_text(page, 3);
+    TEST_ASSERT_TRUE(compressed_cache_set(cache, 3, page));
+    memset(page, 0, PAGE_SIZE);
+    TEST_ASSERT_TRUE(compressed_cache_set(cache, 4, page));
+    TEST_ASSERT_TRUE(compressed_cache_contains(cache, 3));
+    TEST_ASSERT_FALSE(compressed_cache_get(cache, 5, read_page));
+
+    fill_text(page, 3);
+    TEST_ASSERT_TRUE(compressed_cache_get(cache, 3, read_page));
+    TEST_ASSERT_EQUAL_MEMORY(page, read_page, PAGE_SIZE);
+    memset(page, 0, PAGE_SIZE);
+    TEST_ASSERT_TRUE(compressed_cache_get(cache, 4, read_page));
+    TEST_ASSERT_EQUAL_MEMORY(page, read_page, PAGE_SIZE);
+
+    size_t pages, compressed_bytes, arena_bytes;
+    compressed_cache_get_stats(cache, &pages, &compressed_bytes, &arena_bytes);
+    TEST_ASSERT_EQUAL(2, pages);
+    TEST_ASSERT_TRUE(compressed_bytes < PAGE_SIZE / 2);
+    TEST_ASSERT_EQUAL(0, arena_bytes % COMPRESSED_CACHE_CHUNK);
+
+    // an incompressible page drops the older copy
+    fill_random(page, 2);
+    TEST_ASSERT_FALSE(compressed_cache_set(cache, 3, page));
+    TEST_ASSERT_FALSE(compressed_cache_contains(cache, 3));
+    compressed_cache_free(cache);
+}
+
+void test_full_arena_evicts_dirty_pages(){
+    number_of_evicted = 0;
+    compressed_cache_t *cache = compressed_cache_init(PAGE_SIZE, 2 * PAGE_SIZE, EVICTION_POLICY_LRU, on_evict, on_flush, NULL);
+    uint8_t page[PAGE_SIZE];
+    for (size_t page_number = 0; page_number < 32; page_number++)
+    {
+        fill_text(page, page_number);
+        TEST_ASSERT_TRUE(compressed_cache_set(cache, page_number, page));
+    }
+    TEST_ASSERT_TRUE(number_of_evicted > 0);
+    TEST_ASSERT_EQUAL(0, evicted[0]);
+    TEST_ASSERT_TRUE(compressed_cache_contains(cache, 31));
+    for (size_t i = 0; i < number_of_evicted; i++)
+    {
+        TEST_ASSERT_FALSE(compressed_cache_contains(cache, evicted[i]));
+    }
+
+    // more pages fit than in the same memory uncompressed
+    size_t pages, compressed_bytes, arena_bytes;
+    compressed_cache_get_stats(cache, &pages, &compressed_bytes, &arena_bytes);
+    TEST_ASSERT_EQUAL(32 - number_of_evicted, pages);
+    TEST_ASSERT_TRUE(pages > 2);
+    compressed_cache_free(cache);
+}
+
+void test_flush_merges_adjacent_pages(){
+    flushed_calls = 0;
+    flushed_pages = 0;
+    compressed_cache_t *cache = compressed_cache_init(PAGE_SIZE, 8 * PAGE_SIZE, EVICTION_POLICY_CLOCK, on_evict, on_flush, NULL);
+    uint8_t page[PAGE_SIZE];
+    size_t page_numbers[] = {7, 5, 6, 4, 20};
+    for (size_t i = 0; i < 5; i++)
+    {
+        fill_text(page, page_numbers[i]);
+        TEST_ASSERT_TRUE(compressed_cache_set(cache, page_numbers[i], page));
+    }
+    compressed_cache_flush(cache);
+    TEST_ASSERT_EQUAL(5, flushed_pages);
+    TEST_ASSERT_EQUAL(2, flushed_calls);
+
+    // clean pages are not flushed again
+    compressed_cache_flush(cache);
+    TEST_ASSERT_EQUAL(2, flushed_calls);
+    compressed_cache_free(cache);
+}
+
+
+void process()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_lz_round_trip);
+    RUN_TEST(test_set_get);
+    RUN_TEST(test_full_arena_evicts_dirty_pages);
+    RUN_TEST(test_flush_merges_adjacent_pages);
+    UNITY_END();
+}
+
+MAIN()
+{
+    process();
+}
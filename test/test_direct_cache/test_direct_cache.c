@@ -64,6 +64,53 @@ void test_clear_cell(){
     direct_cache_free(cache);
 }
 
+void test_set_associative_keeps_colliding_keys(){
+    // 2 sets of 4 ways, even keys share set 0
+    direct_cache_t * cache = direct_cache_init_ways(8, 4);
+
+    direct_cache_set(cache, (void*)0, (void*)10);
+    direct_cache_set(cache, (void*)2, (void*)12);
+    direct_cache_set(cache, (void*)4, (void*)14);
+    direct_cache_set(cache, (void*)6, (void*)16);
+
+    TEST_ASSERT_EQUAL(10, direct_cache_get(cache,(void*)0));
+    TEST_ASSERT_EQUAL(12, direct_cache_get(cache,(void*)2));
+    TEST_ASSERT_EQUAL(14, direct_cache_get(cache,(void*)4));
+    TEST_ASSERT_EQUAL(16, direct_cache_get(cache,(void*)6));
+
+    // 4 points the tree at the left half, where 0 was touched least recently
+    direct_cache_get(cache,(void*)4);
+    direct_cache_set(cache, (void*)8, (void*)18);
+    TEST_ASSERT_EQUAL(NULL, direct_cache_get(cache,(void*)0));
+    TEST_ASSERT_EQUAL(18, direct_cache_get(cache,(void*)8));
+    TEST_ASSERT_EQUAL(14, direct_cache_get(cache,(void*)4));
+
+    direct_cache_remove(cache, (void*)4);
+    TEST_ASSERT_EQUAL(NULL, direct_cache_get(cache,(void*)4));
+    direct_cache_set(cache, (void*)10, (void*)20);
+    TEST_ASSERT_EQUAL(16, direct_cache_get(cache,(void*)6));
+    TEST_ASSERT_EQUAL(20, direct_cache_get(cache,(void*)10));
+
+    size_t hits, misses;
+    direct_cache_get_stats(cache, &hits, &misses);
+    TEST_ASSERT_EQUAL(9, hits);
+    TEST_ASSERT_EQUAL(2, misses);
+
+    direct_cache_free(cache);
+}
+
+void test_more_than_65536_lines(){
+    direct_cache_t * cache = direct_cache_init_ways(1024 * 128, 2);
+
+    direct_cache_set(cache, (void*)70000, (void*)1);
+    direct_cache_set(cache, (void*)(70000 - 65536), (void*)2);
+
+    TEST_ASSERT_EQUAL(1, direct_cache_get(cache,(void*)70000));
+    TEST_ASSERT_EQUAL(2, direct_cache_get(cache,(void*)(70000 - 65536)));
+
+    direct_cache_free(cache);
+}
+
 
 void process()
 {
@@ -72,6 +119,8 @@ void process()
     RUN_TEST(test_different_cells);
     RUN_TEST(test_same_cells);
     RUN_TEST(test_clear_cell);
+    RUN_TEST(test_set_associative_keeps_colliding_keys);
+    RUN_TEST(test_more_than_65536_lines);
 
     UNITY_END();
 }
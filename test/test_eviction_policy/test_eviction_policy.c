@@ -0,0 +1,154 @@
+
+#include <unity.h>
+#include <runner.h>
+
+#include <eviction_policy.h>
+
+void setUp()
+{
+}
+void tearDown()
+{
+}
+
+static bool not_pinned(void *context, size_t slot)
+{
+    bool *pinned = context;
+    return !pinned[slot];
+}
+
+void test_parse(){
+    eviction_policy_type_t type;
+    TEST_ASSERT_TRUE(eviction_policy_parse("lru", &type));
+    TEST_ASSERT_EQUAL(EVICTION_POLICY_LRU, type);
+    TEST_ASSERT_TRUE(eviction_policy_parse("arc", &type));
+    TEST_ASSERT_EQUAL(EVICTION_POLICY_ARC, type);
+    TEST_ASSERT_TRUE(eviction_policy_parse("clock", &type));
+    TEST_ASSERT_EQUAL(EVICTION_POLICY_CLOCK, type);
+    TEST_ASSERT_FALSE(eviction_policy_parse("fifo", &type));
+}
+
+void test_lru_evicts_least_recently_used(){
+    eviction_policy_t *policy = eviction_policy_init(EVICTION_POLICY_LRU, 4);
+    for (size_t slot = 0; slot < 4; slot++)
+    {
+        eviction_policy_insert(policy, slot, slot + 100);
+    }
+    eviction_policy_access(policy, 0);
+    eviction_policy_access(policy, 2);
+
+    TEST_ASSERT_EQUAL(1, eviction_policy_victim(policy, 200, NULL, NULL));
+    TEST_ASSERT_EQUAL(3, eviction_policy_victim(policy, 201, NULL, NULL));
+    eviction_policy_insert(policy, 1, 200);
+    TEST_ASSERT_EQUAL(0, eviction_policy_victim(policy, 202, NULL, NULL));
+
+    eviction_policy_remove(policy, 2);
+    eviction_policy_remove(policy, 2);
+    TEST_ASSERT_EQUAL(1, eviction_policy_victim(policy, 203, NULL, NULL));
+    TEST_ASSERT_EQUAL(EVICTION_POLICY_NONE, eviction_policy_victim(policy, 204, NULL, NULL));
+    eviction_policy_free(policy);
+}
+
+void test_clock_gives_second_chance(){
+    eviction_policy_t *policy = eviction_policy_init(EVICTION_POLICY_CLOCK, 3);
+    for (size_t slot = 0; slot < 3; slot++)
+    {
+        eviction_policy_insert(policy, slot, slot);
+    }
+
+    // the first sweep clears every referenced bit
+    TEST_ASSERT_EQUAL(0, eviction_policy_victim(policy, 3, NULL, NULL));
+    eviction_policy_insert(policy, 0, 3);
+    eviction_policy_access(policy, 1);
+    TEST_ASSERT_EQUAL(2, eviction_policy_victim(policy, 4, NULL, NULL));
+    // slot 0 was filled after the sweep and gets its second chance
+    TEST_ASSERT_EQUAL(1, eviction_policy_victim(policy, 5, NULL, NULL));
+    eviction_policy_free(policy);
+}
+
+void test_victim_skips_pinned_slots(){
+    eviction_policy_type_t types[] = {EVICTION_POLICY_CLOCK, EVICTION_POLICY_LRU, EVICTION_POLICY_ARC};
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++)
+    {
+        bool pinned[3] = {true, false, true};
+        eviction_policy_t *policy = eviction_policy_init(types[i], 3);
+        for (size_t slot = 0; slot < 3; slot++)
+        {
+            eviction_policy_insert(policy, slot, slot);
+        }
+        TEST_ASSERT_EQUAL(1, eviction_policy_victim(policy, 3, not_pinned, pinned));
+        TEST_ASSERT_EQUAL(EVICTION_POLICY_NONE, eviction_policy_victim(policy, 4, not_pinned, pinned));
+        pinned[2] = false;
+        TEST_ASSERT_EQUAL(2, eviction_policy_victim(policy, 4, not_pinned, pinned));
+        eviction_policy_free(policy);
+    }
+}
+
+void test_arc_resists_scans(){
+    eviction_policy_t *policy = eviction_policy_init(EVICTION_POLICY_ARC, 4);
+    size_t keys[4];
+
+    // keys 0 and 1 are used twice and move to the frequent list
+    for (size_t slot = 0; slot < 4; slot++)
+    {
+        keys[slot] = slot;
+        eviction_policy_insert(policy, slot, slot);
+    }
+    eviction_policy_access(policy, 0);
+    eviction_policy_access(policy, 1);
+
+    // a long scan of keys used once only replaces the recent list
+    for (size_t key = 100; key < 200; key++)
+    {
+        size_t slot = eviction_policy_victim(policy, key, NULL, NULL);
+        TEST_ASSERT_TRUE(slot != 0);
+        TEST_ASSERT_TRUE(slot != 1);
+        keys[slot] = key;
+        eviction_policy_insert(policy, slot, key);
+    }
+    TEST_ASSERT_EQUAL(0, keys[0]);
+    TEST_ASSERT_EQUAL(1, keys[1]);
+    eviction_policy_free(policy);
+}
+
+void test_arc_ghost_hit_goes_to_frequent_list(){
+    eviction_policy_t *policy = eviction_policy_init(EVICTION_POLICY_ARC, 4);
+    for (size_t slot = 0; slot < 4; slot++)
+    {
+        eviction_policy_insert(policy, slot, slot);
+    }
+
+    // key 0 is evicted and remembered as a ghost
+    TEST_ASSERT_EQUAL(0, eviction_policy_victim(policy, 4, NULL, NULL));
+    eviction_policy_insert(policy, 0, 4);
+
+    // key 0 comes back, the ghost hit places it on the frequent list
+    TEST_ASSERT_EQUAL(1, eviction_policy_victim(policy, 0, NULL, NULL));
+    eviction_policy_insert(policy, 1, 0);
+
+    // keys used once replace each other and never key 0
+    for (size_t key = 100; key < 110; key++)
+    {
+        size_t slot = eviction_policy_victim(policy, key, NULL, NULL);
+        TEST_ASSERT_TRUE(slot != 1);
+        eviction_policy_insert(policy, slot, key);
+    }
+    eviction_policy_free(policy);
+}
+
+void process()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_parse);
+    RUN_TEST(test_lru_evicts_least_recently_used);
+    RUN_TEST(test_clock_gives_second_chance);
+    RUN_TEST(test_victim_skips_pinned_slots);
+    RUN_TEST(test_arc_resists_scans);
+    RUN_TEST(test_arc_ghost_hit_goes_to_frequent_list);
+    UNITY_END();
+}
+
+MAIN()
+{
+    process();
+}
@@ -0,0 +1,134 @@
+#include <unity.h>
+#include <runner.h>
+
+#include <cutils.h>
+#include <iomem.h>
+
+void setUp()
+{
+}
+void tearDown()
+{
+}
+
+static uint32_t device_read(void *opaque, uint32_t offset, int size_log2)
+{
+    return 0;
+}
+
+static void device_write(void *opaque, uint32_t offset, uint32_t val, int size_log2)
+{
+}
+
+static PhysMemoryRange *add_device(PhysMemoryMap *map, uint64_t addr, uint64_t size)
+{
+    return cpu_register_device(map, addr, size, NULL, device_read, device_write, DEVIO_SIZE32);
+}
+
+void test_lookup_sorted_ranges(){
+    PhysMemoryMap *map = phys_mem_map_init();
+
+    // registered out of address order
+    PhysMemoryRange *high = add_device(map, 0x80000000, 0x10000);
+    PhysMemoryRange *low = add_device(map, 0x1000, 0x1000);
+    PhysMemoryRange *middle = add_device(map, 0x2000000, 0x10000);
+
+    TEST_ASSERT_EQUAL(3, map->n_sorted_range);
+    TEST_ASSERT_EQUAL_PTR(low, get_phys_mem_range(map, 0x1000));
+    TEST_ASSERT_EQUAL_PTR(low, get_phys_mem_range(map, 0x1fff));
+    TEST_ASSERT_EQUAL_PTR(middle, get_phys_mem_range(map, 0x2008000));
+    TEST_ASSERT_EQUAL_PTR(high, get_phys_mem_range(map, 0x8000ffff));
+    TEST_ASSERT_NULL(get_phys_mem_range(map, 0x0fff));
+    TEST_ASSERT_NULL(get_phys_mem_range(map, 0x2000));
+    TEST_ASSERT_NULL(get_phys_mem_range(map, 0x80010000));
+
+    phys_mem_map_end(map);
+}
+
+void test_overlapping_ranges_are_searched_in_registration_order(){
+    PhysMemoryMap *map = phys_mem_map_init();
+
+    PhysMemoryRange *outer = add_device(map, 0x10000, 0x10000);
+    PhysMemoryRange *inner = add_device(map, 0x14000, 0x1000);
+
+    TEST_ASSERT_EQUAL(-1, map->n_sorted_range);
+    TEST_ASSERT_EQUAL_PTR(outer, get_phys_mem_range(map, 0x14000));
+    TEST_ASSERT_EQUAL_PTR(outer, get_phys_mem_range(map, 0x1f000));
+    TEST_ASSERT_NULL(get_phys_mem_range(map, 0x20000));
+
+    // once the overlap is gone the ranges are sorted again
+    phys_mem_set_addr(outer, 0, FALSE);
+    TEST_ASSERT_EQUAL(1, map->n_sorted_range);
+    TEST_ASSERT_EQUAL_PTR(inner, get_phys_mem_range(map, 0x14000));
+    TEST_ASSERT_NULL(get_phys_mem_range(map, 0x1f000));
+
+    phys_mem_map_end(map);
+}
+
+void test_set_addr_moves_and_disables(){
+    PhysMemoryMap *map = phys_mem_map_init();
+
+    PhysMemoryRange *fixed = add_device(map, 0x1000, 0x1000);
+    PhysMemoryRange *moving = add_device(map, 0x4000, 0x1000);
+
+    phys_mem_set_addr(moving, 0x8000, TRUE);
+    TEST_ASSERT_NULL(get_phys_mem_range(map, 0x4000));
+    TEST_ASSERT_EQUAL_PTR(moving, get_phys_mem_range(map, 0x8800));
+
+    // moved below the other range, the order changes
+    phys_mem_set_addr(moving, 0x0000, TRUE);
+    TEST_ASSERT_EQUAL_PTR(moving, get_phys_mem_range(map, 0x0800));
+    TEST_ASSERT_EQUAL_PTR(fixed, get_phys_mem_range(map, 0x1800));
+    TEST_ASSERT_NULL(get_phys_mem_range(map, 0x8800));
+
+    phys_mem_set_addr(moving, 0, FALSE);
+    TEST_ASSERT_EQUAL(1, map->n_sorted_range);
+    TEST_ASSERT_NULL(get_phys_mem_range(map, 0x0800));
+
+    // and enabled again elsewhere
+    phys_mem_set_addr(moving, 0x6000, TRUE);
+    TEST_ASSERT_EQUAL_PTR(moving, get_phys_mem_range(map, 0x6000));
+
+    phys_mem_map_end(map);
+}
+
+void test_update_resets_last_range(){
+    PhysMemoryMap *map = phys_mem_map_init();
+
+    PhysMemoryRange *first = add_device(map, 0x1000, 0x1000);
+    PhysMemoryRange *second = add_device(map, 0x3000, 0x1000);
+
+    TEST_ASSERT_EQUAL_PTR(first, get_phys_mem_range(map, 0x1000));
+    TEST_ASSERT_EQUAL_PTR(first, map->last_range);
+    TEST_ASSERT_EQUAL_PTR(second, get_phys_mem_range(map, 0x3000));
+    TEST_ASSERT_EQUAL_PTR(second, map->last_range);
+
+    // the cached range is dropped when the table is rebuilt
+    phys_mem_set_addr(second, 0x5000, TRUE);
+    TEST_ASSERT_NULL(map->last_range);
+    TEST_ASSERT_NULL(get_phys_mem_range(map, 0x3000));
+
+    add_device(map, 0x8000, 0x1000);
+    TEST_ASSERT_NULL(map->last_range);
+    TEST_ASSERT_EQUAL_PTR(first, get_phys_mem_range(map, 0x1800));
+    TEST_ASSERT_EQUAL_PTR(first, map->last_range);
+
+    phys_mem_map_end(map);
+}
+
+
+void process()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_lookup_sorted_ranges);
+    RUN_TEST(test_overlapping_ranges_are_searched_in_registration_order);
+    RUN_TEST(test_set_addr_moves_and_disables);
+    RUN_TEST(test_update_resets_last_range);
+
+    UNITY_END();
+}
+
+MAIN()
+{
+    process();
+}
@@ -69,6 +69,50 @@ void test_add_element_update_and_search(){
     TEST_ASSERT_EQUAL(1, number_of_deleted_elements);
 }
 
+static void check_indexer_against_reference(memory_indexer_type_t type, size_t capacity)
+{
+    static char values[4096];
+    memory_indexer_t * indexer = memory_indexer_init_with_capacity(type, capacity);
+
+    // more keys than the capacity hint so the tables have to grow
+    for (size_t key = 0; key < 4096; key += 3){
+        memory_indexer_set(indexer, key, &values[key]);
+    }
+    for (size_t key = 0; key < 4096; key += 6){
+        memory_indexer_remove(indexer, key);
+    }
+    memory_indexer_set(indexer, 9, &values[10]);
+
+    size_t expected_elements = 0;
+    for (size_t key = 0; key < 4096; key++){
+        void * expected = NULL;
+        if (key == 9){
+            expected = &values[10];
+        } else if ((key % 3) == 0 && (key % 6) != 0){
+            expected = &values[key];
+        }
+        if (expected != NULL){
+            expected_elements++;
+        }
+        TEST_ASSERT_EQUAL_PTR(expected, memory_indexer_search(indexer, key));
+    }
+
+    size_t number_of_deleted_elements = memory_indexer_free(indexer);
+    TEST_ASSERT_EQUAL(expected_elements, number_of_deleted_elements);
+}
+
+void test_direct_indexer(){
+    check_indexer_against_reference(MEMORY_INDEXER_DIRECT, 16);
+}
+
+void test_hash_indexer(){
+    check_indexer_against_reference(MEMORY_INDEXER_HASH, 16);
+}
+
+void test_avl_indexer(){
+    check_indexer_against_reference(MEMORY_INDEXER_AVL, 0);
+}
+
 
 void process()
 {
@@ -78,6 +122,9 @@ void process()
     RUN_TEST(test_add_element_and_search);
     RUN_TEST(test_add_element_search_and_remove);
     RUN_TEST(test_add_element_update_and_search);
+    RUN_TEST(test_direct_indexer);
+    RUN_TEST(test_hash_indexer);
+    RUN_TEST(test_avl_indexer);
     UNITY_END();
 }
 
@@ -0,0 +1,30 @@
+#!/bin/sh
+# builds riscv_bench with the computed goto and the switch dispatch and compares their MIPS
+# usage: compare.sh [riscv_bench options], CC and CFLAGS are honoured
+set -e
+
+root=$(cd "$(dirname "$0")/../.." && pwd)
+out=${OUT:-/tmp/riscv_bench}
+mkdir -p "$out"
+
+includes=""
+for dir in "$root"/lib/*/ "$root"/lib/HimemAllocator/himem_access/; do
+    includes="$includes -I$dir"
+done
+sources="$root/tools/riscv_bench/riscv_bench.c
+    $root/lib/tinyemu/riscv_cpu32.c $root/lib/tinyemu/riscv_cpu64.c
+    $root/lib/tinyemu/softfp.c $root/lib/tinyemu/iomem.c $root/lib/tinyemu/cutils.c
+    $root/lib/VMM/*.c $root/lib/virtual_directory/*.c $root/lib/compressed_cache/*.c
+    $root/lib/direct_cache/*.c $root/lib/eviction_policy/*.c $root/lib/page_cache/*.c
+    $root/lib/memory_indexer/*.c $root/lib/avltree/*.c
+    $root/lib/HimemAllocator/himem_allocator.c
+    $root/lib/HimemAllocator/himem_access/emulated_himem.c"
+flags="${CFLAGS:--O3} -D_GNU_SOURCE -DCONFIG_VERSION=\"bench\" -DCONFIG_RISCV_MAX_XLEN=32"
+
+${CC:-cc} $flags $includes $sources -o "$out/riscv_bench_threaded" -lm -lpthread
+${CC:-cc} $flags -DCONFIG_SWITCH_DISPATCH $includes $sources -o "$out/riscv_bench_switch" -lm -lpthread
+
+cd "$out"
+threaded=$(./riscv_bench_threaded "$@" | tee /dev/stderr | tail -n 1 | awk '{ print $2 }')
+switch=$(./riscv_bench_switch "$@" | tee /dev/stderr | tail -n 1 | awk '{ print $2 }')
+echo "threaded $threaded MIPS, switch $switch MIPS, speedup $(awk "BEGIN { printf \"%.2f\", $threaded / $switch }")"
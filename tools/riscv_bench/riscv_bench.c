@@ -0,0 +1,168 @@
+// runs a fixed RV32IMC workload on the interpreter and reports the emulated MIPS, build it
+// once per dispatch mode to compare the computed goto dispatch with the switch
+//
+// build: see README.md, CONFIG_SWITCH_DISPATCH selects the switch dispatch
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "cutils.h"
+#include "iomem.h"
+#include "riscv_cpu.h"
+#include "vmm.h"
+
+#if defined(__GNUC__) && !defined(CONFIG_SWITCH_DISPATCH)
+#define DISPATCH_NAME "threaded"
+#else
+#define DISPATCH_NAME "switch"
+#endif
+
+#define RAM_SIZE 0x10000
+#define WORKLOAD_ADDR 0x1000 // reset pc
+#define CHECKSUM_ADDR 0x3ffc
+#define CYCLES_PER_CALL 500000
+
+// fills a table with an LCG, sums it through a call per element and mixes in
+// byte and half loads and a division, forever. The offsets are from 0x1000.
+static const uint8_t workload[] = {
+    0x37, 0x81, 0x00, 0x00,   /* 000: lui sp, 8 */
+    0x37, 0x44, 0x00, 0x00,   /* 004: lui s0, 4 */
+    0xb7, 0x54, 0x34, 0x12,   /* 008: lui s1, 74565 */
+    0x93, 0x84, 0x84, 0x67,   /* 00c: addi s1, s1, 1656 */
+    /* loop: */
+    0x13, 0x05, 0x04, 0x00,   /* 010: mv a0, s0 */
+    0x93, 0x05, 0x00, 0x10,   /* 014: li a1, 256 */
+    0x13, 0x86, 0x04, 0x00,   /* 018: mv a2, s1 */
+    0xb7, 0x56, 0xc6, 0x41,   /* 01c: lui a3, 269413 */
+    0x93, 0x86, 0xd6, 0xe6,   /* 020: addi a3, a3, -403 */
+    /* fill: */
+    0x33, 0x06, 0xd6, 0x02,   /* 024: mul a2, a2, a3 */
+    0x13, 0x06, 0x56, 0x4d,   /* 028: addi a2, a2, 1237 */
+    0x23, 0x20, 0xc5, 0x00,   /* 02c: sw a2, 0(a0) */
+    0x13, 0x05, 0x45, 0x00,   /* 030: addi a0, a0, 4 */
+    0x93, 0x85, 0xf5, 0xff,   /* 034: addi a1, a1, -1 */
+    0xe3, 0x96, 0x05, 0xfe,   /* 038: bnez a1, fill */
+    0x13, 0x09, 0x04, 0x00,   /* 03c: mv s2, s0 */
+    0x93, 0x09, 0x00, 0x10,   /* 040: li s3, 256 */
+    /* sum: */
+    0x03, 0x25, 0x09, 0x00,   /* 044: lw a0, 0(s2) */
+    0x97, 0x00, 0x00, 0x00,   /* 048: auipc ra, 0 */
+    0xe7, 0x80, 0x40, 0x04,   /* 04c: jalr 68(ra) */
+    0xb3, 0x84, 0xa4, 0x00,   /* 050: add s1, s1, a0 */
+    0x13, 0x09, 0x49, 0x00,   /* 054: addi s2, s2, 4 */
+    0x93, 0x89, 0xf9, 0xff,   /* 058: addi s3, s3, -1 */
+    0xe3, 0x94, 0x09, 0xfe,   /* 05c: bnez s3, sum */
+    0x83, 0x42, 0x14, 0x00,   /* 060: lbu t0, 1(s0) */
+    0x03, 0x13, 0x64, 0x00,   /* 064: lh t1, 6(s0) */
+    0xb3, 0xc4, 0x54, 0x00,   /* 068: xor s1, s1, t0 */
+    0xb3, 0x84, 0x64, 0x40,   /* 06c: sub s1, s1, t1 */
+    0x93, 0xe3, 0x14, 0x00,   /* 070: ori t2, s1, 1 */
+    0x33, 0xde, 0x74, 0x02,   /* 074: divu t3, s1, t2 */
+    0xb3, 0xfe, 0x74, 0x02,   /* 078: remu t4, s1, t2 */
+    0xb3, 0x84, 0xc4, 0x01,   /* 07c: add s1, s1, t3 */
+    0xb3, 0x84, 0xd4, 0x01,   /* 080: add s1, s1, t4 */
+    0x23, 0x2e, 0x94, 0xfe,   /* 084: sw s1, -4(s0) */
+    0x6f, 0xf0, 0x9f, 0xf8,   /* 088: j loop */
+    /* mix: */
+    0xaa, 0x87,               /* 08c: mv a5, a0 */
+    0x9d, 0x83,               /* 08e: srli a5, a5, 7 */
+    0x3d, 0x8d,               /* 090: xor a0, a0, a5 */
+    0x0e, 0x05,               /* 092: slli a0, a0, 3 */
+    0x3e, 0x95,               /* 094: add a0, a0, a5 */
+    0x33, 0x37, 0xf5, 0x00,   /* 096: sltu a4, a0, a5 */
+    0x3a, 0x95,               /* 09a: add a0, a0, a4 */
+    0x93, 0x57, 0xb5, 0x40,   /* 09c: srai a5, a0, 11 */
+    0xe9, 0x8f,               /* 0a0: and a5, a5, a0 */
+    0x3d, 0x8d,               /* 0a2: xor a0, a0, a5 */
+    0x79, 0x99,               /* 0a4: andi a0, a0, -2 */
+    0x63, 0x43, 0x05, 0x00,   /* 0a6: bltz a0, mix+0x20 */
+    0x05, 0x05,               /* 0aa: addi a0, a0, 1 */
+    0x82, 0x80,               /* 0ac: ret */
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void flush_tlb_host_range(void *opaque, uint8_t *host_addr, size_t host_size)
+{
+    riscv_cpu_flush_tlb_host_range(opaque, host_addr, host_size);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: riscv_bench [-n million_instructions] [-r runs]\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t instructions = 200 * 1000000ULL;
+    int runs = 3;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (argv[i][0] != '-' || i + 1 >= argc)
+        {
+            usage();
+        }
+        char *value = argv[++i];
+        switch (argv[i - 1][1])
+        {
+        case 'n':
+            instructions = (uint64_t)(atof(value) * 1000000);
+            break;
+        case 'r':
+            runs = atoi(value);
+            break;
+        default:
+            usage();
+        }
+    }
+    if (instructions == 0 || runs <= 0)
+    {
+        usage();
+    }
+
+    double best = 0;
+    uint32_t checksum = 0;
+    for (int run = 0; run < runs; run++)
+    {
+        PhysMemoryMap *mem_map = phys_mem_map_init();
+        mem_map->flush_tlb_host_range = flush_tlb_host_range;
+        RISCVCPUState *cpu = riscv_cpu_init(mem_map, 32);
+        mem_map->opaque = cpu;
+        PhysMemoryRange *pr = cpu_register_ram(mem_map, 0, RAM_SIZE, 0);
+        vmm_write(pr->vmm, WORKLOAD_ADDR, workload, sizeof(workload));
+
+        double start = now();
+        uint64_t executed;
+        while ((executed = riscv_cpu_get_cycles(cpu)) < instructions)
+        {
+            uint64_t left = instructions - executed;
+            riscv_cpu_interp(cpu, left < CYCLES_PER_CALL ? (int)left : CYCLES_PER_CALL);
+        }
+        double seconds = now() - start;
+
+        vmm_read(pr->vmm, CHECKSUM_ADDR, &checksum, sizeof(checksum));
+        double mips = executed / seconds / 1e6;
+        printf("%s run %d: %" PRIu64 " instructions in %.3f s, %.1f MIPS, checksum %08x\n",
+               DISPATCH_NAME, run + 1, executed, seconds, mips, checksum);
+        if (mips > best)
+        {
+            best = mips;
+        }
+
+        riscv_cpu_end(cpu);
+        phys_mem_map_end(mem_map);
+    }
+    printf("%s: %.1f MIPS\n", DISPATCH_NAME, best);
+    return 0;
+}
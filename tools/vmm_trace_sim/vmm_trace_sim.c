@@ -0,0 +1,616 @@
+// replays a VMM page trace (see vmm_trace_start in lib/VMM/vmm.h) against several
+// eviction policies, pool sizes and page sizes and reports hit rates and modelled SD card I/O
+//
+// build: cc -O2 -o vmm_trace_sim vmm_trace_sim.c
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define VMM_TRACE_MAGIC "VMMTRC01"
+
+enum
+{
+    ACCESS_READ,
+    ACCESS_WRITE,
+    ACCESS_CODE,
+};
+
+typedef struct trace_t
+{
+    uint32_t page_size;
+    size_t length;
+    uint32_t *pages;
+    uint8_t *access;
+    size_t max_page;
+} trace_t;
+
+typedef struct result_t
+{
+    size_t hits;
+    size_t misses;
+    size_t writebacks;
+} result_t;
+
+/* ---------------------------------------------------------------- trace */
+
+static bool load_trace(const char *filename, trace_t *trace)
+{
+    FILE *f = fopen(filename, "rb");
+    if (!f)
+    {
+        perror(filename);
+        return false;
+    }
+    uint8_t header[12];
+    if (fread(header, 1, sizeof(header), f) != sizeof(header) || memcmp(header, VMM_TRACE_MAGIC, 8) != 0)
+    {
+        fprintf(stderr, "%s: not a VMM trace\n", filename);
+        fclose(f);
+        return false;
+    }
+    trace->page_size = header[8] | (header[9] << 8) | (header[10] << 16) | ((uint32_t)header[11] << 24);
+
+    size_t capacity = 1 << 20;
+    trace->length = 0;
+    trace->max_page = 0;
+    trace->pages = malloc(capacity * sizeof(uint32_t));
+    trace->access = malloc(capacity);
+
+    int64_t page = 0;
+    uint64_t value = 0;
+    int shift = 0;
+    int c;
+    while ((c = fgetc(f)) != EOF)
+    {
+        value |= (uint64_t)(c & 0x7f) << shift;
+        shift += 7;
+        if (c & 0x80)
+        {
+            continue;
+        }
+        uint64_t zigzag = value >> 2;
+        int64_t delta = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+        page += delta;
+        if (trace->length == capacity)
+        {
+            capacity *= 2;
+            trace->pages = realloc(trace->pages, capacity * sizeof(uint32_t));
+            trace->access = realloc(trace->access, capacity);
+        }
+        trace->pages[trace->length] = (uint32_t)page;
+        trace->access[trace->length] = value & 3;
+        trace->length++;
+        if ((size_t)page > trace->max_page)
+        {
+            trace->max_page = page;
+        }
+        value = 0;
+        shift = 0;
+    }
+    fclose(f);
+    return true;
+}
+
+/* ---------------------------------------------------------------- lists */
+
+// intrusive doubly linked lists over page numbers, a page is on at most one list
+
+#define NIL UINT32_MAX
+
+typedef struct list_t
+{
+    uint32_t head; // most recent
+    uint32_t tail; // least recent
+    size_t size;
+} list_t;
+
+typedef struct sim_t
+{
+    size_t number_of_pages;
+    size_t capacity;
+    uint32_t *prev;
+    uint32_t *next;
+    int8_t *where; // list index, -1 when not tracked
+    bool *dirty;
+    list_t lists[4];
+    result_t result;
+} sim_t;
+
+static void list_remove(sim_t *sim, uint32_t page)
+{
+    list_t *list = &sim->lists[sim->where[page]];
+    if (sim->prev[page] != NIL)
+        sim->next[sim->prev[page]] = sim->next[page];
+    else
+        list->head = sim->next[page];
+    if (sim->next[page] != NIL)
+        sim->prev[sim->next[page]] = sim->prev[page];
+    else
+        list->tail = sim->prev[page];
+    list->size--;
+    sim->where[page] = -1;
+}
+
+static void list_push_head(sim_t *sim, int index, uint32_t page)
+{
+    list_t *list = &sim->lists[index];
+    sim->prev[page] = NIL;
+    sim->next[page] = list->head;
+    if (list->head != NIL)
+        sim->prev[list->head] = page;
+    else
+        list->tail = page;
+    list->head = page;
+    list->size++;
+    sim->where[page] = index;
+}
+
+static uint32_t list_pop_tail(sim_t *sim, int index)
+{
+    uint32_t page = sim->lists[index].tail;
+    if (page != NIL)
+    {
+        list_remove(sim, page);
+    }
+    return page;
+}
+
+static void sim_init(sim_t *sim, size_t number_of_pages, size_t capacity)
+{
+    memset(sim, 0, sizeof(*sim));
+    sim->number_of_pages = number_of_pages;
+    sim->capacity = capacity;
+    sim->prev = malloc(number_of_pages * sizeof(uint32_t));
+    sim->next = malloc(number_of_pages * sizeof(uint32_t));
+    sim->where = malloc(number_of_pages);
+    sim->dirty = calloc(number_of_pages, sizeof(bool));
+    memset(sim->where, -1, number_of_pages);
+    for (int i = 0; i < 4; i++)
+    {
+        sim->lists[i].head = sim->lists[i].tail = NIL;
+    }
+}
+
+static void sim_free(sim_t *sim)
+{
+    free(sim->prev);
+    free(sim->next);
+    free(sim->where);
+    free(sim->dirty);
+}
+
+static void evict(sim_t *sim, uint32_t page)
+{
+    if (sim->dirty[page])
+    {
+        sim->result.writebacks++;
+        sim->dirty[page] = false;
+    }
+}
+
+/* ---------------------------------------------------------------- policies */
+
+typedef void (*policy_access_t)(sim_t *sim, uint32_t page);
+
+static void lru_access(sim_t *sim, uint32_t page)
+{
+    if (sim->where[page] == 0)
+    {
+        sim->result.hits++;
+        list_remove(sim, page);
+    }
+    else
+    {
+        sim->result.misses++;
+        if (sim->lists[0].size >= sim->capacity)
+        {
+            evict(sim, list_pop_tail(sim, 0));
+        }
+    }
+    list_push_head(sim, 0, page);
+}
+
+// CLOCK: prev holds the referenced bit, where is 0 for resident pages
+static uint32_t *clock_frames;
+static size_t clock_used;
+static size_t clock_hand;
+
+static void clock_access(sim_t *sim, uint32_t page)
+{
+    if (sim->where[page] == 0)
+    {
+        sim->result.hits++;
+        sim->prev[page] = 1;
+        return;
+    }
+    sim->result.misses++;
+    size_t frame;
+    if (clock_used < sim->capacity)
+    {
+        frame = clock_used++;
+    }
+    else
+    {
+        for (;;)
+        {
+            uint32_t victim = clock_frames[clock_hand];
+            frame = clock_hand;
+            clock_hand = (clock_hand + 1) % sim->capacity;
+            if (sim->prev[victim])
+            {
+                sim->prev[victim] = 0;
+                continue;
+            }
+            sim->where[victim] = -1;
+            evict(sim, victim);
+            break;
+        }
+    }
+    clock_frames[frame] = page;
+    sim->where[page] = 0;
+    sim->prev[page] = 1;
+}
+
+// LFU: prev holds the access count, next the last access time, ties go to the least recent
+static uint32_t *lfu_frames;
+static size_t lfu_used;
+static uint32_t lfu_time;
+
+static void lfu_access(sim_t *sim, uint32_t page)
+{
+    lfu_time++;
+    if (sim->where[page] == 0)
+    {
+        sim->result.hits++;
+        sim->prev[page]++;
+        sim->next[page] = lfu_time;
+        return;
+    }
+    sim->result.misses++;
+    size_t frame = lfu_used;
+    if (lfu_used < sim->capacity)
+    {
+        lfu_used++;
+    }
+    else
+    {
+        frame = 0;
+        for (size_t i = 1; i < sim->capacity; i++)
+        {
+            uint32_t a = lfu_frames[i], b = lfu_frames[frame];
+            if (sim->prev[a] < sim->prev[b] || (sim->prev[a] == sim->prev[b] && sim->next[a] < sim->next[b]))
+            {
+                frame = i;
+            }
+        }
+        sim->where[lfu_frames[frame]] = -1;
+        evict(sim, lfu_frames[frame]);
+    }
+    lfu_frames[frame] = page;
+    sim->where[page] = 0;
+    sim->prev[page] = 1;
+    sim->next[page] = lfu_time;
+}
+
+// 2Q (full version): A1in fifo of new pages, A1out ghost list of pages evicted from A1in, Am lru
+enum
+{
+    Q_A1IN,
+    Q_A1OUT,
+    Q_AM,
+};
+
+static void twoq_reclaim(sim_t *sim)
+{
+    if (sim->lists[Q_A1IN].size + sim->lists[Q_AM].size < sim->capacity)
+    {
+        return;
+    }
+    size_t kin = sim->capacity / 4 ? sim->capacity / 4 : 1;
+    size_t kout = sim->capacity / 2 ? sim->capacity / 2 : 1;
+    if (sim->lists[Q_A1IN].size > kin || sim->lists[Q_AM].size == 0)
+    {
+        uint32_t victim = list_pop_tail(sim, Q_A1IN);
+        evict(sim, victim);
+        list_push_head(sim, Q_A1OUT, victim);
+        if (sim->lists[Q_A1OUT].size > kout)
+        {
+            list_pop_tail(sim, Q_A1OUT);
+        }
+    }
+    else
+    {
+        evict(sim, list_pop_tail(sim, Q_AM));
+    }
+}
+
+static void twoq_access(sim_t *sim, uint32_t page)
+{
+    switch (sim->where[page])
+    {
+    case Q_AM:
+        sim->result.hits++;
+        list_remove(sim, page);
+        list_push_head(sim, Q_AM, page);
+        break;
+    case Q_A1IN:
+        sim->result.hits++;
+        break;
+    case Q_A1OUT:
+        sim->result.misses++;
+        list_remove(sim, page);
+        twoq_reclaim(sim);
+        list_push_head(sim, Q_AM, page);
+        break;
+    default:
+        sim->result.misses++;
+        twoq_reclaim(sim);
+        list_push_head(sim, Q_A1IN, page);
+        break;
+    }
+}
+
+// ARC (Megiddo & Modha): T1/T2 resident, B1/B2 ghosts, p is the target size of T1
+enum
+{
+    ARC_T1,
+    ARC_T2,
+    ARC_B1,
+    ARC_B2,
+};
+static size_t arc_p;
+
+static void arc_replace(sim_t *sim, bool in_b2)
+{
+    uint32_t victim;
+    if (sim->lists[ARC_T1].size > 0 && (sim->lists[ARC_T1].size > arc_p || (in_b2 && sim->lists[ARC_T1].size == arc_p)))
+    {
+        victim = list_pop_tail(sim, ARC_T1);
+        list_push_head(sim, ARC_B1, victim);
+    }
+    else
+    {
+        victim = list_pop_tail(sim, ARC_T2);
+        list_push_head(sim, ARC_B2, victim);
+    }
+    evict(sim, victim);
+}
+
+static void arc_access(sim_t *sim, uint32_t page)
+{
+    const size_t c = sim->capacity;
+    size_t b1 = sim->lists[ARC_B1].size, b2 = sim->lists[ARC_B2].size;
+    switch (sim->where[page])
+    {
+    case ARC_T1:
+    case ARC_T2:
+        sim->result.hits++;
+        list_remove(sim, page);
+        list_push_head(sim, ARC_T2, page);
+        return;
+    case ARC_B1:
+        sim->result.misses++;
+        arc_p += (b1 >= b2) ? 1 : b2 / b1;
+        if (arc_p > c)
+            arc_p = c;
+        list_remove(sim, page);
+        arc_replace(sim, false);
+        list_push_head(sim, ARC_T2, page);
+        return;
+    case ARC_B2:
+    {
+        sim->result.misses++;
+        size_t delta = (b2 >= b1) ? 1 : b1 / b2;
+        arc_p = (arc_p > delta) ? arc_p - delta : 0;
+        list_remove(sim, page);
+        arc_replace(sim, true);
+        list_push_head(sim, ARC_T2, page);
+        return;
+    }
+    default:
+        break;
+    }
+
+    sim->result.misses++;
+    size_t l1 = sim->lists[ARC_T1].size + b1;
+    size_t total = l1 + sim->lists[ARC_T2].size + b2;
+    if (l1 == c)
+    {
+        if (sim->lists[ARC_T1].size < c)
+        {
+            list_pop_tail(sim, ARC_B1);
+            arc_replace(sim, false);
+        }
+        else
+        {
+            evict(sim, list_pop_tail(sim, ARC_T1));
+        }
+    }
+    else if (l1 < c && total >= c)
+    {
+        if (total == 2 * c)
+        {
+            list_pop_tail(sim, ARC_B2);
+        }
+        arc_replace(sim, false);
+    }
+    list_push_head(sim, ARC_T1, page);
+}
+
+typedef struct policy_t
+{
+    const char *name;
+    policy_access_t access;
+} policy_t;
+
+static const policy_t policies[] = {
+    {"lru", lru_access},
+    {"clock", clock_access},
+    {"arc", arc_access},
+    {"2q", twoq_access},
+    {"lfu", lfu_access},
+};
+
+#define NUMBER_OF_POLICIES (sizeof(policies) / sizeof(policies[0]))
+
+static result_t simulate(const trace_t *trace, const policy_t *policy, size_t multiple, size_t capacity)
+{
+    sim_t sim;
+    sim_init(&sim, trace->max_page / multiple + 1, capacity);
+    clock_frames = malloc(capacity * sizeof(uint32_t));
+    lfu_frames = malloc(capacity * sizeof(uint32_t));
+    clock_used = clock_hand = lfu_used = lfu_time = 0;
+    arc_p = 0;
+
+    for (size_t i = 0; i < trace->length; i++)
+    {
+        uint32_t page = trace->pages[i] / multiple;
+        policy->access(&sim, page);
+        if (trace->access[i] == ACCESS_WRITE)
+        {
+            sim.dirty[page] = true;
+        }
+    }
+
+    free(clock_frames);
+    free(lfu_frames);
+    result_t result = sim.result;
+    sim_free(&sim);
+    return result;
+}
+
+/* ---------------------------------------------------------------- main */
+
+static size_t parse_list(char *arg, size_t *values, size_t max)
+{
+    size_t count = 0;
+    for (char *token = strtok(arg, ","); token != NULL && count < max; token = strtok(NULL, ","))
+    {
+        values[count++] = strtoul(token, NULL, 0);
+    }
+    return count;
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "usage: vmm_trace_sim [options] trace\n"
+            "  -n pages[,pages..]       resident pool sizes in pages (default 400)\n"
+            "  -s size[,size..]         simulated page sizes in bytes, multiples of the traced page size\n"
+            "  -p policy[,policy..]     lru, clock, arc, 2q, lfu (default all)\n"
+            "  -l latency_us            modelled SD card latency per page transfer (default 1000)\n"
+            "  -b kbytes_per_second     modelled SD card bandwidth (default 4096)\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    size_t pools[16] = {400};
+    size_t number_of_pools = 1;
+    size_t page_sizes[16] = {0};
+    size_t number_of_page_sizes = 1;
+    bool selected[NUMBER_OF_POLICIES];
+    double latency_us = 1000;
+    double kbytes_per_second = 4096;
+    const char *filename = NULL;
+
+    for (size_t i = 0; i < NUMBER_OF_POLICIES; i++)
+    {
+        selected[i] = true;
+    }
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (argv[i][0] != '-')
+        {
+            filename = argv[i];
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            usage();
+        }
+        char *value = argv[++i];
+        switch (argv[i - 1][1])
+        {
+        case 'n':
+            number_of_pools = parse_list(value, pools, 16);
+            break;
+        case 's':
+            number_of_page_sizes = parse_list(value, page_sizes, 16);
+            break;
+        case 'p':
+            for (size_t p = 0; p < NUMBER_OF_POLICIES; p++)
+            {
+                selected[p] = false;
+            }
+            for (char *token = strtok(value, ","); token != NULL; token = strtok(NULL, ","))
+            {
+                size_t p;
+                for (p = 0; p < NUMBER_OF_POLICIES && strcmp(policies[p].name, token) != 0; p++)
+                    ;
+                if (p == NUMBER_OF_POLICIES)
+                {
+                    fprintf(stderr, "unknown policy %s\n", token);
+                    usage();
+                }
+                selected[p] = true;
+            }
+            break;
+        case 'l':
+            latency_us = atof(value);
+            break;
+        case 'b':
+            kbytes_per_second = atof(value);
+            break;
+        default:
+            usage();
+        }
+    }
+    if (filename == NULL)
+    {
+        usage();
+    }
+
+    trace_t trace;
+    if (!load_trace(filename, &trace))
+    {
+        return 1;
+    }
+    printf("%s: %zu accesses, page size %u, %zu pages\n", filename, trace.length, trace.page_size, trace.max_page + 1);
+    printf("%-6s %9s %7s %10s %10s %10s %12s %10s\n", "policy", "page_size", "pages", "hits", "misses", "hit_rate", "writebacks", "io_sec");
+
+    for (size_t s = 0; s < number_of_page_sizes; s++)
+    {
+        size_t page_size = page_sizes[s] ? page_sizes[s] : trace.page_size;
+        if (page_size < trace.page_size || page_size % trace.page_size != 0)
+        {
+            fprintf(stderr, "page size %zu is not a multiple of the traced page size %u\n", page_size, trace.page_size);
+            continue;
+        }
+        for (size_t n = 0; n < number_of_pools; n++)
+        {
+            for (size_t p = 0; p < NUMBER_OF_POLICIES; p++)
+            {
+                if (!selected[p] || pools[n] == 0)
+                {
+                    continue;
+                }
+                result_t result = simulate(&trace, &policies[p], page_size / trace.page_size, pools[n]);
+                size_t transfers = result.misses + result.writebacks;
+                double io_sec = transfers * (latency_us / 1e6 + (double)page_size / (kbytes_per_second * 1024));
+                printf("%-6s %9zu %7zu %10zu %10zu %9.2f%% %12zu %10.2f\n",
+                       policies[p].name, page_size, pools[n],
+                       result.hits, result.misses,
+                       trace.length ? 100.0 * result.hits / trace.length : 0.0,
+                       result.writebacks, io_sec);
+            }
+        }
+    }
+    free(trace.pages);
+    free(trace.access);
+    return 0;
+}